@@ -0,0 +1,372 @@
+/**
+ * @file bench.c
+ * @brief Worker management, timing and reporting for the mailbox benchmarks.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#ifdef MAILBOX_SIM
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include "sim.h"
+#endif
+
+#include "bench.h"
+
+struct bench_opts bench_opts = {
+    .senders = 1,
+    .receivers = 1,
+    .count = 1000,
+    .size = 64,
+    .mailboxes = 1,
+    .acl = 0,
+    .batch = 1,
+    .seconds = 30,
+};
+
+static volatile sig_atomic_t stopping;
+static uint64_t deadline;
+
+struct bench_worker {
+  int index;
+  bench_fn fn;
+#ifdef MAILBOX_SIM
+  pthread_t tid;
+#else
+  pid_t pid;
+  int fd;
+#endif
+  struct bench_stats st;
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-s senders] [-r receivers] [-n count] [-m size]\n"
+          "          [-b mailboxes] [-a acl_size] [-k batch] [-t seconds]\n",
+          prog);
+  exit(1);
+}
+
+void bench_parse(int argc, char *argv[], int max_size) {
+  int c;
+
+  while ((c = getopt(argc, argv, "s:r:n:m:b:a:k:t:")) != -1) {
+    switch (c) {
+    case 's':
+      bench_opts.senders = atoi(optarg);
+      break;
+    case 'r':
+      bench_opts.receivers = atoi(optarg);
+      break;
+    case 'n':
+      bench_opts.count = atoi(optarg);
+      break;
+    case 'm':
+      bench_opts.size = atoi(optarg);
+      break;
+    case 'b':
+      bench_opts.mailboxes = atoi(optarg);
+      break;
+    case 'a':
+      bench_opts.acl = atoi(optarg);
+      break;
+    case 'k':
+      bench_opts.batch = atoi(optarg);
+      break;
+    case 't':
+      bench_opts.seconds = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (bench_opts.senders < 1 || bench_opts.receivers < 1 ||
+      bench_opts.count < 1 || bench_opts.mailboxes < 1 ||
+      bench_opts.acl < 0 || bench_opts.batch < 1 || bench_opts.seconds < 1) {
+    usage(argv[0]);
+  }
+  if (bench_opts.size < 1 || bench_opts.size > max_size) {
+    fprintf(stderr, "%s: message size must be between 1 and %d bytes\n",
+            argv[0], max_size);
+    exit(1);
+  }
+  /* Single-process runs count from here, bench_run() restarts the clock */
+  deadline = bench_now_ns() + (uint64_t)bench_opts.seconds * 1000000000ULL;
+}
+
+uint64_t bench_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int bench_bucket(uint64_t ns) {
+  int msb, shift;
+
+  if (ns < BENCH_SUB) {
+    return (int)ns;
+  }
+  msb = 63 - __builtin_clzll(ns);
+  shift = msb - BENCH_SUB_BITS;
+  return (shift + 1) * BENCH_SUB + (int)((ns >> shift) & (BENCH_SUB - 1));
+}
+
+/* Midpoint of a histogram bucket, in nanoseconds */
+static double bench_bucket_ns(int bucket) {
+  int shift;
+
+  if (bucket < BENCH_SUB) {
+    return bucket;
+  }
+  shift = bucket / BENCH_SUB - 1;
+  return ((double)(BENCH_SUB + bucket % BENCH_SUB) + 0.5) * (double)(1ULL << shift);
+}
+
+void bench_record(struct bench_stats *st, uint64_t ns, uint64_t bytes) {
+  st->ops++;
+  st->bytes += bytes;
+  st->hist[bench_bucket(ns)]++;
+}
+
+static void bench_merge(struct bench_stats *dst, const struct bench_stats *src) {
+  int i;
+
+  dst->ops += src->ops;
+  dst->bytes += src->bytes;
+  dst->failed += src->failed;
+  for (i = 0; i < BENCH_BUCKETS; i++) {
+    dst->hist[i] += src->hist[i];
+  }
+}
+
+static double bench_percentile(const struct bench_stats *st, double p) {
+  uint64_t target, seen = 0;
+  int i;
+
+  if (st->ops == 0) {
+    return 0;
+  }
+  target = (uint64_t)(p * (double)st->ops);
+  if (target == 0) {
+    target = 1;
+  }
+  for (i = 0; i < BENCH_BUCKETS; i++) {
+    seen += st->hist[i];
+    if (seen >= target) {
+      return bench_bucket_ns(i);
+    }
+  }
+  return bench_bucket_ns(BENCH_BUCKETS - 1);
+}
+
+static void bench_report(const char *label, const char *failed_label,
+                         const struct bench_stats *st, double seconds) {
+  printf("%-8s ok=%llu %s=%llu msgs/s=%.0f bytes/s=%.0f "
+         "p50_us=%.2f p99_us=%.2f p999_us=%.2f\n",
+         label, (unsigned long long)st->ops, failed_label,
+         (unsigned long long)st->failed, (double)st->ops / seconds,
+         (double)st->bytes / seconds, bench_percentile(st, 0.50) / 1000.0,
+         bench_percentile(st, 0.99) / 1000.0,
+         bench_percentile(st, 0.999) / 1000.0);
+}
+
+int bench_stopping(void) { return stopping; }
+
+int bench_expired(void) { return bench_now_ns() > deadline; }
+
+#ifdef MAILBOX_SIM
+
+void bench_become(uid_t uid) {
+  sim_attach(sim_spawn(uid == BENCH_ANY_UID ? getuid() : uid));
+}
+
+void bench_backoff(void) { sched_yield(); }
+
+/* The simulated server shares this process's heap */
+size_t bench_heap_bytes(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+static void *bench_thread(void *arg) {
+  struct bench_worker *w = arg;
+
+  w->fn(w->index, &w->st);
+  return NULL;
+}
+
+static int bench_start(struct bench_worker *w) {
+  return pthread_create(&w->tid, NULL, bench_thread, w) == 0 ? 0 : -1;
+}
+
+static void bench_stop(struct bench_worker *w, int n) { stopping = 1; }
+
+static void bench_wait(struct bench_worker *w) { pthread_join(w->tid, NULL); }
+
+#else /* !MAILBOX_SIM */
+
+void bench_become(uid_t uid) {
+  if (uid != BENCH_ANY_UID && getuid() != uid && setuid(uid) != 0) {
+    perror("bench: setuid");
+    _exit(1);
+  }
+}
+
+/* The server round trip that just failed already gave up the CPU */
+void bench_backoff(void) {}
+
+/* The server's heap lives in another address space */
+size_t bench_heap_bytes(void) { return 0; }
+
+static void bench_on_stop(int sig) { stopping = 1; }
+
+static int bench_start(struct bench_worker *w) {
+  int fds[2];
+  char *p;
+  size_t left;
+  ssize_t n;
+
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  if ((w->pid = fork()) < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+
+  if (w->pid == 0) {
+    close(fds[0]);
+    /* Keep the library's per-call chatter off the terminal */
+    freopen("/dev/null", "w", stdout);
+    setvbuf(stdout, NULL, _IOFBF, 65536);
+
+    w->fn(w->index, &w->st);
+
+    p = (char *)&w->st;
+    left = sizeof(w->st);
+    while (left > 0 && (n = write(fds[1], p, left)) > 0) {
+      p += n;
+      left -= n;
+    }
+    _exit(0);
+  }
+
+  close(fds[1]);
+  w->fd = fds[0];
+  return 0;
+}
+
+static void bench_stop(struct bench_worker *w, int n) {
+  int i;
+
+  for (i = 0; i < n; i++) {
+    kill(w[i].pid, SIGUSR1);
+  }
+}
+
+static void bench_wait(struct bench_worker *w) {
+  char *p = (char *)&w->st;
+  size_t left = sizeof(w->st);
+  ssize_t n;
+
+  while (left > 0 && (n = read(w->fd, p, left)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    p += n;
+    left -= n;
+  }
+  if (left > 0) {
+    fprintf(stderr, "bench: worker %d exited without reporting\n", w->pid);
+    memset(&w->st, 0, sizeof(w->st));
+  }
+  close(w->fd);
+  waitpid(w->pid, NULL, 0);
+}
+
+#endif /* MAILBOX_SIM */
+
+int bench_run(const char *variant, bench_fn sender, bench_fn receiver) {
+  struct bench_worker *senders, *receivers;
+  struct bench_stats *deposit, *retrieve;
+  uint64_t start;
+  double seconds;
+  int i;
+
+  senders = calloc(bench_opts.senders, sizeof(*senders));
+  receivers = calloc(bench_opts.receivers, sizeof(*receivers));
+  deposit = calloc(1, sizeof(*deposit));
+  retrieve = calloc(1, sizeof(*retrieve));
+  if (!senders || !receivers || !deposit || !retrieve) {
+    fprintf(stderr, "bench: out of memory\n");
+    return -1;
+  }
+
+#ifndef MAILBOX_SIM
+  signal(SIGUSR1, bench_on_stop);
+  fflush(stdout);
+#endif
+
+  start = bench_now_ns();
+  deadline = start + (uint64_t)bench_opts.seconds * 1000000000ULL;
+
+  for (i = 0; i < bench_opts.receivers; i++) {
+    receivers[i].index = i;
+    receivers[i].fn = receiver;
+    if (bench_start(&receivers[i]) != 0) {
+      perror("bench: cannot start receiver");
+      return -1;
+    }
+  }
+  for (i = 0; i < bench_opts.senders; i++) {
+    senders[i].index = i;
+    senders[i].fn = sender;
+    if (bench_start(&senders[i]) != 0) {
+      perror("bench: cannot start sender");
+      return -1;
+    }
+  }
+
+  for (i = 0; i < bench_opts.senders; i++) {
+    bench_wait(&senders[i]);
+    bench_merge(deposit, &senders[i].st);
+  }
+  bench_stop(receivers, bench_opts.receivers);
+  for (i = 0; i < bench_opts.receivers; i++) {
+    bench_wait(&receivers[i]);
+    bench_merge(retrieve, &receivers[i].st);
+  }
+
+  seconds = (double)(bench_now_ns() - start) / 1e9;
+
+  printf("%s senders=%d receivers=%d count=%d size=%d mailboxes=%d acl=%d "
+         "seconds=%.3f\n",
+         variant, bench_opts.senders, bench_opts.receivers, bench_opts.count,
+         bench_opts.size, bench_opts.mailboxes, bench_opts.acl, seconds);
+  bench_report("deposit", "full", deposit, seconds);
+  bench_report("retrieve", "empty", retrieve, seconds);
+
+  free(senders);
+  free(receivers);
+  free(deposit);
+  free(retrieve);
+  return 0;
+}
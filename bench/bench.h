@@ -0,0 +1,77 @@
+/**
+ * @file bench.h
+ * @brief Shared driver code for the mailbox throughput/latency benchmarks.
+ *
+ * A benchmark runs N sender and M receiver workers against one mailbox
+ * variant. On MINIX every worker is a forked process talking to PM or the
+ * mailbox service through the real calls; built with MAILBOX_SIM every worker is a thread
+ * driving the host simulation harness in ../sim.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Latency histogram: 8 linear sub-buckets per power of two nanoseconds */
+#define BENCH_SUB_BITS 3
+#define BENCH_SUB (1 << BENCH_SUB_BITS)
+#define BENCH_BUCKETS (64 * BENCH_SUB)
+
+/* Worker identity for calls that do not care about the UID */
+#define BENCH_ANY_UID ((uid_t)-1)
+
+/* Per-worker counters, merged per role at the end of the run */
+struct bench_stats {
+  uint64_t ops;    /* successful calls */
+  uint64_t bytes;  /* payload bytes moved by successful calls */
+  uint64_t failed; /* failed calls (mailbox full or empty) */
+  uint64_t hist[BENCH_BUCKETS];
+};
+
+/* Command line options */
+struct bench_opts {
+  int senders;   /* -s: sender workers */
+  int receivers; /* -r: receiver workers */
+  int count;     /* -n: messages per sender */
+  int size;      /* -m: payload bytes per message */
+  int mailboxes; /* -b: mailboxes (secure only) */
+  int acl;       /* -a: extra UIDs in every ACL (secure only) */
+  int batch;     /* -k: messages per deposit/retrieve (secure only) */
+  int seconds;   /* -t: deadline for the whole run */
+};
+
+typedef void (*bench_fn)(int index, struct bench_stats *st);
+
+extern struct bench_opts bench_opts;
+
+/// Parse the command line into bench_opts; exits on bad usage.
+void bench_parse(int argc, char *argv[], int max_size);
+
+/// Monotonic time in nanoseconds.
+uint64_t bench_now_ns(void);
+
+/// Account one successful call that took @p ns and moved @p bytes.
+void bench_record(struct bench_stats *st, uint64_t ns, uint64_t bytes);
+
+/// Run the calling worker as @p uid (a new simulated client on the host).
+void bench_become(uid_t uid);
+
+/// Non-zero once the senders are done; receivers drain and return.
+int bench_stopping(void);
+
+/// Non-zero once the -t deadline has passed.
+int bench_expired(void);
+
+/// Give other workers a chance to run after a failed call.
+void bench_backoff(void);
+
+/// Bytes allocated from the mailbox server's heap, or 0 if it is not visible.
+size_t bench_heap_bytes(void);
+
+/// Run all workers to completion and print the report.
+int bench_run(const char *variant, bench_fn sender, bench_fn receiver);
+
+#endif
@@ -0,0 +1,79 @@
+/* ================================================= *
+ *     Benchmark: mailbox IPC throughput and latency *
+ * ================================================= */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <lib.h>
+#include <string.h>
+#include <mailboxlib.h>
+
+#include "bench.h"
+
+/* Receivers are addressed by PID number; PM does not check it against the
+ * caller, so the workers use fixed four-digit ids */
+#define RECEIVER_PID(i) (3000 + (i))
+#define MAX_RECEIVERS 1000
+
+static char payload[MAX_MESSAGE_LEN];
+static int recipients[MAX_RECEIVERS];
+
+static void sender(int index, struct bench_stats *st) {
+  uint64_t t0, t1;
+  int k = 0;
+
+  bench_become(BENCH_ANY_UID);
+
+  while (k < bench_opts.count && !bench_expired()) {
+    t0 = bench_now_ns();
+    if (send_message(payload, bench_opts.size, recipients,
+                     bench_opts.receivers) == OK) {
+      t1 = bench_now_ns();
+      bench_record(st, t1 - t0, bench_opts.size);
+      k++;
+    } else {
+      st->failed++;
+      bench_backoff();
+    }
+  }
+}
+
+static void receiver(int index, struct bench_stats *st) {
+  char buf[MAX_MESSAGE_LEN];
+  uint64_t t0, t1;
+
+  bench_become(BENCH_ANY_UID);
+
+  for (;;) {
+    t0 = bench_now_ns();
+    if (receive_message(buf, sizeof(buf), RECEIVER_PID(index)) == OK) {
+      t1 = bench_now_ns();
+      bench_record(st, t1 - t0, bench_opts.size);
+    } else {
+      st->failed++;
+      if (bench_stopping()) {
+        break;
+      }
+      bench_backoff();
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+
+  bench_parse(argc, argv, MAX_MESSAGE_LEN - 1);
+
+  if (bench_opts.receivers > MAX_RECEIVERS) {
+    fprintf(stderr, "bench_ipc: at most %d receivers\n", MAX_RECEIVERS);
+    return 1;
+  }
+  for (i = 0; i < bench_opts.receivers; i++) {
+    recipients[i] = RECEIVER_PID(i);
+  }
+
+  memset(payload, 'x', bench_opts.size);
+  payload[bench_opts.size] = '\0';
+
+  return bench_run("mailbox-ipc", sender, receiver) == 0 ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+/* ================================================= *
+ *  Benchmark: secure mailbox throughput and latency *
+ * ================================================= */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <lib.h>
+#include <string.h>
+#include <mailboxlib.h>
+
+#include "bench.h"
+
+#define SECURE_MAILBOX 0
+
+/* UID ranges of the accounts the benchmark provisions */
+#define SENDER_UID(i) (20000 + (i))
+#define RECEIVER_UID(i) (30000 + (i))
+#define FILLER_UID(i) (40000 + (i))
+
+static char payload[MAX_MESSAGE_LEN];
+
+static void mailbox_name(char *buf, size_t len, int k) {
+  snprintf(buf, len, "bench%d", k);
+}
+
+/* Bench accounts need not exist in /etc/passwd, so skip add_user()'s
+ * getpwnam() and register the UID directly. */
+static int register_uid(int uid) {
+  message m;
+  m.m1_i1 = uid;
+  m.m1_i2 = 0b1011;
+  m.m1_i3 = geteuid();
+  return (mailbox_syscall(MAILBOX_ADD_USER, &m));
+}
+
+/* ACL: the fillers first, so that permission checks have to get past all
+ * of them */
+static int *access_list(int fillers, int first_uid, int uids) {
+  int *list = malloc((size_t)(fillers + uids) * sizeof(int) + 1);
+  int i;
+
+  for (i = 0; i < fillers; i++) {
+    list[i] = FILLER_UID(i);
+  }
+  for (i = 0; i < uids; i++) {
+    list[fillers + i] = first_uid + i;
+  }
+  return list;
+}
+
+static int setup(void) {
+  char name[32];
+  int *senders, *receivers;
+  int i;
+
+  for (i = 0; i < bench_opts.senders; i++) {
+    register_uid(SENDER_UID(i));
+  }
+  for (i = 0; i < bench_opts.receivers; i++) {
+    register_uid(RECEIVER_UID(i));
+  }
+  for (i = 0; i < bench_opts.acl; i++) {
+    register_uid(FILLER_UID(i));
+  }
+
+  senders = access_list(bench_opts.acl, SENDER_UID(0), bench_opts.senders);
+  receivers =
+      access_list(bench_opts.acl, RECEIVER_UID(0), bench_opts.receivers);
+
+  for (i = 0; i < bench_opts.mailboxes; i++) {
+    mailbox_name(name, sizeof(name), i);
+    remove_mailbox(name);
+    if (add_mailbox_uids(SECURE_MAILBOX, name, senders,
+                         bench_opts.acl + bench_opts.senders, receivers,
+                         bench_opts.acl + bench_opts.receivers) == ERROR) {
+      fprintf(stderr, "bench_secure: cannot create mailbox %s\n", name);
+      return ERROR;
+    }
+  }
+
+  free(senders);
+  free(receivers);
+  return OK;
+}
+
+/* Batch buffer: descriptors and strings of up to MAX_BATCH_COUNT messages */
+static int batch_buffer_size(void) {
+  int size = bench_opts.batch * (sizeof(mail_desc_t) + MAX_MAILBOX_NAME_LEN +
+                                 MAX_SUBJECT_LEN + MAX_MESSAGE_LEN);
+  return size < MAX_BATCH_BYTES ? size : MAX_BATCH_BYTES;
+}
+
+static void batch_sender(int index, struct bench_stats *st) {
+  int *packed = malloc(batch_buffer_size());
+  char name[32], subject[32];
+  mail_batch_t batch;
+  uint64_t t0, t1;
+  int k = 0, n, i;
+
+  while (k < bench_opts.count && !bench_expired()) {
+    send_batch_init(&batch, packed, batch_buffer_size(), bench_opts.batch);
+    for (i = k; i < bench_opts.count && i < k + bench_opts.batch; i++) {
+      mailbox_name(name, sizeof(name), i % bench_opts.mailboxes);
+      snprintf(subject, sizeof(subject), "s%d-%d", index, i);
+      send_batch_add(&batch, name, subject, payload);
+    }
+
+    t0 = bench_now_ns();
+    n = send_messages(&batch, NULL);
+    t1 = bench_now_ns();
+    for (i = 0; i < n; i++) {
+      bench_record(st, t1 - t0, bench_opts.size);
+    }
+    if (n < batch.count) {
+      st->failed++;
+      bench_backoff();
+    }
+    k += n > 0 ? n : 0;
+  }
+  free(packed);
+}
+
+static void sender(int index, struct bench_stats *st) {
+  char name[32], subject[32];
+  uint64_t t0, t1;
+  int k = 0;
+
+  bench_become(SENDER_UID(index));
+
+  if (bench_opts.batch > 1) {
+    batch_sender(index, st);
+    return;
+  }
+
+  while (k < bench_opts.count && !bench_expired()) {
+    mailbox_name(name, sizeof(name), k % bench_opts.mailboxes);
+    snprintf(subject, sizeof(subject), "s%d-%d", index, k);
+
+    t0 = bench_now_ns();
+    if (send_message(name, subject, payload) == OK) {
+      t1 = bench_now_ns();
+      bench_record(st, t1 - t0, bench_opts.size);
+      k++;
+    } else {
+      st->failed++;
+      bench_backoff();
+    }
+  }
+}
+
+static void batch_receiver(struct bench_stats *st) {
+  int *batch = malloc(batch_buffer_size());
+  uint64_t t0, t1;
+  int n, i;
+
+  for (;;) {
+    t0 = bench_now_ns();
+    n = receive_messages(batch, batch_buffer_size(), bench_opts.batch);
+    if (n > 0) {
+      t1 = bench_now_ns();
+      for (i = 0; i < n; i++) {
+        bench_record(st, t1 - t0, bench_opts.size);
+      }
+    } else {
+      st->failed++;
+      if (bench_stopping()) {
+        break;
+      }
+      bench_backoff();
+    }
+  }
+  free(batch);
+}
+
+static void receiver(int index, struct bench_stats *st) {
+  char buf[MAX_MESSAGE_LEN];
+  uint64_t t0, t1;
+
+  bench_become(RECEIVER_UID(index));
+
+  if (bench_opts.batch > 1) {
+    batch_receiver(st);
+    return;
+  }
+
+  for (;;) {
+    t0 = bench_now_ns();
+    if (receive_message(buf, sizeof(buf)) == OK) {
+      t1 = bench_now_ns();
+      bench_record(st, t1 - t0, bench_opts.size);
+    } else {
+      st->failed++;
+      if (bench_stopping()) {
+        break;
+      }
+      bench_backoff();
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bench_parse(argc, argv, MAX_MESSAGE_LEN - 1);
+  if (bench_opts.batch > MAX_BATCH_COUNT) {
+    fprintf(stderr, "%s: batch size must be at most %d\n", argv[0],
+            MAX_BATCH_COUNT);
+    return 1;
+  }
+
+  memset(payload, 'x', bench_opts.size);
+  payload[bench_opts.size] = '\0';
+
+  /* Provisioning and setuid() in the workers need the superuser */
+  bench_become(0);
+  if (setup() != OK) {
+    return 1;
+  }
+
+  return bench_run("mailbox-ipc-secure", sender, receiver) == 0 ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+/* ================================================= *
+ *  Soak test: mailbox service heap under long runs  *
+ *  of administration calls (secure mailbox)         *
+ * ================================================= */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <lib.h>
+#include <string.h>
+#include <mailboxlib.h>
+
+#include "bench.h"
+
+#define SECURE_MAILBOX 0
+
+/* Calls issued per round, see soak_round() */
+#define CALLS_PER_ROUND 10
+
+/* Mailboxes created and removed in turn */
+#define SOAK_MAILBOXES 8
+
+/* Account that edits ACLs and deletes messages (those privileges are
+ * granted by clear bits); the peer is the UID granted and revoked */
+#define ADMIN_UID 45000
+#define PEER_UID 45001
+
+/* Heap growth tolerated after warm-up before the run counts as a leak */
+#define SOAK_SLACK (64 * 1024)
+
+static char payload[MAX_MESSAGE_LEN];
+
+static int register_uid(int uid, int privileges) {
+  message m;
+  m.m1_i1 = uid;
+  m.m1_i2 = privileges;
+  m.m1_i3 = geteuid();
+  return (mailbox_syscall(MAILBOX_ADD_USER, &m));
+}
+
+/* add_sender() and friends as ADMIN_UID, for a UID without a passwd entry */
+static int acl_call(int call, char *mailbox_name, int uid) {
+  message m;
+  m.m1_i1 = ADMIN_UID;
+  m.m1_i2 = uid;
+  m.m1_i3 = strlen(mailbox_name) + 1;
+  m.m1_p1 = mailbox_name;
+  return (mailbox_syscall(call, &m));
+}
+
+/* delete_message() as ADMIN_UID */
+static int delete_call(char *mailbox_name, char *subject) {
+  message m;
+  m.m1_i1 = ADMIN_UID;
+  m.m1_i2 = strlen(mailbox_name) + 1;
+  m.m1_i3 = strlen(subject) + 1;
+  m.m1_p1 = mailbox_name;
+  m.m1_p2 = subject;
+  return (mailbox_syscall(MAILBOX_DELETE_MESSAGE, &m));
+}
+
+/* One pass over every handler that copies strings in from the caller.
+ * Returns the number of calls that did not do what they should. */
+static int soak_round(int k) {
+  char name[32], buf[MAX_MESSAGE_LEN];
+  int bad = 0;
+
+  snprintf(name, sizeof(name), "soak%d", k % SOAK_MAILBOXES);
+
+  bad += add_mailbox(SECURE_MAILBOX, name, "", "") != OK;
+  bad += acl_call(MAILBOX_ADD_SENDER, name, PEER_UID) != OK;
+  bad += acl_call(MAILBOX_REMOVE_SENDER, name, PEER_UID) != OK;
+  bad += acl_call(MAILBOX_ADD_RECEIVER, name, PEER_UID) != OK;
+  bad += acl_call(MAILBOX_REMOVE_RECEIVER, name, PEER_UID) != OK;
+  bad += send_message(name, "deleted", payload) != OK;
+  bad += delete_call(name, "deleted") != OK;
+  bad += send_message(name, "read", payload) != OK;
+  bad += receive_message(buf, sizeof(buf)) != OK;
+  bad += remove_mailbox(name) != OK;
+  return bad;
+}
+
+/* Reports go through fprintf(): in the simulation printf() is the one the
+ * mailbox library uses, which is silenced */
+int main(int argc, char *argv[]) {
+  uint64_t start, rounds, k, warm, checkpoint;
+  size_t heap, warm_heap = 0;
+  double seconds;
+  int bad = 0;
+
+  bench_parse(argc, argv, MAX_MESSAGE_LEN - 1);
+
+  memset(payload, 'x', bench_opts.size);
+  payload[bench_opts.size] = '\0';
+
+  /* The superuser owns the mailboxes and reads what is left in them */
+  bench_become(0);
+  register_uid(ADMIN_UID, 0b1000);
+  register_uid(PEER_UID, 0b1000);
+
+  rounds = (uint64_t)bench_opts.count;
+  warm = rounds / 10;
+  checkpoint = rounds / 10 > 0 ? rounds / 10 : 1;
+  start = bench_now_ns();
+
+  for (k = 0; k < rounds && !bench_expired(); k++) {
+    bad += soak_round((int)k);
+    if (k + 1 == warm) {
+      warm_heap = bench_heap_bytes();
+    }
+    if ((k + 1) % checkpoint == 0) {
+      fprintf(stdout, "calls=%llu heap_bytes=%lu\n",
+              (unsigned long long)((k + 1) * CALLS_PER_ROUND),
+              (unsigned long)bench_heap_bytes());
+    }
+  }
+
+  seconds = (double)(bench_now_ns() - start) / 1e9;
+  heap = bench_heap_bytes();
+
+  fprintf(stdout,
+          "mailbox-ipc-secure soak calls=%llu failed=%d seconds=%.3f "
+          "calls/s=%.0f\n",
+          (unsigned long long)(k * CALLS_PER_ROUND), bad, seconds,
+          (double)(k * CALLS_PER_ROUND) / seconds);
+
+  if (bad > 0) {
+    fprintf(stderr, "bench_soak: %d calls failed\n", bad);
+    return 1;
+  }
+  if (heap == 0) {
+    fprintf(stdout, "heap: not visible from here, watch the mailbox service with top(1)\n");
+    return 0;
+  }
+  fprintf(stdout, "heap: %lu bytes after warm-up, %lu at the end\n",
+          (unsigned long)warm_heap, (unsigned long)heap);
+  if (warm_heap > 0 && heap > warm_heap + SOAK_SLACK) {
+    fprintf(stderr, "bench_soak: heap grew by %lu bytes after warm-up\n",
+            (unsigned long)(heap - warm_heap));
+    return 1;
+  }
+  return 0;
+}
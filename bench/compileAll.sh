@@ -0,0 +1,15 @@
+# Build the benchmarks on MINIX against the installed <mailboxlib.h>.
+# Only the benchmark for the variant installed with update-files.sh will
+# compile.
+
+echo 'Compile bench_secure (mailbox-ipc-secure)'
+rm bench_secure
+clang bench_secure.c bench.c -o bench_secure
+
+echo 'Compile bench_soak (mailbox-ipc-secure)'
+rm bench_soak
+clang bench_soak.c bench.c -o bench_soak
+
+echo 'Compile bench_ipc (mailbox-ipc)'
+rm bench_ipc
+clang bench_ipc.c bench.c -o bench_ipc
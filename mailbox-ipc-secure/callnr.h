@@ -1,6 +1,4 @@
-/* This header file defines the calls to PM and VFS. */
-
-/* Define new calls here */
+/* This header file defines the calls to PM, VFS and the mailbox service. */
 
 #ifndef _MINIX_CALLNR_H
 #define _MINIX_CALLNR_H
@@ -53,7 +51,7 @@
 #define PM_REBOOT		(PM_BASE + 37)
 #define PM_SVRCTL		(PM_BASE + 38)
 #define PM_SPROF		(PM_BASE + 39)
-#define PM_RETRIEVE             (PM_BASE + 40) //get_from_mailbox
+#define PM_CPROF		(PM_BASE + 40)
 #define PM_SRV_FORK		(PM_BASE + 41)
 #define PM_SRV_KILL		(PM_BASE + 42)
 #define PM_EXEC_NEW		(PM_BASE + 43)
@@ -61,21 +59,8 @@
 #define PM_GETEPINFO		(PM_BASE + 45)
 #define PM_GETPROCNR		(PM_BASE + 46)
 #define PM_GETSYSINFO		(PM_BASE + 47)
-#define PM_DEPOSIT              (PM_BASE + 48) //add_to_mailbox
-#define PM_ADD_USER             (PM_BASE + 49) //add user to user list
-#define PM_ADD_MAILBOX          (PM_BASE + 50) //add mailbox to mailbox_collection
-#define PM_REMOVE_USER		(PM_BASE + 51)
-#define PM_UPDATE_PRIVILEGES    (PM_BASE + 52)
-#define PM_DELETE_MESSAGE       (PM_BASE + 53)
-#define PM_REMOVE_MAILBOX       (PM_BASE + 54)
-#define PM_ADD_SENDER           (PM_BASE + 55)
-#define PM_ADD_RECEIVER         (PM_BASE + 56)
-#define PM_REMOVE_SENDER        (PM_BASE + 57)
-#define PM_REMOVE_RECEIVER      (PM_BASE + 58)
-#define PM_SHOW_USERS           (PM_BASE + 59)
-#define PM_SHOW_MAILBOXES       (PM_BASE + 60)
-
-#define NR_PM_CALLS		61	/* highest number from base plus one */
+
+#define NR_PM_CALLS		48	/* highest number from base plus one */
 
 /*===========================================================================*
  *				Calls to VFS				     *
@@ -137,4 +122,46 @@
 
 #define NR_VFS_CALLS		49	/* highest number from base plus one */
 
+/*===========================================================================*
+ *			Calls to the mailbox service			     *
+ *===========================================================================*/
+
+/* The service's endpoint is looked up by name ("mailbox"); request types
+ * only have to be unique among the requests it receives. */
+#define MAILBOX_BASE		0x200
+
+#define IS_MAILBOX_CALL(type)	(((type) & ~0xff) == MAILBOX_BASE)
+
+#define MAILBOX_DEPOSIT		(MAILBOX_BASE + 0)
+#define MAILBOX_RETRIEVE	(MAILBOX_BASE + 1)
+#define MAILBOX_ADD_USER	(MAILBOX_BASE + 2)
+#define MAILBOX_ADD_MAILBOX	(MAILBOX_BASE + 3)
+#define MAILBOX_REMOVE_USER	(MAILBOX_BASE + 4)
+#define MAILBOX_UPDATE_PRIVILEGES (MAILBOX_BASE + 5)
+#define MAILBOX_DELETE_MESSAGE	(MAILBOX_BASE + 6)
+#define MAILBOX_REMOVE_MAILBOX	(MAILBOX_BASE + 7)
+#define MAILBOX_ADD_SENDER	(MAILBOX_BASE + 8)
+#define MAILBOX_ADD_RECEIVER	(MAILBOX_BASE + 9)
+#define MAILBOX_REMOVE_SENDER	(MAILBOX_BASE + 10)
+#define MAILBOX_REMOVE_RECEIVER	(MAILBOX_BASE + 11)
+#define MAILBOX_SHOW_USERS	(MAILBOX_BASE + 12)
+#define MAILBOX_SHOW_MAILBOXES	(MAILBOX_BASE + 13)
+#define MAILBOX_RETRIEVE_BATCH	(MAILBOX_BASE + 14)
+#define MAILBOX_DEPOSIT_BATCH	(MAILBOX_BASE + 15)
+#define MAILBOX_DEPOSIT_INLINE	(MAILBOX_BASE + 16)
+#define MAILBOX_OPEN		(MAILBOX_BASE + 17)
+#define MAILBOX_CLOSE		(MAILBOX_BASE + 18)
+#define MAILBOX_DEPOSIT_HANDLE	(MAILBOX_BASE + 19)
+#define MAILBOX_RETRIEVE_HANDLE	(MAILBOX_BASE + 20)
+#define MAILBOX_RING_MAP	(MAILBOX_BASE + 21)
+#define MAILBOX_RING_CLAIM	(MAILBOX_BASE + 22)
+#define MAILBOX_RING_POST	(MAILBOX_BASE + 23)
+#define MAILBOX_RING_TAKE	(MAILBOX_BASE + 24)
+#define MAILBOX_RING_RELEASE	(MAILBOX_BASE + 25)
+#define MAILBOX_PROBE		(MAILBOX_BASE + 26)
+#define MAILBOX_DEPOSIT_WAIT	(MAILBOX_BASE + 27)
+#define MAILBOX_RELEASE		(MAILBOX_BASE + 28)
+
+#define NR_MAILBOX_CALLS	29	/* highest number from base plus one */
+
 #endif /* !_MINIX_CALLNR_H */
@@ -0,0 +1,13 @@
+/* Global variables of the mailbox service, defined in main.c. */
+
+#ifndef _MAILBOX_GLO_H
+#define _MAILBOX_GLO_H
+
+extern message m_in;		/* the incoming message itself */
+extern message m_out;		/* reply to it, cleared before each request */
+extern endpoint_t who_e;	/* caller's endpoint */
+extern int call_nr;		/* request type */
+
+extern int (* const call_vec[])(void);
+
+#endif
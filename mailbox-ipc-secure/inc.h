@@ -0,0 +1,25 @@
+/* Header file for the mailbox service: everything mailbox.c, table.c and
+ * main.c need in scope.
+ */
+
+#ifndef _MAILBOX_INC_H
+#define _MAILBOX_INC_H
+
+#define _SYSTEM		1	/* get negative error number in <errno.h> */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <minix/callnr.h>
+#include <minix/com.h>
+#include <minix/ipc.h>
+#include <minix/syslib.h>
+#include <minix/sysutil.h>
+#include <minix/timers.h>
+#include <minix/vm.h>
+
+#include "proto.h"
+#include "glo.h"
+
+#endif
@@ -7,22 +7,170 @@
 
 /** Collection of all created mailboxes */
 static mailbox_collection_t *mailbox_collection;
-/** List of registered users */
-static uid_node_t *users;
+/** Registry of users and their privileges */
+static user_registry_t *users;
 
 /* TODO: remove old single mailbox interface */
 static mailbox_t *mailbox;
 
+/** Retrieves waiting with a timeout */
+static timeout_heap_t timeouts;
+
+/** The oldest blocked retrieve of each user that has one */
+static waiter_t *blocked_readers;
+
+/** Messages of the public mailboxes, and the seq of the next deposit */
+static public_log_t public_log;
+static uint64_t next_seq;
+
+/** Scratch arena for strings copied in by the current request */
+static char scratch[SCRATCH_SIZE];
+static int scratch_used;
+
+/** Staging area of batches: assembled here for a retrieve, copied in here
+ * for a deposit */
+static char batch[MAX_BATCH_BYTES];
+
+/** Open mailbox handles, indexed by handle modulo MAX_HANDLES */
+static mailbox_handle_t handles[MAX_HANDLES];
+
+/** Leases on lent messages, indexed by lease modulo MAX_LEASES, and the
+ * first free entry */
+static lease_t *leases;
+static int number_of_leases;
+static int free_lease = -1;
+
+/** Pools for the fixed-size nodes allocated on every call */
+static pool_t mailbox_pool = POOL_INITIALIZER(mailbox_t, MAILBOX_POOL_SLAB);
+static pool_t message_pool = POOL_INITIALIZER(message_t, MESSAGE_POOL_SLAB);
+static pool_t delivery_pool = POOL_INITIALIZER(delivery_t, DELIVERY_POOL_SLAB);
+static pool_t waiter_pool = POOL_INITIALIZER(waiter_t, WAITER_POOL_SLAB);
+static pool_t chunk_pool = POOL_INITIALIZER(chunk_t, CHUNK_POOL_SLAB);
+static pool_t sender_pool = POOL_INITIALIZER(sender_t, SENDER_POOL_SLAB);
+static pool_t view_pool = POOL_INITIALIZER(view_t, VIEW_POOL_SLAB);
+
+/** Mailboxes that gained room with senders blocked on them, admitted once
+ * the request at hand is done */
+static mailbox_t *ready_mailboxes;
+
+/* Slab pools */
+
+/// Carve a new slab into free objects.
+static int pool_grow(pool_t *pool) {
+  char *slab = malloc(pool->objects_per_slab * pool->object_size);
+  int i;
+
+  if (slab == NULL) {
+    return ERROR;
+  }
+  for (i = pool->objects_per_slab - 1; i >= 0; i--) {
+    pool_object_t *obj = (pool_object_t *)(slab + i * pool->object_size);
+    obj->next = pool->free_list;
+    pool->free_list = obj;
+  }
+  pool->number_of_slabs++;
+  return OK;
+}
+
+/// Take an object from a pool. Returns NULL if out of memory.
+static void *pool_alloc(pool_t *pool) {
+  pool_object_t *obj;
+
+  if (pool->free_list == NULL && pool_grow(pool) != OK) {
+    return NULL;
+  }
+  obj = pool->free_list;
+  pool->free_list = obj->next;
+  if (++pool->in_use > pool->high_water) {
+    pool->high_water = pool->in_use;
+  }
+  return obj;
+}
+
+/// Return an object to its pool.
+static void pool_free(pool_t *pool, void *p) {
+  pool_object_t *obj = p;
+
+  obj->next = pool->free_list;
+  pool->free_list = obj;
+  pool->in_use--;
+}
+
+/// Preallocate the first slab of the pools every call uses.
+static void init_pools() {
+  if (mailbox_pool.number_of_slabs == 0) {
+    pool_grow(&mailbox_pool);
+  }
+  if (message_pool.number_of_slabs == 0) {
+    pool_grow(&message_pool);
+  }
+  if (delivery_pool.number_of_slabs == 0) {
+    pool_grow(&delivery_pool);
+  }
+  if (waiter_pool.number_of_slabs == 0) {
+    pool_grow(&waiter_pool);
+  }
+}
+
+/// Print usage and high-water marks of the pools.
+int print_pool_stats() {
+  pool_t *pools[] = {&mailbox_pool, &message_pool, &delivery_pool,
+                     &waiter_pool, &chunk_pool, &sender_pool, &view_pool};
+  int i;
+
+  printf("Pools:\n");
+  for (i = 0; i < 7; i++) {
+    printf("%s: in use %d, high water %d, allocated %d\n", pools[i]->name,
+           pools[i]->in_use, pools[i]->high_water,
+           pools[i]->number_of_slabs * pools[i]->objects_per_slab);
+  }
+  return OK;
+}
+
+/* Scratch arena */
+
+/// Drop whatever the previous request left in the scratch arena.
+static void scratch_reset() { scratch_used = 0; }
+
+/* Copy a string of @p len bytes, terminator included, from the caller into
+ * the scratch arena. Returns NULL if it is empty, longer than @p max or does
+ * not fit.
+ */
+static char *scratch_copy_in(char *src, int len, int max) {
+  char *dst = scratch + scratch_used;
+
+  if (len < 1 || len > max || len > SCRATCH_SIZE - scratch_used) {
+    return NULL;
+  }
+  if (sys_datacopy(who_e, (vir_bytes)src, SELF, (vir_bytes)dst, len) != OK) {
+    return NULL;
+  }
+  dst[len - 1] = '\0';
+  scratch_used += len;
+  return dst;
+}
+
+static void invalidate_handles(mailbox_t *mb, int uid, int mode);
+static void cancel_senders(mailbox_t *mb);
+static void fail_senders(mailbox_t *mb, int uid);
+static int lend_mapped(delivery_t *d);
+static void end_lease(lease_t *l);
+static void revoke_views(mailbox_t *mb, int uid);
+static delivery_t *next_pending(user_t *reader, delivery_t *d);
+static int may_receive(mailbox_t *mb, int uid);
+
 /* Project 3 */
 
 /* Debug syshandlers */
 /// Print the list of users currently registered in the system.
 int do_show_users() {
-  uid_node_t *head = users->next;
+  int i;
+
   printf("Current user list: \n");
-  while (head->uid != -1) {
-    printf("%d->", head->uid);
-    head = head->next;
+  for (i = 0; users && i < users->number_of_slots; i++) {
+    if (users->slots[i].uid != -1) {
+      printf("%d->", users->slots[i].uid);
+    }
   }
   printf("NULL\n");
 
@@ -30,12 +178,11 @@ int do_show_users() {
 }
 
 /// Print the UIDs contained in an access list.
-int print_access_list(uid_node_t *access_list) {
-  uid_node_t *head = access_list->next;
-  while (head->uid != -1) {
-    printf("%d->", head->uid);
+int print_access_list(const acl_t *access_list) {
+  int i;
 
-    head = head->next;
+  for (i = 0; i < access_list->number_of_uids; i++) {
+    printf("%d->", access_list->uids[i]);
   }
   printf("NULL\n");
 
@@ -45,8 +192,8 @@ int print_access_list(uid_node_t *access_list) {
 /// Print all messages contained in a mailbox.
 int print_messages_of_mailbox(message_t *head) {
   message_t *iter = head->next;
-  while (strcmp(iter->message, "HEAD") != 0) {
-    printf("%s->", iter->message);
+  while (iter != head) {
+    printf("%.*s->", MAX_MESSAGE_LEN - 1, iter->message);
 
     iter = iter->next;
   }
@@ -56,1015 +203,3231 @@ int print_messages_of_mailbox(message_t *head) {
 
 /// Display information about all existing mailboxes.
 int do_show_mailboxes() {
+  if (!mailbox_collection) {
+    printf("Mailboxes:\n");
+    return OK;
+  }
+
   mailbox_t *head = mailbox_collection->head->next;
   printf("Mailboxes:\n");
-  while (strcmp(head->mailbox_name, "HEAD") != 0) {
+  while (head != mailbox_collection->head) {
     printf("Owner: %d\n", head->owner);
     printf("Number of messages: %d\n", head->number_of_messages);
     printf("Type: %d\n", head->mailbox_type);
     printf("Name: %s\n", head->mailbox_name);
 
     printf("send_access: ");
-    print_access_list(head->send_access);
+    print_access_list(&head->send_access);
 
     printf("receive_access: ");
-    print_access_list(head->receive_access);
+    print_access_list(&head->receive_access);
 
     printf("messages: ");
     print_messages_of_mailbox(head->head);
 
     head = head->next;
   }
+  print_pool_stats();
   return OK;
 }
 
 /* Main syshandlers */
 
-/// Initialize the global user list with the superuser.
-int init_users() {
-
-  // Sentinel value
-  users = malloc(sizeof(uid_node_t));
-  users->uid = -1;
-
-  // add superuser to users list
-  uid_node_t *superuser = malloc(sizeof(uid_node_t));
-  superuser->uid = 0;
-  superuser->privileges = 0b1111;
-  superuser->prev = users;
-  superuser->next = users;
-
-  users->next = superuser;
-  users->prev = superuser;
-
-  return OK;
+/// Home slot of a UID in a registry with @p number_of_slots slots.
+static int user_slot(int uid, int number_of_slots) {
+  return (int)(((unsigned int)uid * 2654435761u) & (number_of_slots - 1));
 }
 
-/// Check if a UID is registered in the user list.
-int userExists(int uid) {
-  uid_node_t *head = users->next;
-  while (head->uid != -1) {
-    if (head->uid == uid) {
-      return 1;
-    }
+/// Allocate an empty slot array for the registry.
+static user_t *alloc_user_slots(int number_of_slots) {
+  user_t *slots = malloc(number_of_slots * sizeof(user_t));
+  int i;
 
-    head = head->next;
+  if (slots == NULL) {
+    return NULL;
   }
-  return 0;
+  for (i = 0; i < number_of_slots; i++) {
+    slots[i].uid = -1;
+  }
+  return slots;
 }
 
-/* Get the user node from the list (pointer) */
+/// Store a user in the first free slot of its probe sequence.
+static void place_user(user_t *slots, int number_of_slots,
+                       const user_t *user) {
+  int i = user_slot(user->uid, number_of_slots);
 
-uid_node_t *getUser(int uid) {
-  uid_node_t *head = users->next;
-
-  while (head->uid != -1) {
-    if (head->uid == uid) {
-      return head;
-    }
-
-    head = head->next;
+  while (slots[i].uid != -1) {
+    i = (i + 1) & (number_of_slots - 1);
   }
-
-  return NULL;
+  slots[i] = *user;
 }
 
-/// Update a user's privilege bitmask. Requires superuser privileges.
-int do_update_privileges() {
-  int uid, privileges, processUID;
-
-  uid = m_in.m1_i1;
-  privileges = m_in.m1_i2;
-  processUID = m_in.m1_i3;
+/// Double the registry, rehashing every user.
+static int grow_users() {
+  int new_size = users->number_of_slots * 2;
+  user_t *new_slots = alloc_user_slots(new_size);
+  int i;
 
-  if (processUID != 0) {
-    printf("Mailbox: You are not superuser. Access denied.\n");
+  if (new_slots == NULL) {
     return ERROR;
   }
-
-  // Updating user privileges
-  uid_node_t *user_to_update = getUser(uid);
-
-  if (user_to_update == NULL) {
-    printf("Mailbox: The user with uid %d does not exist and can not be "
-           "updated.\n",
-           uid);
-    return ERROR;
+  for (i = 0; i < users->number_of_slots; i++) {
+    if (users->slots[i].uid != -1) {
+      place_user(new_slots, new_size, &users->slots[i]);
+    }
   }
 
-  user_to_update->privileges = privileges;
-
-  printf("Mailbox: Privileges of user with uid %d have been updated to %d\n",
-         user_to_update->uid, privileges);
-
+  free(users->slots);
+  users->slots = new_slots;
+  users->number_of_slots = new_size;
   return OK;
 }
 
-/// Remove a user from the system. Only the superuser may perform this action.
-int do_remove_user() {
-  int uid, processUID;
-
-  uid = m_in.m1_i1;
-  processUID = m_in.m1_i3;
+/// Register a user. The caller checks that the UID is not registered yet.
+static int insert_user(int uid, int privileges) {
+  user_t user;
 
-  if (processUID != 0) {
-    printf("Mailbox: You are not superuser. Access denied.\n");
+  if ((users->number_of_users + 1) * 4 > users->number_of_slots * 3 &&
+      grow_users() != OK) {
     return ERROR;
   }
 
-  // Removing user from the list
-  uid_node_t *user_to_remove = getUser(uid);
-
-  if (user_to_remove == NULL) {
-    printf("Mailbox: The user with uid %d does not exist and can not be "
-           "removed.\n",
-           uid);
+  // Empty pending queue
+  user.pending = pool_alloc(&delivery_pool);
+  if (user.pending == NULL) {
     return ERROR;
   }
+  user.pending->prev = user.pending;
+  user.pending->next = user.pending;
+  user.public_seq = next_seq;
+  user.waiting = NULL;
+  user.queues = NULL;
+  user.uid = uid;
+  user.privileges = privileges;
+
+  place_user(users->slots, users->number_of_slots, &user);
+  users->number_of_users++;
+  return OK;
+}
 
-  user_to_remove->prev->next = user_to_remove->next;
-  user_to_remove->next->prev = user_to_remove->prev;
+/// Unregister the user in @p slot, shifting back the rest of its cluster.
+static void delete_user(user_t *slot) {
+  int mask = users->number_of_slots - 1;
+  int hole = slot - users->slots;
+  int i = hole;
 
-  user_to_remove->prev = NULL;
-  user_to_remove->next = NULL;
+  for (;;) {
+    i = (i + 1) & mask;
+    if (users->slots[i].uid == -1) {
+      break;
+    }
 
-  free(user_to_remove);
+    // Entries whose home slot lies cyclically in (hole, i] stay put
+    int home = user_slot(users->slots[i].uid, users->number_of_slots);
+    if (hole <= i ? (hole < home && home <= i) : (hole < home || home <= i)) {
+      continue;
+    }
 
-  printf("Mailbox: Removed user with uid %d\n", user_to_remove->uid);
+    users->slots[hole] = users->slots[i];
+    hole = i;
+  }
 
-  return OK;
+  users->slots[hole].uid = -1;
+  users->number_of_users--;
 }
 
-/// Add a new user to the system. Superuser only.
-int do_add_user() {
+/// The reader's queue for @p mb, or NULL if it holds no receive handle on it.
+static mailbox_queue_t *find_queue(user_t *reader, mailbox_t *mb) {
+  mailbox_queue_t *q;
 
-  int privileges, uid, processUID;
+  for (q = reader->queues; q != NULL && q->mailbox != mb; q = q->next) {
+  }
+  return q;
+}
 
-  uid = m_in.m1_i1;
-  privileges = m_in.m1_i2;
-  processUID = m_in.m1_i3;
+/// Append a delivery to a mailbox queue.
+static void enqueue_delivery(mailbox_queue_t *q, delivery_t *d) {
+  d->queue_next = q->head;
+  d->queue_prev = q->head->queue_prev;
+  q->head->queue_prev->queue_next = d;
+  q->head->queue_prev = d;
+}
 
-  if (processUID != 0) {
-    printf("Mailbox: You are not superuser. Access denied.\n");
-    return ERROR;
+/// Take a delivery off its reader's pending queue and mailbox queue.
+static void unqueue_delivery(delivery_t *d) {
+  d->prev->next = d->next;
+  d->next->prev = d->prev;
+  if (d->queue_next != NULL) {
+    d->queue_prev->queue_next = d->queue_next;
+    d->queue_next->queue_prev = d->queue_prev;
+    d->queue_prev = NULL;
+    d->queue_next = NULL;
   }
+}
 
-  if (!users) {
-    init_users();
+/// Unlink a delivery from its reader's queue, or from the handle that took
+/// it, and from its message, and free it.
+static void drop_delivery(delivery_t *d) {
+  if (d->handle != -1) {
+    handles[d->handle].taken = NULL;
+    d->message->held--;
+  } else if (d->lease != -1) {
+    end_lease(&leases[d->lease]);
+    d->message->held--;
+  } else {
+    unqueue_delivery(d);
   }
 
-  // Check if user already exists
-  if (userExists(uid)) {
-    printf("Mailbox: The user with uid %d already exists.\n", uid);
-    return ERROR;
+  if (d->message_prev != NULL) {
+    d->message_prev->message_next = d->message_next;
+  } else {
+    d->message->deliveries = d->message_next;
   }
+  if (d->message_next != NULL) {
+    d->message_next->message_prev = d->message_prev;
+  }
+  pool_free(&delivery_pool, d);
+}
 
-  // Add new user to the users list
-  uid_node_t *new_user = malloc(sizeof(uid_node_t));
-  new_user->uid = uid;
-  new_user->privileges = privileges;
+/// Drop every outstanding delivery of a message.
+static void drop_deliveries(message_t *msg) {
+  while (msg->deliveries != NULL) {
+    drop_delivery(msg->deliveries);
+  }
+}
 
-  new_user->next = users;
-  new_user->prev = users->prev;
+/// Size of a payload slot of @p mb.
+static int slot_size(mailbox_t *mb) {
+  return mb->body_size + MAX_SUBJECT_LEN;
+}
 
-  users->prev->next = new_user;
-  users->prev = new_user;
+/// Size of the payload arena of @p mb, in whole pages if it is shared.
+static size_t arena_bytes(mailbox_t *mb) {
+  if (mb->shared) {
+    return RING_BYTES(mb->capacity, slot_size(mb));
+  }
+  return mb->capacity * slot_size(mb);
+}
 
-  printf("Mailbox: Added user with uid %d\n", new_user->uid);
+/// Slots of MAILBOX_SLOT_BUDGET taken per slot with room for @p body_size.
+static int budget_slots(int body_size) {
+  return (body_size + MAX_SUBJECT_LEN + PAYLOAD_SLOT_SIZE - 1) /
+         PAYLOAD_SLOT_SIZE;
+}
 
-  return OK;
+/// Address of a payload slot.
+static char *payload_slot(mailbox_t *mb, int slot) {
+  return mb->payload + slot * slot_size(mb);
 }
 
-/* Create sentinel mailbox if none exists */
-/// Check if the mailbox with the given name already exists.
-int mailboxExists(char *mailbox_name) {
-  // Empty mailbox collection
-  if (!mailbox_collection) {
-    mailbox_collection = malloc(sizeof(mailbox_collection_t));
-    mailbox_collection->number_of_mailboxes = 0;
+/// Free the payload arena of @p mb, if it has one.
+static void free_payload(mailbox_t *mb) {
+  if (mb->payload != NULL && mb->shared) {
+    munmap(mb->payload, arena_bytes(mb));
+  } else {
+    free(mb->payload);
+  }
+  free(mb->free_links);
+  mb->payload = NULL;
+  mb->free_links = NULL;
+}
 
-    // Sentinel mailbox
-    mailbox_t *sentinel = malloc(sizeof(mailbox_t));
-    sentinel->mailbox_name = "HEAD";
+/// Create the payload arena of @p mb, in pages of its own if it is shared.
+static int alloc_payload(mailbox_t *mb) {
+  int slot;
 
-    sentinel->prev = sentinel;
-    sentinel->next = sentinel;
+  if (mb->shared) {
+    mb->payload = mmap(NULL, arena_bytes(mb), PROT_READ | PROT_WRITE,
+                       MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (mb->payload == MAP_FAILED) {
+      mb->payload = NULL;
+    }
+  } else {
+    mb->payload = malloc(arena_bytes(mb));
+  }
+  mb->free_links = malloc(mb->capacity * sizeof(int));
+  if (mb->payload == NULL || mb->free_links == NULL) {
+    free_payload(mb);
+    return ERROR;
+  }
 
-    mailbox_collection->head = sentinel;
-    return 0;
+  for (slot = 0; slot < mb->capacity; slot++) {
+    mb->free_links[slot] = slot + 1 < mb->capacity ? slot + 1 : -1;
   }
+  mb->free_slot = 0;
+  return OK;
+}
 
-  mailbox_t *head = mailbox_collection->head->next;
-  while (strcmp(head->mailbox_name, "HEAD") != 0) {
-    if (strcmp(head->mailbox_name, mailbox_name) == 0) {
-      return 1;
-    }
+/// Take a free payload slot, creating the arena on first use.
+static int take_payload_slot(mailbox_t *mb) {
+  int slot;
 
-    head = head->next;
+  if (mb->payload == NULL && alloc_payload(mb) != OK) {
+    return -1;
   }
 
-  return 0;
+  slot = mb->free_slot;
+  if (slot != -1) {
+    mb->free_slot = mb->free_links[slot];
+  }
+  return slot;
 }
 
-/// Verify that a user has privileges to create a mailbox.
-int create_mailbox_privileges(int uid) {
-  if (!users) {
-    init_users();
+/// Have the senders blocked on @p mb, if any, let in after the request.
+static void mark_ready(mailbox_t *mb) {
+  if (mb->senders != NULL && !mb->ready) {
+    mb->ready = 1;
+    mb->ready_next = ready_mailboxes;
+    ready_mailboxes = mb;
   }
+}
 
-  uid_node_t *head = users->next;
+/* Return a payload slot; the most recently freed is reused first. Senders
+ * blocked for room are let in after the request at hand.
+ */
+static void release_payload_slot(mailbox_t *mb, int slot) {
+  mb->free_links[slot] = mb->free_slot;
+  mb->free_slot = slot;
+  mark_ready(mb);
+}
 
-  while (head->uid != -1) {
-    if (head->uid == uid) {
-      if (head->privileges == 0b1111 || head->privileges == 0b1011) {
-        return 1;
-      }
-    }
+/* Large message bodies */
 
-    head = head->next;
+/// Room for the body of @p msg in its slot, which the subject follows.
+static int body_field(message_t *msg) {
+  return msg->subject - msg->message;
+}
+
+/// Size of the body of @p msg with its terminator.
+static int body_length(message_t *msg) {
+  if (msg->chunks != NULL) {
+    return msg->length;
   }
+  return strnlen(msg->message, body_field(msg) - 1) + 1;
+}
 
-  // User does not exist or does not have correct privileges
-  return 0;
+/// Give the chunks of a large body back to their pool.
+static void free_chunks(message_t *msg) {
+  while (msg->chunks != NULL) {
+    chunk_t *next = msg->chunks->next;
+    pool_free(&chunk_pool, msg->chunks);
+    msg->chunks = next;
+  }
 }
 
-/// Obtain the privilege mask for a specific user.
-int get_privileges_for_user(int uid) {
-  uid_node_t *head = users->next;
-  while (head->uid != -1) {
-    if (head->uid == uid) {
-      return head->privileges;
-    }
+/// Chain enough chunks to @p msg for a body of @p length bytes.
+static int alloc_chunks(message_t *msg, int length) {
+  chunk_t **at = &msg->chunks;
+  int left;
 
-    head = head->next;
+  for (left = length - body_field(msg); left > 0; left -= CHUNK_SIZE) {
+    if ((*at = pool_alloc(&chunk_pool)) == NULL) {
+      free_chunks(msg);
+      return ERROR;
+    }
+    (*at)->next = NULL;
+    at = &(*at)->next;
   }
-  return ERROR;
+  msg->length = length;
+  return OK;
 }
 
-/// Create an access list from a space separated UID string.
-int create_list(char *access_list_str, uid_node_t *access_list) {
+/// Address of byte @p i of the body of @p msg.
+static char *body_byte(message_t *msg, int i) {
+  chunk_t *c = msg->chunks;
 
-  // Initialize access_list
-  access_list->uid = -1;
+  if (i < body_field(msg)) {
+    return msg->message + i;
+  }
+  for (i -= body_field(msg); i >= CHUNK_SIZE; i -= CHUNK_SIZE) {
+    c = c->next;
+  }
+  return c->data + i;
+}
 
-  access_list->prev = access_list;
-  access_list->next = access_list;
+/* Copy the first @p length bytes of the body of @p msg between it and
+ * @p buffer in @p endpoint: into the body if @p in is set, out of it
+ * otherwise. Goes piece by piece, the slot first and then each chunk.
+ */
+static int copy_body(message_t *msg, int in, endpoint_t endpoint,
+                     vir_bytes buffer, int length) {
+  chunk_t *c = msg->chunks;
+  char *piece = msg->message;
+  int size = body_field(msg);
+  int done = 0;
+
+  for (;;) {
+    int n = length - done < size ? length - done : size;
+    int r = in ? sys_datacopy(endpoint, buffer + done, SELF, (vir_bytes)piece,
+                              n)
+               : sys_datacopy(SELF, (vir_bytes)piece, endpoint, buffer + done,
+                              n);
+    if (r != OK) {
+      return ERROR;
+    }
+    done += n;
+    if (done == length || c == NULL) {
+      break;
+    }
+    piece = c->data;
+    size = CHUNK_SIZE;
+    c = c->next;
+  }
+  return done == length ? OK : ERROR;
+}
 
-  const char delim[2] = " ";
-  char *access_p = strtok(access_list_str, delim);
+/// Assemble the body of @p msg, @p length bytes, at @p dst.
+static void gather_body(message_t *msg, char *dst, int length) {
+  chunk_t *c;
+  int n = length < body_field(msg) ? length : body_field(msg);
 
-  while (access_p != NULL) {
-    int uid = atoi(access_p);
-    int privileges = get_privileges_for_user(uid);
-    if (privileges == ERROR) {
-      // Skip this user
-      printf("No user found for user id %d\n", uid);
-    } else {
-      // If privileges were found (user exists)
-      uid_node_t *new_uid = malloc(sizeof(uid_node_t));
-      new_uid->uid = uid;
-      new_uid->privileges = privileges;
+  memcpy(dst, msg->message, n);
+  for (c = msg->chunks; c != NULL && n < length; c = c->next) {
+    int piece = length - n < CHUNK_SIZE ? length - n : CHUNK_SIZE;
+    memcpy(dst + n, c->data, piece);
+    n += piece;
+  }
+}
 
-      new_uid->next = access_list;
+/* Public log */
 
-      new_uid->prev = access_list->prev;
+/// Index of the first entry of the public log with a seq of @p seq or more.
+static int log_find(uint64_t seq) {
+  int lo = 0, hi = public_log.used;
 
-      access_list->prev->next = new_uid;
-      access_list->prev = new_uid;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (public_log.entries[mid].seq < seq) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
+  }
+  return lo;
+}
 
-    access_p = strtok(NULL, delim);
+/// Append a message deposited into public mailbox @p mb to the log.
+static int log_append(mailbox_t *mb, message_t *msg) {
+  log_entry_t *e;
+
+  if (public_log.used == public_log.capacity) {
+    int capacity =
+        public_log.capacity ? 2 * public_log.capacity : PUBLIC_LOG_MIN;
+    log_entry_t *entries =
+        realloc(public_log.entries, capacity * sizeof(log_entry_t));
+    if (entries == NULL) {
+      return ERROR;
+    }
+    public_log.entries = entries;
+    public_log.capacity = capacity;
   }
+
+  e = &public_log.entries[public_log.used++];
+  e->seq = msg->seq;
+  e->message = msg;
+  e->mailbox = mb;
   return OK;
 }
 
-/* Create a new mailbox
- * Check uid in users list
- * Check user's privilege
- * send_receive_lens = "mailbox_type send_len receive_len"
- */
-/// Create a mailbox with the provided attributes.
-int do_add_mailbox() {
+/// Clear the entry of a reclaimed public message.
+static void log_clear(message_t *msg) {
+  int i, n;
 
-  char *mailbox_name, *send_access, *receive_access, *send_receive_lens;
+  public_log.entries[log_find(msg->seq)].message = NULL;
+  if (++public_log.cleared * 2 < public_log.used) {
+    return;
+  }
+  // Readers only keep a seq, so the entries may move
+  for (i = 0, n = 0; i < public_log.used; i++) {
+    if (public_log.entries[i].message != NULL) {
+      public_log.entries[n++] = public_log.entries[i];
+    }
+  }
+  public_log.used = n;
+  public_log.cleared = 0;
+}
 
-  int uid = m_in.m1_i1;
+/// Free a message that never made it into its mailbox.
+static void discard_message(mailbox_t *mb, message_t *msg) {
+  free_chunks(msg);
+  release_payload_slot(mb, msg->slot);
+  pool_free(&message_pool, msg);
+}
 
-  if (!create_mailbox_privileges(uid)) {
-    printf("The user with uid %d does not have the appropriate privileges to "
-           "create a mailbox.\n",
-           uid);
-    return ERROR;
+/// Unlink a message from its mailbox and free it.
+static void reclaim_message(mailbox_t *mb, message_t *msg) {
+  msg->prev->next = msg->next;
+  msg->next->prev = msg->prev;
+  mb->number_of_messages--;
+  if (mb->mailbox_type == PUBLIC) {
+    log_clear(msg);
   }
 
-  // Correct privileges
-  int mailbox_name_len = m_in.m1_i2;
-  int send_receive_lens_len = m_in.m1_i3;
+  drop_deliveries(msg);
+  discard_message(mb, msg);
+}
+
+/* Retire a delivery that was retrieved or withdrawn, reclaiming its message
+ * once no eligible reader is left. The superuser's copy does not hold a
+ * message back, but a message nobody else could read waits for it. A
+ * public message has no set of readers to wait for: it stays until its
+ * mailbox needs the room, see no_room().
+ */
+static void finish_delivery(delivery_t *d) {
+  message_t *msg = d->message;
+  mailbox_t *mb = d->mailbox;
+  int counted = d->uid != 0;
+
+  drop_delivery(d);
+  if (mb->mailbox_type == PUBLIC) {
+    if (msg->held == 0) {
+      mark_ready(mb);
+    }
+    return;
+  }
+  if (counted) {
+    msg->readers_left--;
+  }
+  if (msg->readers_left == 0 && (counted || msg->deliveries == NULL)) {
+    reclaim_message(mb, msg);
+  }
+}
 
-  int mailbox_name_bytes = mailbox_name_len * sizeof(char);
+/// Withdraw a user's pending deliveries from @p mb, or from every mailbox if NULL.
+static void drop_pending(user_t *user, mailbox_t *mb) {
+  delivery_t *d = user->pending->next;
 
-  int send_receive_bytes = send_receive_lens_len * sizeof(char);
+  while (d != user->pending) {
+    // Reclaiming a message only drops other readers' deliveries
+    delivery_t *next = d->next;
+    if (mb == NULL || d->mailbox == mb) {
+      finish_delivery(d);
+    }
+    d = next;
+  }
+}
 
-  mailbox_name = malloc(mailbox_name_bytes);
-  send_receive_lens = malloc(send_receive_bytes);
+/// Initialize the user registry with the superuser.
+int init_users() {
+  init_pools();
 
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)mailbox_name,
-               mailbox_name_bytes);
+  init_timer(&timeouts.timer);
 
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p4, SELF, (vir_bytes)send_receive_lens,
-               send_receive_bytes);
+  users = malloc(sizeof(user_registry_t));
+  users->number_of_users = 0;
+  users->number_of_slots = USER_REGISTRY_MIN_SLOTS;
+  users->slots = alloc_user_slots(USER_REGISTRY_MIN_SLOTS);
 
-  printf("Mailbox name is: %s\n", mailbox_name);
-  printf("Send_receive number of bytes: %s\n", send_receive_lens);
+  // add superuser to the registry
+  insert_user(0, 0b1111);
 
-  // Copy send_access & receive_access strings
-  const char delim[2] = " ";
-  int mailbox_type = atoi(strtok(send_receive_lens, delim));
-  int send_access_bytes = atoi(strtok(NULL, delim)) * sizeof(char);
-  int receive_access_bytes = atoi(strtok(NULL, delim)) * sizeof(char);
+  return OK;
+}
 
-  send_access = malloc(send_access_bytes);
-  receive_access = malloc(receive_access_bytes);
+/* Get the user entry from the registry (pointer) */
 
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p2, SELF, (vir_bytes)send_access,
-               send_access_bytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p3, SELF, (vir_bytes)receive_access,
-               receive_access_bytes);
+user_t *getUser(int uid) {
+  if (!users) {
+    return NULL;
+  }
 
-  printf("The mailbox_type is: %d\n", mailbox_type);
-  printf("The value of send_access is: %s\n", send_access);
-  printf("The value of receive_access is: %s\n", receive_access);
+  int i = user_slot(uid, users->number_of_slots);
 
-  // Check if mailbox already exists
-  if (mailboxExists(mailbox_name)) {
-    printf("Error: mailbox %s already exists.\n", mailbox_name);
-    return ERROR;
+  while (users->slots[i].uid != -1) {
+    if (users->slots[i].uid == uid) {
+      return &users->slots[i];
+    }
+    i = (i + 1) & (users->number_of_slots - 1);
   }
 
-  // Create a new mailbox
-  // Assumes that the uid's that the user provides are valid
+  return NULL;
+}
 
-  mailbox_t *new_mailbox = malloc(sizeof(mailbox_t));
-  new_mailbox->owner = uid;
-  new_mailbox->number_of_messages = 0;
-  new_mailbox->mailbox_type = mailbox_type;
-  new_mailbox->mailbox_name = mailbox_name;
-  new_mailbox->send_access = malloc(sizeof(uid_node_t));
-  new_mailbox->receive_access = malloc(sizeof(uid_node_t));
+/// Check if a UID is registered in the user registry.
+int userExists(int uid) { return getUser(uid) != NULL; }
 
-  // Add send and receive access lists
-  create_list(send_access, new_mailbox->send_access);
-  create_list(receive_access, new_mailbox->receive_access);
+/// Copy a queued message out to a reader's buffer and retire the delivery.
+static int hand_out(delivery_t *d, endpoint_t endpoint, vir_bytes buffer,
+                    int buffer_size) {
+  int messageBytes = body_length(d->message) * sizeof(char);
 
-  // Sentinel message for mailbox
-  message_t *head = malloc(sizeof(message_t));
+  if (messageBytes > buffer_size) {
+    printf("Error: buffer of %d bytes too small for a message of %d\n",
+           buffer_size, messageBytes);
+    return ERROR;
+  }
+  if (copy_body(d->message, 0, endpoint, buffer, messageBytes) != OK) {
+    return ERROR;
+  }
+  // Frees the message after its last reader
+  finish_delivery(d);
+  return OK;
+}
+
+/* Hand a queued message out in the reply itself if its body fits there,
+ * sparing the copy. Returns ERROR, changing nothing, if it does not.
+ */
+static int hand_out_inline(delivery_t *d) {
+  mail_inline_reply_t reply;
+  int messageBytes = body_length(d->message);
+
+  if (messageBytes > (int)sizeof(reply.body)) {
+    return ERROR;
+  }
+  reply.length = messageBytes;
+  memcpy(reply.body, d->message->message, messageBytes - 1);
+  reply.body[messageBytes - 1] = '\0';
+  memcpy(m_out.m_u8.data, &reply, sizeof(reply));
+  finish_delivery(d);
+  return OK;
+}
+
+/* Receive timeouts */
+
+/// Swap two waiters in the timeout heap.
+static void timeout_swap(int i, int j) {
+  waiter_t *w = timeouts.heap[i];
+
+  timeouts.heap[i] = timeouts.heap[j];
+  timeouts.heap[j] = w;
+  timeouts.heap[i]->heap_index = i;
+  timeouts.heap[j]->heap_index = j;
+}
+
+/// Restore heap order around position @p i after its deadline changed place.
+static void timeout_sift(int i) {
+  while (i > 0 && timeouts.heap[(i - 1) / 2]->deadline >
+                      timeouts.heap[i]->deadline) {
+    timeout_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= timeouts.number_of_waiters) {
+      return;
+    }
+    if (child + 1 < timeouts.number_of_waiters &&
+        timeouts.heap[child + 1]->deadline < timeouts.heap[child]->deadline) {
+      child++;
+    }
+    if (timeouts.heap[i]->deadline <= timeouts.heap[child]->deadline) {
+      return;
+    }
+    timeout_swap(i, child);
+    i = child;
+  }
+}
+
+static void expire_receives(int arg);
+
+/// Arm the receive timer for the earliest deadline, if any.
+static void arm_receive_timer() {
+  clock_t now;
+
+  if (timeouts.number_of_waiters == 0) {
+    cancel_timer(&timeouts.timer);
+    return;
+  }
+  now = getticks();
+  set_timer(&timeouts.timer,
+            timeouts.heap[0]->deadline > now
+                ? timeouts.heap[0]->deadline - now
+                : 1,
+            expire_receives, 0);
+}
+
+/// Start the timeout of a waiter.
+static int timeout_add(waiter_t *w) {
+  if (timeouts.number_of_waiters == timeouts.capacity) {
+    int capacity = timeouts.capacity ? 2 * timeouts.capacity : TIMEOUT_HEAP_MIN;
+    waiter_t **heap = realloc(timeouts.heap, capacity * sizeof(waiter_t *));
+    if (heap == NULL) {
+      return ERROR;
+    }
+    timeouts.heap = heap;
+    timeouts.capacity = capacity;
+  }
+
+  w->heap_index = timeouts.number_of_waiters++;
+  timeouts.heap[w->heap_index] = w;
+  timeout_sift(w->heap_index);
+  if (w->heap_index == 0) {
+    arm_receive_timer();
+  }
+  return OK;
+}
+
+/// Stop the timeout of a waiter. The timer stays armed, see timeout_heap_t.
+static void timeout_remove(waiter_t *w) {
+  int i = w->heap_index;
+  int last = --timeouts.number_of_waiters;
+
+  if (i != last) {
+    timeout_swap(i, last);
+    timeout_sift(i);
+  }
+  w->heap_index = -1;
+}
+
+/* Blocked retrieves */
+
+/// Put @p by in the place of @p w among the oldest waiters, or just take
+/// @p w out if @p by is NULL.
+static void replace_blocked(waiter_t *w, waiter_t *by) {
+  waiter_t *prev = w->blocked_prev;
+  waiter_t *next = w->blocked_next;
+
+  if (by != NULL) {
+    by->blocked_prev = prev;
+    by->blocked_next = next;
+    next = by;
+    prev = by;
+  }
+  if (w->blocked_prev != NULL) {
+    w->blocked_prev->blocked_next = next;
+  } else {
+    blocked_readers = next;
+  }
+  if (w->blocked_next != NULL) {
+    w->blocked_next->blocked_prev = prev;
+  }
+}
+
+/// Queue a waiter behind the user's other waiters.
+static void enqueue_waiter(user_t *user, waiter_t *w) {
+  if (user->waiting == NULL) {
+    w->prev = w;
+    w->next = w;
+    user->waiting = w;
+    w->blocked_prev = NULL;
+    w->blocked_next = blocked_readers;
+    if (blocked_readers != NULL) {
+      blocked_readers->blocked_prev = w;
+    }
+    blocked_readers = w;
+    return;
+  }
+  w->next = user->waiting;
+  w->prev = user->waiting->prev;
+  w->prev->next = w;
+  user->waiting->prev = w;
+}
+
+/// Take a waiter off its user's queue and stop its timeout.
+static void unqueue_waiter(user_t *user, waiter_t *w) {
+  if (w->next == w) {
+    user->waiting = NULL;
+    replace_blocked(w, NULL);
+  } else {
+    w->prev->next = w->next;
+    w->next->prev = w->prev;
+    if (user->waiting == w) {
+      user->waiting = w->next;
+      replace_blocked(w, w->next);
+    }
+  }
+  if (w->heap_index != -1) {
+    timeout_remove(w);
+  }
+}
+
+/// Unqueue a waiter, reply to it and free it.
+static void release_waiter(user_t *user, waiter_t *w, int result) {
+  unqueue_waiter(user, w);
+  mailbox_reply(w->endpoint, result);
+  pool_free(&waiter_pool, w);
+}
+
+/// Fail the retrieves whose timeout has passed.
+static void expire_receives(int arg) {
+  clock_t now = getticks();
+
+  while (timeouts.number_of_waiters > 0 &&
+         timeouts.heap[0]->deadline <= now) {
+    waiter_t *w = timeouts.heap[0];
+    release_waiter(getUser(w->uid), w, ERROR);
+  }
+  arm_receive_timer();
+}
+
+/* Complete the oldest blocked retrieve of a reader with its oldest message.
+ * Returns OK if the message was handed out.
+ */
+static int serve_waiter(user_t *reader) {
+  waiter_t *w;
+  delivery_t *d;
+
+  while ((w = reader->waiting) != NULL &&
+         (d = next_pending(reader, reader->pending->next)) != NULL) {
+    if (hand_out(d, w->endpoint, w->buffer, w->buffer_size) == OK) {
+      release_waiter(reader, w, OK);
+      return OK;
+    }
+    // The caller is gone or its buffer too small; try the next one
+    release_waiter(reader, w, ERROR);
+  }
+  return ERROR;
+}
+
+/* Hand a message just deposited to the readers blocked waiting for one.
+ * Their queues were empty, so the message is at the head of each. The
+ * superuser is served first: giving the message to the last counted reader
+ * reclaims it along with the superuser's copy.
+ */
+static void wake_readers(message_t *msg) {
+  user_t *reader = getUser(0);
+  delivery_t *d, *next;
+
+  if (reader != NULL && reader->waiting != NULL) {
+    int last = msg->readers_left == 0;
+    if (serve_waiter(reader) == OK && last) {
+      return;
+    }
+  }
+
+  for (d = msg->deliveries; d != NULL; d = next) {
+    next = d->message_next;
+    reader = getUser(d->uid);
+    if (reader->waiting != NULL) {
+      int last = msg->readers_left == 1;
+      if (serve_waiter(reader) == OK && last) {
+        return;
+      }
+    }
+  }
+}
+
+/* Hand a message just deposited into public mailbox @p mb to the readers
+ * blocked waiting for one that may receive it. They had read the whole
+ * public log, so it is the next for each.
+ */
+static void wake_blocked(mailbox_t *mb) {
+  waiter_t *w, *next;
+
+  for (w = blocked_readers; w != NULL; w = next) {
+    // Serving a reader only replaces or drops its own entry
+    next = w->blocked_next;
+    if (may_receive(mb, w->uid)) {
+      serve_waiter(getUser(w->uid));
+    }
+  }
+}
+
+/// Fail every retrieve a user has blocked in.
+static void cancel_waiters(user_t *user) {
+  while (user->waiting != NULL) {
+    release_waiter(user, user->waiting, ERROR);
+  }
+}
+
+/// Update a user's privilege bitmask. Requires superuser privileges.
+int do_update_privileges() {
+  int uid, privileges, processUID;
+
+  uid = m_in.m1_i1;
+  privileges = m_in.m1_i2;
+  processUID = m_in.m1_i3;
+
+  if (processUID != 0) {
+    printf("Mailbox: You are not superuser. Access denied.\n");
+    return ERROR;
+  }
+
+  // Updating user privileges
+  user_t *user_to_update = getUser(uid);
+
+  if (user_to_update == NULL) {
+    printf("Mailbox: The user with uid %d does not exist and can not be "
+           "updated.\n",
+           uid);
+    return ERROR;
+  }
+
+  user_to_update->privileges = privileges;
+
+  printf("Mailbox: Privileges of user with uid %d have been updated to %d\n",
+         user_to_update->uid, privileges);
+
+  return OK;
+}
+
+/// Remove a user from the system. Only the superuser may perform this action.
+int do_remove_user() {
+  int uid, processUID;
+
+  uid = m_in.m1_i1;
+  processUID = m_in.m1_i3;
+
+  if (processUID != 0) {
+    printf("Mailbox: You are not superuser. Access denied.\n");
+    return ERROR;
+  }
+
+  // Removing user from the registry
+  user_t *user_to_remove = getUser(uid);
+
+  if (user_to_remove == NULL) {
+    printf("Mailbox: The user with uid %d does not exist and can not be "
+           "removed.\n",
+           uid);
+    return ERROR;
+  }
+
+  // Messages queued for the user are no longer theirs to read
+  cancel_waiters(user_to_remove);
+  drop_pending(user_to_remove, NULL);
+  invalidate_handles(NULL, uid, OPEN_SEND | OPEN_RECEIVE);
+  fail_senders(NULL, uid);
+  pool_free(&delivery_pool, user_to_remove->pending);
+  delete_user(user_to_remove);
+
+  printf("Mailbox: Removed user with uid %d\n", uid);
+
+  return OK;
+}
+
+/// Add a new user to the system. Superuser only.
+int do_add_user() {
+
+  int privileges, uid, processUID;
+
+  uid = m_in.m1_i1;
+  privileges = m_in.m1_i2;
+  processUID = m_in.m1_i3;
+
+  if (processUID != 0) {
+    printf("Mailbox: You are not superuser. Access denied.\n");
+    return ERROR;
+  }
+
+  if (!users) {
+    init_users();
+  }
+
+  if (uid < 0) {
+    printf("Mailbox: Invalid uid %d.\n", uid);
+    return ERROR;
+  }
+
+  // Check if user already exists
+  if (userExists(uid)) {
+    printf("Mailbox: The user with uid %d already exists.\n", uid);
+    return ERROR;
+  }
+
+  // Add new user to the registry
+  if (insert_user(uid, privileges) != OK) {
+    printf("Mailbox: Out of memory adding user with uid %d\n", uid);
+    return ERROR;
+  }
+
+  printf("Mailbox: Added user with uid %d\n", uid);
+
+  return OK;
+}
+
+/// Hash a mailbox name (32-bit FNV-1a).
+static unsigned int mailbox_hash(const char *name, int len) {
+  unsigned int hash = 2166136261u;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/// Create the mailbox collection: sentinel mailbox and empty name index.
+static int init_mailbox_collection() {
+  init_pools();
+
+  mailbox_collection = malloc(sizeof(mailbox_collection_t));
+  mailbox_collection->number_of_mailboxes = 0;
+  mailbox_collection->reserved_slots = 0;
+
+  // Sentinel mailbox
+  mailbox_t *sentinel = malloc(sizeof(mailbox_t));
+  sentinel->mailbox_name = "HEAD";
+
+  sentinel->prev = sentinel;
+  sentinel->next = sentinel;
+
+  mailbox_collection->head = sentinel;
+
+  mailbox_collection->number_of_buckets = MAILBOX_INDEX_MIN_BUCKETS;
+  mailbox_collection->buckets =
+      calloc(MAILBOX_INDEX_MIN_BUCKETS, sizeof(mailbox_t *));
+
+  return OK;
+}
+
+/// Double the name index, rehashing from the cached hashes.
+static void grow_mailbox_index() {
+  int old_size = mailbox_collection->number_of_buckets;
+  int new_size = old_size * 2;
+  mailbox_t **new_buckets = calloc(new_size, sizeof(mailbox_t *));
+  int i;
+
+  if (new_buckets == NULL) {
+    // Keep the current index, chains just get longer
+    return;
+  }
+
+  for (i = 0; i < old_size; i++) {
+    mailbox_t *mb = mailbox_collection->buckets[i];
+    while (mb != NULL) {
+      mailbox_t *next = mb->hash_next;
+      mailbox_t **bucket = &new_buckets[mb->name_hash & (new_size - 1)];
+      mb->hash_next = *bucket;
+      *bucket = mb;
+      mb = next;
+    }
+  }
+
+  free(mailbox_collection->buckets);
+  mailbox_collection->buckets = new_buckets;
+  mailbox_collection->number_of_buckets = new_size;
+}
+
+/// Add a mailbox to the name index, growing it to keep chains short.
+static void index_mailbox(mailbox_t *mb) {
+  if (mailbox_collection->number_of_mailboxes >=
+      mailbox_collection->number_of_buckets) {
+    grow_mailbox_index();
+  }
+
+  mailbox_t **bucket =
+      &mailbox_collection->buckets[mb->name_hash &
+                                   (mailbox_collection->number_of_buckets - 1)];
+  mb->hash_next = *bucket;
+  *bucket = mb;
+}
+
+/// Remove a mailbox from the name index.
+static void unindex_mailbox(mailbox_t *mb) {
+  mailbox_t **p =
+      &mailbox_collection->buckets[mb->name_hash &
+                                   (mailbox_collection->number_of_buckets - 1)];
+  while (*p != mb) {
+    p = &(*p)->hash_next;
+  }
+  *p = mb->hash_next;
+}
+
+/// Look up a mailbox by name. Returns NULL if there is no such mailbox.
+mailbox_t *find_mailbox(const char *mailbox_name) {
+  if (!mailbox_collection) {
+    return NULL;
+  }
+
+  int len = strlen(mailbox_name);
+  unsigned int hash = mailbox_hash(mailbox_name, len);
+  mailbox_t *mb =
+      mailbox_collection
+          ->buckets[hash & (mailbox_collection->number_of_buckets - 1)];
+
+  while (mb != NULL) {
+    if (mb->name_hash == hash && mb->name_len == len &&
+        memcmp(mb->mailbox_name, mailbox_name, len) == 0) {
+      return mb;
+    }
+    mb = mb->hash_next;
+  }
+  return NULL;
+}
+
+/* Create sentinel mailbox if none exists */
+/// Check if the mailbox with the given name already exists.
+int mailboxExists(char *mailbox_name) {
+  // Empty mailbox collection
+  if (!mailbox_collection) {
+    init_mailbox_collection();
+    return 0;
+  }
+
+  return find_mailbox(mailbox_name) != NULL;
+}
+
+/// Verify that a user has privileges to create a mailbox.
+int create_mailbox_privileges(int uid) {
+  if (!users) {
+    init_users();
+  }
+
+  user_t *user = getUser(uid);
+
+  if (user != NULL &&
+      (user->privileges == 0b1111 || user->privileges == 0b1011)) {
+    return 1;
+  }
+
+  // User does not exist or does not have correct privileges
+  return 0;
+}
+
+/// Obtain the privilege mask for a specific user.
+int get_privileges_for_user(int uid) {
+  user_t *user = getUser(uid);
+
+  return user != NULL ? user->privileges : ERROR;
+}
+
+/// Index of the first entry of an access list that is not below @p uid.
+static int acl_lower_bound(const acl_t *acl, int uid) {
+  const int *uids = acl->uids;
+  int first = 0;
+  int n = acl->number_of_uids;
+  int below = 0;
+  int i;
+
+  while (n > ACL_LINEAR_SCAN) {
+    int half = n / 2;
+    if (uids[first + half] < uid) {
+      first += half + 1;
+      n -= half + 1;
+    } else {
+      n = half;
+    }
+  }
+
+  // Branch-free count over the last cache lines, which vectorizes
+  for (i = 0; i < n; i++) {
+    below += uids[first + i] < uid;
+  }
+  return first + below;
+}
+
+/// Check whether a UID is on an access list.
+int acl_contains(const acl_t *acl, int uid) {
+  int i = acl_lower_bound(acl, uid);
+
+  return i < acl->number_of_uids && acl->uids[i] == uid;
+}
+
+/// Check whether a user may read messages from a mailbox.
+static int may_receive(mailbox_t *mb, int uid) {
+  int in_permission_list = acl_contains(&mb->receive_access, uid);
+
+  return (uid == 0) ||
+         ((mb->mailbox_type == SECURE) && in_permission_list) ||
+         ((mb->mailbox_type == PUBLIC) && !in_permission_list);
+}
+
+/// Queue a message for a reader ahead of @p before in its pending queue.
+static delivery_t *add_delivery(user_t *reader, mailbox_t *mb,
+                                message_t *msg, delivery_t *before) {
+  delivery_t *d = pool_alloc(&delivery_pool);
+  mailbox_queue_t *q;
+
+  if (d == NULL) {
+    return NULL;
+  }
+  d->uid = reader->uid;
+  d->handle = -1;
+  d->lease = -1;
+  d->message = msg;
+  d->mailbox = mb;
+
+  d->next = before;
+  d->prev = before->prev;
+  before->prev->next = d;
+  before->prev = d;
+
+  d->queue_prev = NULL;
+  d->queue_next = NULL;
+  if (reader->queues != NULL && (q = find_queue(reader, mb)) != NULL) {
+    enqueue_delivery(q, d);
+  }
+
+  d->message_prev = NULL;
+  d->message_next = msg->deliveries;
+  if (msg->deliveries != NULL) {
+    msg->deliveries->message_prev = d;
+  }
+  msg->deliveries = d;
+  return d;
+}
+
+/* Queue a new message of a secure mailbox for the superuser and every
+ * registered user on its receivers list. Public messages go to the public
+ * log instead. On failure the caller drops the deliveries already made.
+ */
+static int deliver_message(mailbox_t *mb, message_t *msg) {
+  user_t *reader;
+  int i;
+
+  if ((reader = getUser(0)) != NULL &&
+      add_delivery(reader, mb, msg, reader->pending) == NULL) {
+    return ERROR;
+  }
+  for (i = 0; i < mb->receive_access.number_of_uids; i++) {
+    int uid = mb->receive_access.uids[i];
+    if (uid != 0 && (reader = getUser(uid)) != NULL) {
+      if (add_delivery(reader, mb, msg, reader->pending) == NULL) {
+        return ERROR;
+      }
+      msg->readers_left++;
+    }
+  }
+  return OK;
+}
+
+/* Take the next message @p reader may receive off the public log and queue
+ * it ahead of @p before, if it was deposited before that one (or at all, if
+ * @p before is the sentinel); the messages passed over on the way are no
+ * longer the reader's to get. Returns the new delivery, or NULL.
+ */
+static delivery_t *pull_public(user_t *reader, delivery_t *before) {
+  int i;
+
+  for (i = log_find(reader->public_seq); i < public_log.used; i++) {
+    log_entry_t *e = &public_log.entries[i];
+    delivery_t *d;
+
+    if (before != reader->pending && before->message->seq < e->seq) {
+      return NULL;
+    }
+    if (e->message == NULL || !may_receive(e->mailbox, reader->uid)) {
+      reader->public_seq = e->seq + 1;
+      continue;
+    }
+
+    // Behind anything queued since
+    while (before->prev != reader->pending &&
+           before->prev->message->seq > e->seq) {
+      before = before->prev;
+    }
+    if ((d = add_delivery(reader, e->mailbox, e->message, before)) == NULL) {
+      printf("Error: out of memory queueing a message for uid %d\n",
+             reader->uid);
+      return NULL;
+    }
+    reader->public_seq = e->seq + 1;
+    return d;
+  }
+  return NULL;
+}
+
+/* The reader's oldest message from @p d on in its pending queue, taken off
+ * the public log if that holds an older one; NULL if there is none.
+ */
+static delivery_t *next_pending(user_t *reader, delivery_t *d) {
+  delivery_t *pulled = pull_public(reader, d);
+
+  if (pulled != NULL) {
+    return pulled;
+  }
+  return d != reader->pending ? d : NULL;
+}
+
+/// Make room for at least @p capacity entries.
+static int acl_reserve(acl_t *acl, int capacity) {
+  if (capacity <= acl->capacity) {
+    return OK;
+  }
+
+  int new_capacity = acl->capacity ? acl->capacity : 8;
+  while (new_capacity < capacity) {
+    new_capacity *= 2;
+  }
+
+  int *uids = realloc(acl->uids, new_capacity * sizeof(int));
+  if (uids == NULL) {
+    return ERROR;
+  }
+  acl->uids = uids;
+  acl->capacity = new_capacity;
+  return OK;
+}
+
+/// Add a UID to an access list. Returns ERROR if it is already there.
+static int acl_add(acl_t *acl, int uid) {
+  int i = acl_lower_bound(acl, uid);
+
+  if ((i < acl->number_of_uids && acl->uids[i] == uid) ||
+      acl_reserve(acl, acl->number_of_uids + 1) != OK) {
+    return ERROR;
+  }
+
+  memmove(&acl->uids[i + 1], &acl->uids[i],
+          (acl->number_of_uids - i) * sizeof(int));
+  acl->uids[i] = uid;
+  acl->number_of_uids++;
+  return OK;
+}
+
+/// Remove a UID from an access list. Returns ERROR if it is not there.
+static int acl_remove(acl_t *acl, int uid) {
+  int i = acl_lower_bound(acl, uid);
+
+  if (i == acl->number_of_uids || acl->uids[i] != uid) {
+    return ERROR;
+  }
+
+  memmove(&acl->uids[i], &acl->uids[i + 1],
+          (acl->number_of_uids - i - 1) * sizeof(int));
+  acl->number_of_uids--;
+  return OK;
+}
+
+/// Restore the heap property below node @p i (heapsort helper).
+static void sift_down(int *a, int i, int n) {
+  for (;;) {
+    int largest = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+
+    if (left < n && a[left] > a[largest]) {
+      largest = left;
+    }
+    if (right < n && a[right] > a[largest]) {
+      largest = right;
+    }
+    if (largest == i) {
+      return;
+    }
+
+    int tmp = a[i];
+    a[i] = a[largest];
+    a[largest] = tmp;
+    i = largest;
+  }
+}
+
+/// Sort UIDs in place (libminc has no qsort).
+static void sort_uids(int *a, int n) {
+  int i;
+
+  for (i = n / 2 - 1; i >= 0; i--) {
+    sift_down(a, i, n);
+  }
+  for (i = n - 1; i > 0; i--) {
+    int tmp = a[0];
+    a[0] = a[i];
+    a[i] = tmp;
+    sift_down(a, 0, i);
+  }
+}
+
+/// Create an access list from an array of UIDs in any order.
+int create_list(const int *uids, int count, acl_t *access_list) {
+  int kept = 0;
+  int i;
+
+  access_list->number_of_uids = 0;
+  access_list->capacity = 0;
+  access_list->uids = NULL;
+
+  if (count == 0) {
+    return OK;
+  }
+  if (acl_reserve(access_list, count) != OK) {
+    return ERROR;
+  }
+
+  for (i = 0; i < count; i++) {
+    if (!userExists(uids[i])) {
+      // Skip this user
+      printf("No user found for user id %d\n", uids[i]);
+    } else {
+      access_list->uids[kept++] = uids[i];
+    }
+  }
+
+  // Sort once and drop duplicates
+  sort_uids(access_list->uids, kept);
+  for (i = 0; i < kept; i++) {
+    if (access_list->number_of_uids == 0 ||
+        access_list->uids[access_list->number_of_uids - 1] !=
+            access_list->uids[i]) {
+      access_list->uids[access_list->number_of_uids++] = access_list->uids[i];
+    }
+  }
+  return OK;
+}
+
+/* Create a new mailbox
+ * Check uid in users list
+ * Check user's privilege
+ * The request (mailbox_request_t, name, UID arrays) comes in one copy
+ */
+/// Create a mailbox with the provided attributes.
+int do_add_mailbox() {
+
+  mailbox_request_t *request;
+  char *mailbox_name;
+  int *senders, *receivers;
+
+  int uid = m_in.m1_i1;
+  int request_bytes = m_in.m1_i2;
+
+  if (!create_mailbox_privileges(uid)) {
+    printf("The user with uid %d does not have the appropriate privileges to "
+           "create a mailbox.\n",
+           uid);
+    return ERROR;
+  }
+
+  // Correct privileges
+  if (request_bytes < (int)sizeof(mailbox_request_t) ||
+      request_bytes > (int)(sizeof(mailbox_request_t) +
+                            MAILBOX_REQUEST_PAD(MAX_MAILBOX_NAME_LEN) +
+                            2 * MAX_ACL_UIDS * sizeof(int))) {
+    printf("Error: invalid mailbox request size %d\n", request_bytes);
+    return ERROR;
+  }
+
+  request = malloc(request_bytes);
+  if (request == NULL) {
+    printf("Error: out of memory reading mailbox request\n");
+    return ERROR;
+  }
+  if (sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)request,
+                   request_bytes) != OK) {
+    free(request);
+    return ERROR;
+  }
+
+  int name_bytes = request->name_bytes;
+  int number_of_senders = request->number_of_senders;
+  int number_of_receivers = request->number_of_receivers;
+  int capacity = request->capacity != 0 ? request->capacity
+                                        : DEFAULT_MAILBOX_CAPACITY;
+  int body_size = request->body_size != 0 ? request->body_size
+                                          : MAX_MESSAGE_LEN;
+
+  if (name_bytes < 1 || name_bytes > MAX_MAILBOX_NAME_LEN ||
+      number_of_senders < 0 || number_of_senders > MAX_ACL_UIDS ||
+      number_of_receivers < 0 || number_of_receivers > MAX_ACL_UIDS ||
+      request_bytes != (int)(sizeof(mailbox_request_t) +
+                             MAILBOX_REQUEST_PAD(name_bytes) +
+                             (number_of_senders + number_of_receivers) *
+                                 sizeof(int))) {
+    printf("Error: malformed mailbox request\n");
+    free(request);
+    return ERROR;
+  }
+
+  mailbox_name = (char *)(request + 1);
+  mailbox_name[name_bytes - 1] = '\0';
+  senders = (int *)(mailbox_name + MAILBOX_REQUEST_PAD(name_bytes));
+  receivers = senders + number_of_senders;
+
+  printf("Mailbox name is: %s\n", mailbox_name);
+
+  // Check if mailbox already exists
+  if (mailboxExists(mailbox_name)) {
+    printf("Error: mailbox %s already exists.\n", mailbox_name);
+    free(request);
+    return ERROR;
+  }
+
+  // Only the slots of shared mailboxes are sized, the rest spill to chunks
+  if (body_size < MAX_MESSAGE_LEN || body_size > MAX_LARGE_MESSAGE_LEN ||
+      (body_size != MAX_MESSAGE_LEN &&
+       !(request->mailbox_type & SHARED_MAILBOX))) {
+    printf("Error: invalid body size %d\n", request->body_size);
+    free(request);
+    return ERROR;
+  }
+
+  // Its slots must fit in what is left of the budget
+  if (capacity < 1 ||
+      capacity > (MAILBOX_SLOT_BUDGET - mailbox_collection->reserved_slots) /
+                     budget_slots(body_size)) {
+    printf("Error: no room left for a mailbox of %d messages\n", capacity);
+    free(request);
+    return ERROR;
+  }
+
+  printf("The mailbox_type is: %d\n", request->mailbox_type);
+  printf("Senders: %d, receivers: %d\n", number_of_senders,
+         number_of_receivers);
+
+  // Create a new mailbox
+  // Assumes that the uid's that the user provides are valid
+
+  mailbox_t *new_mailbox = pool_alloc(&mailbox_pool);
+  message_t *head = pool_alloc(&message_pool);
+  char *name = malloc(name_bytes);
+  int lists = ERROR;
+
+  // Add send and receive access lists; a list that fails is left empty
+  if (new_mailbox != NULL) {
+    lists = create_list(senders, number_of_senders, &new_mailbox->send_access);
+    if (create_list(receivers, number_of_receivers,
+                    &new_mailbox->receive_access) != OK) {
+      lists = ERROR;
+    }
+  }
+
+  if (lists != OK || head == NULL || name == NULL) {
+    printf("Error: out of memory creating mailbox %s\n", mailbox_name);
+    if (new_mailbox != NULL) {
+      free(new_mailbox->send_access.uids);
+      free(new_mailbox->receive_access.uids);
+      pool_free(&mailbox_pool, new_mailbox);
+    }
+    if (head != NULL) {
+      pool_free(&message_pool, head);
+    }
+    free(name);
+    free(request);
+    return ERROR;
+  }
+
+  new_mailbox->owner = uid;
+  new_mailbox->number_of_messages = 0;
+  new_mailbox->capacity = capacity;
+  new_mailbox->mailbox_type = request->mailbox_type & ~SHARED_MAILBOX;
+  new_mailbox->shared = (request->mailbox_type & SHARED_MAILBOX) != 0;
+  new_mailbox->body_size = body_size;
+  new_mailbox->views = NULL;
+  new_mailbox->mailbox_name = strcpy(name, mailbox_name);
+  new_mailbox->name_len = strlen(mailbox_name);
+  new_mailbox->name_hash =
+      mailbox_hash(mailbox_name, new_mailbox->name_len);
+  new_mailbox->payload = NULL;
+  new_mailbox->free_slot = -1;
+  new_mailbox->free_links = NULL;
+  new_mailbox->senders = NULL;
+  new_mailbox->ready = 0;
+  free(request);
+
+  // Sentinel message for mailbox
   head->message = "HEAD";
   head->prev = head;
   head->next = head;
 
-  new_mailbox->head = head;
+  new_mailbox->head = head;
+
+  new_mailbox->next = mailbox_collection->head;
+  new_mailbox->prev = mailbox_collection->head->prev;
+
+  mailbox_collection->head->prev->next = new_mailbox;
+  mailbox_collection->head->prev = new_mailbox;
+
+  index_mailbox(new_mailbox);
+  mailbox_collection->number_of_mailboxes++;
+  mailbox_collection->reserved_slots += capacity * budget_slots(body_size);
+  return OK;
+}
+
+/* Removes a mailbox from the mailbox_collection
+ * Returns OK if the mailbox was removed
+ * Returns ERROR if the mailbox was not found
+ */
+/// Remove an existing mailbox. Only owners or the superuser may remove it.
+int do_remove_mailbox() {
 
-  new_mailbox->next = mailbox_collection->head;
-  new_mailbox->prev = mailbox_collection->head->prev;
+  char *mailbox_name;
+
+  int caller_uid = m_in.m1_i1;
+  int mailbox_name_len = m_in.m1_i2;
+
+  scratch_reset();
+  mailbox_name =
+      scratch_copy_in(m_in.m1_p1, mailbox_name_len, MAX_MAILBOX_NAME_LEN);
+  if (mailbox_name == NULL) {
+    printf("Error: invalid mailbox name\n");
+    return ERROR;
+  }
+
+  mailbox_t *mailbox = find_mailbox(mailbox_name);
+
+  if (mailbox == NULL) {
+    printf("Mailbox: Mailbox %s does not exist\n", mailbox_name);
+    return ERROR;
+  }
+
+  // Only remove mailbox if superuser or caller uid
+  // is the owner of the mailbox
+
+  if (caller_uid != 0 && mailbox->owner != caller_uid) {
+    printf("Error: the user with uid %d is not the owner of mailbox %s\n",
+           caller_uid, mailbox_name);
+    return ERROR;
+  }
+
+  mailbox->prev->next = mailbox->next;
+  mailbox->next->prev = mailbox->prev;
+  unindex_mailbox(mailbox);
+  // Before any slot is freed, so that it never becomes ready
+  cancel_senders(mailbox);
+  invalidate_handles(mailbox, -1, OPEN_SEND | OPEN_RECEIVE);
+
+  // Withdraw its messages from every reader's queue
+  message_t *message_ptr = mailbox->head->next;
+  while (message_ptr != mailbox->head) {
+    message_t *next = message_ptr->next;
+    reclaim_message(mailbox, message_ptr);
+    message_ptr = next;
+  }
+  pool_free(&message_pool, mailbox->head);
+  mailbox_collection->number_of_mailboxes--;
+  mailbox_collection->reserved_slots -=
+      mailbox->capacity * budget_slots(mailbox->body_size);
+
+  printf("+kernel debug: mailbox %s deleted\n", mailbox->mailbox_name);
+  free(mailbox->send_access.uids);
+  free(mailbox->receive_access.uids);
+  free_payload(mailbox);
+  free(mailbox->mailbox_name);
+  pool_free(&mailbox_pool, mailbox);
+
+  printf("Mailbox: Mailbox %s removed\n", mailbox_name);
+  return OK;
+}
+
+/// Check whether a user may write messages into a mailbox.
+static int may_send(mailbox_t *mb, int uid) {
+  int in_permission_list = acl_contains(&mb->send_access, uid);
+
+  return (uid == 0) ||
+         ((mb->mailbox_type == SECURE) && in_permission_list) ||
+         ((mb->mailbox_type == PUBLIC) && !in_permission_list);
+}
+
+/// Check whether @p mb holds as many messages as it may, or has no free slot.
+static int is_full(mailbox_t *mb) {
+  return mb->number_of_messages >= mb->capacity ||
+         (mb->payload != NULL && mb->free_slot == -1);
+}
+
+/* Check whether @p mb is full for good. A public mailbox is read at any
+ * pace, or not at all, by any number of readers, so rather than wait for
+ * them it keeps its latest messages: when full, it reclaims the oldest one
+ * no reader holds lent out or taken to make room.
+ */
+static int no_room(mailbox_t *mb) {
+  message_t *msg;
+
+  if (!is_full(mb)) {
+    return 0;
+  }
+  if (mb->mailbox_type == PUBLIC) {
+    for (msg = mb->head->next; msg != mb->head; msg = msg->next) {
+      if (msg->held == 0) {
+        reclaim_message(mb, msg);
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/// Check that @p mb has room for another message.
+static int has_room(mailbox_t *mb) {
+  if (no_room(mb)) {
+    printf("Error: mailbox is full\n");
+    return ERROR;
+  }
+  return OK;
+}
+
+/// Check that @p uid may deposit into @p mb and that it has room.
+static int may_deposit(mailbox_t *mb, int uid) {
+  if (!may_send(mb, uid)) {
+    printf("The user is not allowed to write in the specified mailbox\n");
+    return ERROR;
+  }
+  return has_room(mb);
+}
+
+/// Set up a message whose payload is in @p slot of @p mb.
+static void init_message(message_t *msg, mailbox_t *mb, int slot) {
+  msg->deliveries = NULL;
+  msg->readers_left = 0;
+  msg->held = 0;
+  msg->slot = slot;
+  msg->message = payload_slot(mb, slot);
+  msg->subject = msg->message + mb->body_size;
+  msg->length = 0;
+  msg->chunks = NULL;
+}
+
+/// Take a message and a payload slot for a new deposit into @p mb.
+static message_t *new_message(mailbox_t *mb) {
+  message_t *msg = pool_alloc(&message_pool);
+  int slot = msg != NULL ? take_payload_slot(mb) : -1;
+
+  if (slot == -1) {
+    printf("Error: out of memory adding message to mailbox %s\n",
+           mb->mailbox_name);
+    if (msg != NULL) {
+      pool_free(&message_pool, msg);
+    }
+    return NULL;
+  }
+
+  init_message(msg, mb, slot);
+  return msg;
+}
+
+/* Queue a message whose payload is in place for its readers and link it
+ * into its mailbox; gives the message back if that runs out of memory.
+ */
+static int post_message(mailbox_t *mb, message_t *msg) {
+  int r;
+
+  msg->seq = next_seq++;
+  if (mb->mailbox_type == PUBLIC) {
+    r = log_append(mb, msg);
+  } else {
+    r = deliver_message(mb, msg);
+  }
+  if (r != OK) {
+    printf("Error: out of memory queueing message for mailbox %s\n",
+           mb->mailbox_name);
+    drop_deliveries(msg);
+    discard_message(mb, msg);
+    return ERROR;
+  }
+
+  msg->next = mb->head;
+  msg->prev = mb->head->prev;
+  mb->head->prev->next = msg;
+  mb->head->prev = msg;
+
+  mb->number_of_messages += 1;
+
+  printf("Mailbox: Current amount of messages in mailbox: %d\n",
+         mb->number_of_messages);
+
+  if (mb->mailbox_type == PUBLIC) {
+    wake_blocked(mb);
+  } else {
+    wake_readers(msg);
+  }
+  return OK;
+}
+
+/* Deposit into @p mailbox the message and subject at @p body and
+ * @p subject in @p endpoint, copied straight into the mailbox's payload
+ * slot.
+ */
+static int copy_in_message(mailbox_t *mailbox, endpoint_t endpoint,
+                           vir_bytes body, vir_bytes subject, int messageLen,
+                           int subjectLen) {
+  message_t *new_message_ptr = new_message(mailbox);
+  if (new_message_ptr == NULL) {
+    return ERROR;
+  }
+
+  if (messageLen > mailbox->body_size) {
+    if (mailbox->shared) {
+      printf("Error: mailbox %s takes messages of up to %d bytes\n",
+             mailbox->mailbox_name, mailbox->body_size);
+      discard_message(mailbox, new_message_ptr);
+      return ERROR;
+    }
+    if (alloc_chunks(new_message_ptr, messageLen) != OK) {
+      printf("Error: out of memory adding message to mailbox %s\n",
+             mailbox->mailbox_name);
+      discard_message(mailbox, new_message_ptr);
+      return ERROR;
+    }
+  }
+
+  int messageBytes = messageLen * sizeof(char);
+  if (copy_body(new_message_ptr, 1, endpoint, body, messageBytes) != OK) {
+    discard_message(mailbox, new_message_ptr);
+    return ERROR;
+  }
+  *body_byte(new_message_ptr, messageLen - 1) = '\0';
+
+  int subjectBytes = subjectLen * sizeof(char);
+  if (sys_datacopy(endpoint, subject, SELF,
+                   (vir_bytes)new_message_ptr->subject, subjectBytes) != OK) {
+    discard_message(mailbox, new_message_ptr);
+    return ERROR;
+  }
+  new_message_ptr->subject[subjectLen - 1] = '\0';
+
+  printf("Mailbox: New message received. Subject with %d bytes: %s,message "
+         "content with %d bytes: %.*s\n",
+         subjectBytes, new_message_ptr->subject, messageBytes,
+         MAX_MESSAGE_LEN - 1, new_message_ptr->message);
+
+  return post_message(mailbox, new_message_ptr);
+}
+
+/* Blocked deposits */
+
+/// Take a sender off its mailbox's queue of blocked senders.
+static void unqueue_sender(mailbox_t *mb, sender_t *s) {
+  if (s->next == s) {
+    mb->senders = NULL;
+  } else {
+    s->prev->next = s->next;
+    s->next->prev = s->prev;
+    if (mb->senders == s) {
+      mb->senders = s->next;
+    }
+  }
+}
+
+/* Suspend the caller of MAILBOX_DEPOSIT_WAIT until @p mb has room for the
+ * message in its request, behind the senders already waiting there.
+ */
+static int block_sender(mailbox_t *mb, int uid, int messageLen,
+                        int subjectLen) {
+  sender_t *s = pool_alloc(&sender_pool);
+
+  if (s == NULL) {
+    printf("Error: out of memory suspending uid %d\n", uid);
+    return ERROR;
+  }
+  s->uid = uid;
+  s->endpoint = who_e;
+  s->body = (vir_bytes)m_in.m1_p1;
+  s->subject = (vir_bytes)m_in.m1_p2;
+  s->body_bytes = messageLen;
+  s->subject_bytes = subjectLen;
+
+  if (mb->senders == NULL) {
+    s->prev = s;
+    s->next = s;
+    mb->senders = s;
+  } else {
+    s->next = mb->senders;
+    s->prev = mb->senders->prev;
+    s->prev->next = s;
+    mb->senders->prev = s;
+  }
+  vm_watch_exit(who_e);
+
+  printf("Mailbox: uid %d waiting for room in mailbox %s\n", uid,
+         mb->mailbox_name);
+  return EDONTREPLY;
+}
+
+/// Fail every deposit blocked on @p mb.
+static void cancel_senders(mailbox_t *mb) {
+  sender_t *s;
+
+  while ((s = mb->senders) != NULL) {
+    unqueue_sender(mb, s);
+    mailbox_reply(s->endpoint, ERROR);
+    pool_free(&sender_pool, s);
+  }
+}
+
+/// Fail the deposits @p uid has blocked on @p mb (every mailbox if NULL).
+static void fail_senders(mailbox_t *mb, int uid) {
+  mailbox_t *at;
+
+  if (!mailbox_collection) {
+    return;
+  }
+  for (at = mailbox_collection->head->next; at != mailbox_collection->head;
+       at = at->next) {
+    sender_t *s, *next;
+
+    if (mb != NULL && at != mb) {
+      continue;
+    }
+    for (s = at->senders; s != NULL; s = next) {
+      next = s->next != at->senders ? s->next : NULL;
+      if (s->uid == uid) {
+        unqueue_sender(at, s);
+        mailbox_reply(s->endpoint, ERROR);
+        pool_free(&sender_pool, s);
+      }
+    }
+  }
+}
+
+/* Let in the senders blocked on mailboxes that have gained room, oldest
+ * first, until each is full again. Runs once the request that made the
+ * room has been handled, never inside a handler. A sender that may no
+ * longer write to the mailbox is failed instead.
+ */
+void admit_senders() {
+  while (ready_mailboxes != NULL) {
+    mailbox_t *mb = ready_mailboxes;
+    sender_t *s;
+
+    ready_mailboxes = mb->ready_next;
+    mb->ready = 0;
+    while ((s = mb->senders) != NULL && !no_room(mb)) {
+      int r = ERROR;
+
+      unqueue_sender(mb, s);
+      if (may_send(mb, s->uid)) {
+        r = copy_in_message(mb, s->endpoint, s->body, s->subject,
+                            s->body_bytes, s->subject_bytes);
+      } else {
+        printf("The user is not allowed to write in the specified mailbox\n");
+      }
+      mailbox_reply(s->endpoint, r);
+      pool_free(&sender_pool, s);
+    }
+  }
+}
+
+/* Creates mailbox if there is none
+ * Add message to mailbox (if mailbox is not full)
+ * Returns OK if message was successfully added
+ * Returns ERROR if mailbox is full, unless called as MAILBOX_DEPOSIT_WAIT:
+ * then the caller is suspended until a message is reclaimed
+ */
+/// Deposit a message into a mailbox.
+int do_add_to_mailbox() {
+  char *mailboxName;
+
+  int messageLen;
+  int subjectLen;
+  int mailboxNameLen;
+
+  messageLen = m_in.m1_i1;
+  subjectLen = m_in.m1_i2;
+  mailboxNameLen = m_in.m1_i3;
+  int uid = (int)m_in.m1_ull1;
+
+  if (messageLen < 1 || messageLen > MAX_LARGE_MESSAGE_LEN) {
+    printf("Error: Length of the message > %d\n", MAX_LARGE_MESSAGE_LEN);
+    return ERROR;
+  }
+
+  if (subjectLen < 1 || subjectLen > MAX_SUBJECT_LEN) {
+    printf("Error: Length of the subject > %d\n", MAX_SUBJECT_LEN);
+    return ERROR;
+  }
+
+  scratch_reset();
+  mailboxName =
+      scratch_copy_in(m_in.m1_p3, mailboxNameLen, MAX_MAILBOX_NAME_LEN);
+  if (mailboxName == NULL) {
+    printf("Error: Length of the mailbox name > %d\n", MAX_MAILBOX_NAME_LEN);
+    return ERROR;
+  }
+
+  // search mailbox by name, if it does not exist -> Error
+  // store mailbox pointer in mailbox var
+
+  mailbox_t *mailbox = find_mailbox(mailboxName);
+
+  if (mailbox == NULL) {
+    printf("Error: not found mailbox with given name\n");
+    return ERROR;
+  }
+
+  // Permission to write, and room?
+  if (call_nr == MAILBOX_DEPOSIT_WAIT && may_send(mailbox, uid) &&
+      no_room(mailbox)) {
+    return block_sender(mailbox, uid, messageLen, subjectLen);
+  }
+  if (may_deposit(mailbox, uid) != OK) {
+    return ERROR;
+  }
+
+  return copy_in_message(mailbox, who_e, (vir_bytes)m_in.m1_p1,
+                         (vir_bytes)m_in.m1_p2, messageLen, subjectLen);
+}
+
+
+/* Deposit a message carried inline in the request (mail_inline_t)
+ * Same checks as do_add_to_mailbox(), without copying anything in from the
+ * caller.
+ */
+/// Deposit a short message straight from the request.
+int do_add_inline_to_mailbox() {
+  mail_inline_t request;
+  char mailboxName[MAX_MAILBOX_NAME_LEN];
+  char *subject, *body;
+
+  memcpy(&request, m_in.m_u8.data, sizeof(request));
+
+  if (request.name_len + request.subject_len + request.body_len >
+          INLINE_TEXT ||
+      request.name_len >= MAX_MAILBOX_NAME_LEN ||
+      request.subject_len >= MAX_SUBJECT_LEN) {
+    printf("Error: malformed inline message\n");
+    return ERROR;
+  }
+  memcpy(mailboxName, request.text, request.name_len);
+  mailboxName[request.name_len] = '\0';
+  subject = request.text + request.name_len;
+  body = subject + request.subject_len;
+
+  mailbox_t *mailbox = find_mailbox(mailboxName);
+
+  if (mailbox == NULL) {
+    printf("Error: not found mailbox with given name\n");
+    return ERROR;
+  }
+
+  if (may_deposit(mailbox, request.uid) != OK) {
+    return ERROR;
+  }
+
+  message_t *new_message_ptr = new_message(mailbox);
+  if (new_message_ptr == NULL) {
+    return ERROR;
+  }
+
+  memcpy(new_message_ptr->message, body, request.body_len);
+  new_message_ptr->message[request.body_len] = '\0';
+  memcpy(new_message_ptr->subject, subject, request.subject_len);
+  new_message_ptr->subject[request.subject_len] = '\0';
+
+  printf("Mailbox: New inline message received. Subject: %s, message: %s\n",
+         new_message_ptr->subject, new_message_ptr->message);
+
+  return post_message(mailbox, new_message_ptr);
+}
+
+/// Find the terminator of a string of at most @p max bytes at @p off.
+static char *batch_string(int off, int used, int max) {
+  int room = used - off;
+
+  if (off < 0 || room < 1) {
+    return NULL;
+  }
+  return memchr(batch + off, '\0', room < max ? room : max);
+}
+
+/* Deposit a packed batch of messages
+ * The caller's buffer holds m1_i2 descriptors (mail_desc_t) followed by the
+ * mailbox names, subjects and bodies they refer to, m1_i1 bytes in all. It
+ * is copied in at once; each record is then deposited like a single
+ * send_message() and its OK/ERROR goes in the status array at m1_p2.
+ * Returns the number of records deposited.
+ */
+/// Deposit several messages, possibly into different mailboxes, in one call.
+int do_add_batch_to_mailbox() {
+  int used = m_in.m1_i1;
+  int count = m_in.m1_i2;
+  int uid = (int)m_in.m1_ull1;
+  int status[MAX_BATCH_COUNT];
+  mailbox_t *mailbox = NULL;
+  mail_desc_t desc;
+  int deposited = 0;
+  int i;
+
+  if (count < 1 || count > MAX_BATCH_COUNT) {
+    printf("Error: batch size should be between 1 and %d\n", MAX_BATCH_COUNT);
+    return ERROR;
+  }
+  if (used < count * (int)sizeof(mail_desc_t) || used > MAX_BATCH_BYTES) {
+    printf("Error: batch should be at most %d bytes\n", MAX_BATCH_BYTES);
+    return ERROR;
+  }
+  if (sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)batch,
+                   used) != OK) {
+    return ERROR;
+  }
+
+  for (i = 0; i < count; i++) {
+    char *name, *subject, *end;
+    message_t *msg;
+
+    status[i] = ERROR;
+    memcpy(&desc, batch + i * sizeof(mail_desc_t), sizeof(desc));
+
+    // Every string must end inside the batch and within its limit
+    if (batch_string(desc.mailbox, used, MAX_MAILBOX_NAME_LEN) == NULL ||
+        batch_string(desc.subject, used, MAX_SUBJECT_LEN) == NULL ||
+        desc.length < 1 || desc.length > MAX_MESSAGE_LEN ||
+        (end = batch_string(desc.body, used, desc.length)) == NULL) {
+      printf("Error: malformed record %d in batch\n", i);
+      continue;
+    }
+    name = batch + desc.mailbox;
+    subject = batch + desc.subject;
+
+    // Bursts usually go to one mailbox; look it up once per run of records
+    if (mailbox == NULL || strcmp(mailbox->mailbox_name, name) != 0) {
+      mailbox = find_mailbox(name);
+    }
+    if (mailbox == NULL) {
+      printf("Error: not found mailbox with given name\n");
+      continue;
+    }
+    if (may_deposit(mailbox, uid) != OK ||
+        (msg = new_message(mailbox)) == NULL) {
+      continue;
+    }
+
+    memcpy(msg->message, batch + desc.body, end - (batch + desc.body) + 1);
+    strcpy(msg->subject, subject);
+    if (post_message(mailbox, msg) == OK) {
+      status[i] = OK;
+      deposited++;
+    }
+  }
+
+  printf("Mailbox: %d of %d messages in batch deposited\n", deposited,
+         count);
+
+  if (m_in.m1_p2 != NULL &&
+      sys_datacopy(SELF, (vir_bytes)status, who_e, (vir_bytes)m_in.m1_p2,
+                   count * sizeof(int)) != OK) {
+    return ERROR;
+  }
+  return deposited;
+}
+
+/* Retrieve a process' messages from the mailbox
+ * Readers are fixed when a message is deposited; each retrieve hands out the
+ * oldest message still queued for the caller, whichever mailbox holds it.
+ * The message is garbage collected once all of its readers have it.
+ * With RECEIVE_WAIT and nothing queued the caller is suspended and gets its
+ * reply when the next message for it is deposited, or ERROR once its
+ * timeout passes. A message that does not fit in the caller's buffer (m1_i1
+ * bytes) stays queued and the call fails.
+ */
+/// Fetch a message for a user from any mailbox they can access.
+int do_get_from_mailbox() {
+  int bufferSize = m_in.m1_i1;
+  int recipient = m_in.m1_i2;
+  int mode = m_in.m1_i3;
+  uint64_t timeout_ms = m_in.m1_ull1;
+
+  printf(
+      "Mailbox: get_mail request received from recipient %d. Buffer size: %d\n",
+      recipient, bufferSize);
+
+  if (bufferSize < 1) {
+    printf("Error: insufficient buffer size\n");
+    return (ERROR);
+  }
+  // The oldest message queued for the recipient, if any
+  user_t *reader = getUser(recipient);
+
+  if (reader == NULL) {
+    return ERROR;
+  }
+
+  delivery_t *d = next_pending(reader, reader->pending->next);
+
+  if (d == NULL) {
+    if (mode != RECEIVE_WAIT) {
+      return ERROR;
+    }
+
+    waiter_t *w = pool_alloc(&waiter_pool);
+    if (w == NULL) {
+      printf("Error: out of memory suspending uid %d\n", recipient);
+      return ERROR;
+    }
+    w->uid = recipient;
+    w->endpoint = who_e;
+    w->buffer = (vir_bytes)m_in.m1_p1;
+    w->buffer_size = bufferSize;
+    w->heap_index = -1;
+    if (timeout_ms > 0) {
+      uint64_t ticks = (timeout_ms * sys_hz() + 999) / 1000;
+      w->deadline = getticks() + (clock_t)ticks;
+      if (timeout_add(w) != OK) {
+        printf("Error: out of memory suspending uid %d\n", recipient);
+        pool_free(&waiter_pool, w);
+        return ERROR;
+      }
+    }
+    enqueue_waiter(reader, w);
+    vm_watch_exit(who_e);
+
+    printf("Mailbox: uid %d waiting for a message\n", recipient);
+    return EDONTREPLY;
+  }
+
+  printf("Mailbox: uid %d success\n", recipient);
+
+  if (mode == RECEIVE_MAPPED) {
+    if (lend_mapped(d) == OK) {
+      return OK;
+    }
+    m_out.m1_i1 = -1;
+  } else if (body_length(d->message) <= bufferSize &&
+             hand_out_inline(d) == OK) {
+    return OK;
+  }
+  return hand_out(d, who_e, (vir_bytes)m_in.m1_p1, bufferSize);
+}
 
-  mailbox_collection->head->prev->next = new_mailbox;
-  mailbox_collection->head->prev = new_mailbox;
+/* Size of the caller's next message
+ * The body length, terminator included, of the oldest message queued for
+ * uid m1_i2: what a receive would hand out next. ERROR if none is queued.
+ */
+/// Report the size of a user's next message.
+int do_probe_mailbox() {
+  user_t *reader = getUser(m_in.m1_i2);
+  delivery_t *d;
 
-  mailbox_collection->number_of_mailboxes++;
-  return OK;
+  if (reader == NULL ||
+      (d = next_pending(reader, reader->pending->next)) == NULL) {
+    return ERROR;
+  }
+  return body_length(d->message);
 }
 
-/* Removes a mailbox from the mailbox_collection
- * Returns OK if the mailbox was removed
- * Returns ERROR if the mailbox was not found
+/* Retrieve up to m1_i3 of the caller's queued messages, oldest first
+ * The descriptors and the mailbox names, subjects and bodies they point at
+ * are laid out in a staging area and reach the caller in one copy. Stops
+ * early at the first message that does not fit in the caller's buffer.
+ * Returns the number of messages retrieved.
  */
-/// Remove an existing mailbox. Only owners or the superuser may remove it.
-int do_remove_mailbox() {
+/// Fetch a batch of messages for a user in one call.
+int do_get_batch_from_mailbox() {
+  int bufferSize = m_in.m1_i1;
+  int recipient = m_in.m1_i2;
+  int max_messages = m_in.m1_i3;
+  mail_desc_t desc;
+  delivery_t *d;
+  int used, count, i;
 
-  char *mailbox_name;
+  if (max_messages < 1 || max_messages > MAX_BATCH_COUNT) {
+    printf("Error: batch size should be between 1 and %d\n", MAX_BATCH_COUNT);
+    return ERROR;
+  }
+  if (bufferSize > MAX_BATCH_BYTES) {
+    bufferSize = MAX_BATCH_BYTES;
+  }
+  used = max_messages * sizeof(mail_desc_t);
+  if (bufferSize < used) {
+    printf("Error: insufficient buffer size for %d descriptors\n",
+           max_messages);
+    return ERROR;
+  }
 
-  int caller_uid = m_in.m1_i1;
-  int mailbox_name_len = m_in.m1_i2;
+  user_t *reader = getUser(recipient);
 
-  int mailbox_name_bytes = mailbox_name_len * sizeof(char);
-  mailbox_name = malloc(mailbox_name_bytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)mailbox_name,
-               mailbox_name_bytes);
+  if (reader == NULL) {
+    return ERROR;
+  }
 
-  if (!mailbox_collection) {
+  count = 0;
+  for (d = next_pending(reader, reader->pending->next);
+       d != NULL && count < max_messages;
+       d = next_pending(reader, d->next)) {
+    message_t *msg = d->message;
+    int name_bytes = d->mailbox->name_len + 1;
+    int subject_bytes = strnlen(msg->subject, MAX_SUBJECT_LEN - 1) + 1;
+    int body_bytes = body_length(msg);
+
+    if (used + name_bytes + subject_bytes + body_bytes > bufferSize) {
+      break;
+    }
+    desc.mailbox = used;
+    memcpy(batch + used, d->mailbox->mailbox_name, name_bytes);
+    used += name_bytes;
+    desc.subject = used;
+    memcpy(batch + used, msg->subject, subject_bytes - 1);
+    batch[used + subject_bytes - 1] = '\0';
+    used += subject_bytes;
+    desc.body = used;
+    desc.length = body_bytes;
+    gather_body(msg, batch + used, body_bytes - 1);
+    batch[used + body_bytes - 1] = '\0';
+    used += body_bytes;
+
+    memcpy(batch + count * sizeof(mail_desc_t), &desc, sizeof(desc));
+    count++;
+  }
+
+  if (count == 0) {
+    if (d != NULL) {
+      printf("Error: insufficient buffer size for the next message\n");
+      return ERROR;
+    }
+    return 0;
+  }
+
+  if (sys_datacopy(SELF, (vir_bytes)batch, who_e, (vir_bytes)m_in.m1_p1,
+                   used) != OK) {
     return ERROR;
   }
 
-  mailbox_t *head = mailbox_collection->head->next;
-  int mailbox_found = 0;
+  // Retire what was copied; frees each message after its last reader
+  for (i = 0; i < count; i++) {
+    finish_delivery(reader->pending->next);
+  }
 
-  while (strcmp(head->mailbox_name, "HEAD") != 0) {
-    printf("+kernel debug: mailbox_name is %s\n", head->mailbox_name);
-    if (strcmp(head->mailbox_name, mailbox_name) == 0) {
+  printf("Mailbox: uid %d received %d messages\n", recipient, count);
 
-      // Only remove mailbox if superuser or caller uid
-      // is the owner of the mailbox
+  return count;
+}
 
-      if (caller_uid == 0 || head->owner == caller_uid) {
-        head->prev->next = head->next;
-        head->next->prev = head->prev;
+/// Delete a message with a specific subject from a mailbox.
+int do_delete_message() {
+  int caller_uid = m_in.m1_i1;
+  int mailboxNameLen = m_in.m1_i2;
+  int subjectLen = m_in.m1_i3;
 
-        printf("+kernel debug: mailbox %s deleted\n", head->mailbox_name);
-        free(head);
-        mailbox_found = 1;
-        mailbox_collection->number_of_mailboxes--;
-      } else {
-        printf("Error: the user with uid %d is not the owner of mailbox %s\n",
-               caller_uid, mailbox_name);
-        return ERROR;
-      }
-    }
+  char *mailboxName;
+  char *subject;
 
-    head = head->next;
+  scratch_reset();
+  mailboxName =
+      scratch_copy_in(m_in.m1_p1, mailboxNameLen, MAX_MAILBOX_NAME_LEN);
+  if (mailboxName == NULL) {
+    printf("Error: invalid mailbox name\n");
+    return ERROR;
   }
 
-  if (mailbox_found) {
-    printf("Mailbox: Mailbox %s removed\n", mailbox_name);
-    return OK;
-  } else {
-    printf("Mailbox: Mailbox %s does not exist\n", mailbox_name);
+  subject = scratch_copy_in(m_in.m1_p2, subjectLen, MAX_SUBJECT_LEN);
+  if (subject == NULL) {
+    printf("Error: invalid subject\n");
+    return ERROR;
+  }
+
+  // find mailbox
+  mailbox_t *mailbox = find_mailbox(mailboxName);
+
+  if (mailbox == NULL) {
+    printf("Error: not found mailbox with given name: %s\n", mailboxName);
+    return ERROR;
+  }
+
+  // check owner
+  int privileges = get_privileges_for_user(caller_uid);
+  if ((privileges & 0b0100) == 0b0100) {
+    printf("Error: user with uid %d does not have remove_message privilege for "
+           "mailbox %s\n",
+           caller_uid, mailbox->mailbox_name);
+    return ERROR;
+  }
+
+  // Find message by subject and remove
+
+  if (mailbox->number_of_messages == 0) {
+    printf("Error: mailbox %s is empty\n", mailboxName);
     return ERROR;
   }
+
+  int i = 0;
+  message_t *message_ptr = mailbox->head->next;
+  while (i < mailbox->number_of_messages) {
+    if (!strncmp(message_ptr->subject, subject, MAX_SUBJECT_LEN)) {
+      reclaim_message(mailbox, message_ptr);
+      printf("+Mailbox: Message with subject %s has been deleted\n", subject);
+      return OK;
+    }
+    message_ptr = message_ptr->next;
+    i++;
+  }
+  printf("Error: message with subject %s not found in mailbox %s\n", subject,
+         mailboxName);
+  return ERROR;
 }
 
-/* Creates mailbox if there is none
- * Add message to mailbox (if mailbox is not full)
- * Returns OK if message was successfully added
- * Returns ERROR if mailbox is full
- */
-/// Deposit a message into a mailbox.
-int do_add_to_mailbox() {
-  char *message;
-  char *subject;
+/// Grant sender privileges for a mailbox to a user.
+int do_add_sender() {
   char *mailboxName;
+  int caller_uid = m_in.m1_i1;
+  int uid = m_in.m1_i2;
+  int mailboxNameLen = m_in.m1_i3;
 
-  int messageLen;
-  int subjectLen;
-  int mailboxNameLen;
+  scratch_reset();
+  mailboxName =
+      scratch_copy_in(m_in.m1_p1, mailboxNameLen, MAX_MAILBOX_NAME_LEN);
+  if (mailboxName == NULL) {
+    printf("Error: invalid mailbox name\n");
+    return ERROR;
+  }
 
-  messageLen = m_in.m1_i1;
-  subjectLen = m_in.m1_i2;
-  mailboxNameLen = m_in.m1_i3;
+  // find mailbox
+  mailbox_t *mailbox = find_mailbox(mailboxName);
 
-  if (messageLen > MAX_MESSAGE_LEN) {
-    printf("Error: Length of the message > %d\n", MAX_MESSAGE_LEN);
+  if (mailbox == NULL) {
+    printf("Mailbox: mailbox %s does not exist!\n", mailboxName);
     return ERROR;
   }
 
-  int messageBytes = messageLen * sizeof(char);
-  message = malloc(messageBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)message,
-               messageBytes);
+  // Check privileges
+  int privileges = get_privileges_for_user(caller_uid);
+  if ((privileges & 0b0010) == 0b0010) {
+    printf("Error: user with uid %d does not have add_sender privilege for "
+           "mailbox %s\n",
+           caller_uid, mailbox->mailbox_name);
+    return ERROR;
+  }
 
-  if (subjectLen > MAX_SUBJECT_LEN) {
-    printf("Error: Length of the subject > %d\n", MAX_SUBJECT_LEN);
+  // Add the user to the list, unless it is already there
+  if (acl_contains(&mailbox->send_access, uid)) {
+    printf("Error: User with uid %d is already in the senders list.\n", uid);
     return ERROR;
   }
 
-  int subjectBytes = subjectLen * sizeof(char);
-  subject = malloc(subjectBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p2, SELF, (vir_bytes)subject,
-               subjectBytes);
+  if (acl_add(&mailbox->send_access, uid) != OK) {
+    printf("Error: out of memory adding uid %d to mailbox %s\n", uid,
+           mailbox->mailbox_name);
+    return ERROR;
+  }
 
-  printf("Mailbox: New message received. Subject with %d bytes: %s,message "
-         "content with %d bytes: %s\n",
-         subjectBytes, subject, messageBytes, message);
+  // On a public mailbox the list denies access
+  if (mailbox->mailbox_type == PUBLIC && uid != 0) {
+    invalidate_handles(mailbox, uid, OPEN_SEND);
+    fail_senders(mailbox, uid);
+  }
 
-  int mailboxNameBytes = mailboxNameLen * sizeof(char);
-  mailboxName = malloc(mailboxNameBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p3, SELF, (vir_bytes)mailboxName,
-               mailboxNameBytes);
+  printf("Added user with uid %d to the senders list of mailbox %s\n", uid,
+         mailbox->mailbox_name);
+  return OK;
+}
 
-  // search mailbox by name, if it does not exist -> Error
-  // store mailbox pointer in mailbox var
+/// Grant receiver privileges for a mailbox to a user.
+int do_add_receiver() {
+  char *mailboxName;
 
-  if (!mailbox_collection) {
-    printf("Error: mailbox collection not created yet.\n");
+  int caller_uid = m_in.m1_i1;
+  int uid = m_in.m1_i2;
+  int mailboxNameLen = m_in.m1_i3;
+
+  scratch_reset();
+  mailboxName =
+      scratch_copy_in(m_in.m1_p1, mailboxNameLen, MAX_MAILBOX_NAME_LEN);
+  if (mailboxName == NULL) {
+    printf("Error: invalid mailbox name\n");
     return ERROR;
   }
 
-  int found = 0;
-  mailbox_t *mailbox = mailbox_collection->head->next;
-  while (!found && (strcmp(mailbox->mailbox_name, "HEAD") != 0)) {
-    if (strcmp(mailbox->mailbox_name, mailboxName) == 0) {
-      found = 1;
-    } else {
-      mailbox = mailbox->next;
-    }
+  // find mailbox
+  mailbox_t *mailbox = find_mailbox(mailboxName);
+
+  if (mailbox == NULL) {
+    printf("Error: not found mailbox with given name: %s\n", mailboxName);
+    return ERROR;
   }
 
-  if (!found) {
-    printf("Error: not found mailbox with given name\n");
+  int privileges = get_privileges_for_user(caller_uid);
+  if ((privileges & 0b0001) == 0b0001) {
+    printf("Error: user with uid %d does not have add_receiver privilege for "
+           "mailbox %s\n",
+           caller_uid, mailbox->mailbox_name);
     return ERROR;
   }
 
-  // Permission to write?
+  // Add the user to the list, unless it is already there
+  if (acl_contains(&mailbox->receive_access, uid)) {
+    printf("Error: User with uid %d is already in the receivers list.\n", uid);
+    return ERROR;
+  }
 
-  int uid = (int)m_in.m1_ull1;
-  int in_permission_list = 0;
-  uid_node_t *send_access_list = mailbox->send_access;
+  if (acl_add(&mailbox->receive_access, uid) != OK) {
+    printf("Error: out of memory adding uid %d to mailbox %s\n", uid,
+           mailbox->mailbox_name);
+    return ERROR;
+  }
+
+  // On a public mailbox the list denies access: withdraw queued messages
+  user_t *reader = getUser(uid);
+  if (mailbox->mailbox_type == PUBLIC && uid != 0 && reader != NULL) {
+    drop_pending(reader, mailbox);
+  }
+  if (mailbox->mailbox_type == PUBLIC && uid != 0) {
+    invalidate_handles(mailbox, uid, OPEN_RECEIVE);
+  }
+
+  printf("Added user with uid %d to the receivers list of mailbox %s\n", uid,
+         mailbox->mailbox_name);
+  return OK;
+}
+
+/// Revoke sender privileges from a user.
+int do_remove_sender() {
+  char *mailboxName;
+
+  int caller_uid = m_in.m1_i1;
+  int uid = m_in.m1_i2;
+  int mailboxNameLen = m_in.m1_i3;
+
+  scratch_reset();
+  mailboxName =
+      scratch_copy_in(m_in.m1_p1, mailboxNameLen, MAX_MAILBOX_NAME_LEN);
+  if (mailboxName == NULL) {
+    printf("Error: invalid mailbox name\n");
+    return ERROR;
+  }
+
+  // find mailbox
+  mailbox_t *mailbox = find_mailbox(mailboxName);
+
+  if (mailbox == NULL) {
+    printf("Error: not found mailbox with given name: %s\n", mailboxName);
+    return ERROR;
+  }
+
+  // Check to make sure that the current user is the owner of this mailbox
+  int privileges = get_privileges_for_user(caller_uid);
+  if ((privileges & 0b0010) == 0b0010) {
+    printf("Error: user with uid %d does not have remove_sender privilege for "
+           "mailbox %s\n",
+           caller_uid, mailbox->mailbox_name);
+    return ERROR;
+  }
 
-  uid_node_t *uid_p = send_access_list->next;
+  // Find the user in senders list
 
-  while ((uid_p->uid != -1) && !in_permission_list) {
-    if (uid == uid_p->uid) {
-      in_permission_list = 1;
+  if (acl_remove(&mailbox->send_access, uid) == OK) {
+    if (mailbox->mailbox_type == SECURE && uid != 0) {
+      invalidate_handles(mailbox, uid, OPEN_SEND);
+      fail_senders(mailbox, uid);
     }
-    uid_p = uid_p->next;
+    printf("Removed user with uid %d from the senders list of mailbox %s\n",
+           uid, mailbox->mailbox_name);
+    return OK;
   }
 
-  int permission = ((uid == 0) ||
-                    ((mailbox->mailbox_type == SECURE) && in_permission_list) ||
-                    ((mailbox->mailbox_type == PUBLIC) && !in_permission_list))
-                       ? 1
-                       : 0;
+  printf("Error: user uid %d not found in mailbox with given name: %s\n", uid,
+         mailboxName);
+  return ERROR;
+}
+
+/// Revoke receiver privileges from a user.
+int do_remove_receiver() {
+  char *mailboxName;
 
-  if (!permission) {
-    printf("The user is not allowed to write in the specified mailbox\n");
+  int caller_uid = m_in.m1_i1;
+  int uid = m_in.m1_i2;
+  int mailboxNameLen = m_in.m1_i3;
+
+  scratch_reset();
+  mailboxName =
+      scratch_copy_in(m_in.m1_p1, mailboxNameLen, MAX_MAILBOX_NAME_LEN);
+  if (mailboxName == NULL) {
+    printf("Error: invalid mailbox name\n");
     return ERROR;
   }
 
-  if (mailbox->number_of_messages < MAX_MESSAGE_COUNT) {
-    message_t *new_message = malloc(sizeof(message_t));
-    new_message->message = message;
-    new_message->subject = subject;
+  // find mailbox
+  mailbox_t *mailbox = find_mailbox(mailboxName);
 
-    new_message->next = mailbox->head;
-    new_message->prev = mailbox->head->prev;
-    mailbox->head->prev->next = new_message;
-    mailbox->head->prev = new_message;
+  if (mailbox == NULL) {
+    printf("Error: not found mailbox with given name: %s\n", mailboxName);
+    return ERROR;
+  }
 
-    mailbox->number_of_messages += 1;
+  // Find the user in receivers list
 
-    printf("Mailbox: Current amount of messages in mailbox: %d\n",
-           mailbox->number_of_messages);
-  } else {
-    printf("Error: mailbox is full\n");
+  int privileges = get_privileges_for_user(caller_uid);
+  if ((privileges & 0b0001) == 0b0001) {
+    printf("Error: user with uid %d does not have remove_receiver privilege "
+           "for mailbox %s\n",
+           caller_uid, mailbox->mailbox_name);
     return ERROR;
   }
 
-  return OK;
+  if (acl_remove(&mailbox->receive_access, uid) == OK) {
+    // Withdraw messages queued for a receiver of a secure mailbox
+    user_t *reader = getUser(uid);
+    if (mailbox->mailbox_type == SECURE && uid != 0 && reader != NULL) {
+      drop_pending(reader, mailbox);
+    }
+    if (mailbox->mailbox_type == SECURE && uid != 0) {
+      invalidate_handles(mailbox, uid, OPEN_RECEIVE);
+    }
+    printf("Removed user with uid %d from the receivers list of mailbox %s\n",
+           uid, mailbox->mailbox_name);
+    return OK;
+  }
+
+  printf("Error: user with uid %d not found in mailbox with given name: %s\n",
+         uid, mailboxName);
+  return ERROR;
 }
 
-/* Retrieve a process' messages from the mailbox
- * Garbage collect a given message if all designated processes have received the
- * message Deadlock can occur if the mailbox is full, and no process retrieves
- * the messages from the mailbox
+/* Mailbox handles */
+
+/* The queue of @p uid's deliveries from @p mb for a new receive handle:
+ * the one its other handles share, or one built from its pending queue.
  */
-/// Fetch a message for a user from any mailbox they can access.
-int do_get_from_mailbox() {
-  char *message;
-  int bufferSize = m_in.m1_i1;
-  int recipient = m_in.m1_i2;
+static mailbox_queue_t *open_queue(int uid, mailbox_t *mb) {
+  user_t *reader = getUser(uid);
+  mailbox_queue_t *q;
+  delivery_t *d;
+
+  if (reader == NULL) {
+    printf("Error: uid %d is not registered\n", uid);
+    return NULL;
+  }
+  if ((q = find_queue(reader, mb)) != NULL) {
+    q->handles++;
+    return q;
+  }
 
-  printf(
-      "Mailbox: get_mail request received from recipient %d. Buffer size: %d\n",
-      recipient, bufferSize);
+  q = malloc(sizeof(mailbox_queue_t));
+  if (q == NULL || (q->head = pool_alloc(&delivery_pool)) == NULL) {
+    printf("Error: out of memory opening mailbox %s\n", mb->mailbox_name);
+    free(q);
+    return NULL;
+  }
+  q->mailbox = mb;
+  q->handles = 1;
+  q->head->queue_prev = q->head;
+  q->head->queue_next = q->head;
+  for (d = reader->pending->next; d != reader->pending; d = d->next) {
+    if (d->mailbox == mb) {
+      enqueue_delivery(q, d);
+    }
+  }
+  q->next = reader->queues;
+  reader->queues = q;
+  return q;
+}
 
-  if (bufferSize < MAX_MESSAGE_LEN) {
-    printf("Error: insufficient buffer size, should be %d chars\n",
-           MAX_MESSAGE_LEN);
-    return (ERROR);
+/// Let go of a receive handle's queue, freeing it after its last handle.
+static void close_queue(int uid, mailbox_queue_t *q) {
+  user_t *reader = getUser(uid);
+  mailbox_queue_t **at;
+  delivery_t *d, *next;
+
+  if (--q->handles > 0) {
+    return;
+  }
+  for (at = &reader->queues; *at != q; at = &(*at)->next) {
   }
-  // Look for messages in mailboxes
+  *at = q->next;
+  for (d = q->head->queue_next; d != q->head; d = next) {
+    next = d->queue_next;
+    d->queue_prev = NULL;
+    d->queue_next = NULL;
+  }
+  pool_free(&delivery_pool, q->head);
+  free(q);
+}
 
-  mailbox_t *mailbox = mailbox_collection->head->next;
+/* Take @p mode away from a handle, giving back the slot it claimed or took
+ * under that mode and unmapping the arena from the holder; a handle left
+ * with no mode is freed.
+ */
+static void revoke_handle(mailbox_handle_t *h, int mode) {
+  mode &= h->mode;
+  if ((mode & OPEN_SEND) && h->claimed != -1) {
+    release_payload_slot(h->mailbox, h->claimed);
+    h->claimed = -1;
+  }
+  if ((mode & OPEN_RECEIVE) && h->taken != NULL) {
+    // Clears h->taken
+    finish_delivery(h->taken);
+  }
+  if ((mode & OPEN_RECEIVE) && h->queue != NULL) {
+    close_queue(h->uid, h->queue);
+    h->queue = NULL;
+  }
+  h->mode &= ~mode;
+  if (mode != 0 && h->mapping != NULL) {
+    vm_unmap(h->endpoint, h->mapping);
+    h->mapping = NULL;
+  }
+  if (h->mode == 0) {
+    h->mailbox = NULL;
+  }
+}
 
-  // int found = 0;
+/* Take @p mode away from the handles on @p mb (every mailbox if NULL) held
+ * for @p uid (every user if -1); with OPEN_RECEIVE, the views and leases
+ * held for it go as well.
+ */
+static void invalidate_handles(mailbox_t *mb, int uid, int mode) {
+  int i;
 
-  // int recipient = m_in.m1_i3;
+  if (mode & OPEN_RECEIVE) {
+    revoke_views(mb, uid);
+  }
 
-  do {
+  for (i = 0; i < MAX_HANDLES; i++) {
+    mailbox_handle_t *h = &handles[i];
 
-    // Permission to read?
-    int in_permission_list = 0;
+    if (h->mailbox != NULL && (mb == NULL || h->mailbox == mb) &&
+        (uid == -1 || h->uid == uid)) {
+      revoke_handle(h, mode);
+    }
+  }
+}
 
-    uid_node_t *uid_p = mailbox->receive_access;
+/// Take a free handle on @p mb for the caller, or NULL if none is left.
+static mailbox_handle_t *new_handle(mailbox_t *mb, int uid, int mode) {
+  mailbox_handle_t *h;
 
-    uid_p = uid_p->next;
+  for (h = handles; h < handles + MAX_HANDLES && h->mailbox != NULL; h++) {
+  }
+  if (h == handles + MAX_HANDLES) {
+    printf("Error: no free mailbox handles\n");
+    return NULL;
+  }
 
-    while ((uid_p->uid != -1) && !in_permission_list) {
+  h->mailbox = mb;
+  h->endpoint = who_e;
+  h->uid = uid;
+  h->mode = mode;
+  h->generation = (h->generation + 1) % HANDLE_GENERATIONS;
+  h->claimed = -1;
+  h->taken = NULL;
+  h->queue = NULL;
+  h->mapping = NULL;
+  vm_watch_exit(who_e);
+  return h;
+}
 
-      if (recipient == uid_p->uid) {
-        in_permission_list = 1;
-      } else {
-        uid_p = uid_p->next;
-      }
-    }
+/// The value a handle is known by in the caller.
+static int handle_value(mailbox_handle_t *h) {
+  return (h - handles) + MAX_HANDLES * h->generation;
+}
 
-    int permission =
-        ((recipient == 0) ||
-         ((mailbox->mailbox_type == SECURE) && in_permission_list) ||
-         ((mailbox->mailbox_type == PUBLIC) && !in_permission_list))
-            ? 1
-            : 0;
-
-    if (mailbox->number_of_messages > 0 && permission) {
-      int i = 0;
-      message_t *message_ptr = mailbox->head->next;
-      // Iterate over existing messages
-      while (i < mailbox->number_of_messages) {
-        if (message_ptr->recipients == NULL) {
-          // initialize recipients list
-          uid_node_t *head = malloc(sizeof(uid_node_t));
-          head->uid = -1;
-          head->next = head;
-          head->prev = head;
-          message_ptr->recipients = head;
-        }
-        printf("Mailbox: Checking message number %d\n", i);
-        int already_read = 0;
-        uid_node_t *recipient_p = message_ptr->recipients->next;
-        // Iterate over messages assigned recipients
-        while ((!already_read) && (recipient_p->uid != -1)) {
-          printf("Mailbox:Checking uid %d\n", recipient_p->uid);
-          // If the message has not beer read yet bey current recipient, just
-          // consume it
-          if (recipient_p->uid == recipient) {
-            already_read = 1;
-          }
-          // Otherwise increment recipient's pointer
-          else {
-            recipient_p = recipient_p->next;
-          }
-        }
-        if (!already_read) {
-
-          printf("Mailbox: uid %d success\n", recipient_p->uid);
-
-          int messageBytes = (strlen(message_ptr->message) + 1) * sizeof(char);
-          // Copy the content of the message
-
-          sys_datacopy(SELF, (vir_bytes)message_ptr->message, who_e,
-                       (vir_bytes)m_in.m1_p1, messageBytes);
-
-          // Add recipient (received message notification)
-
-          uid_node_t *new_recipient = malloc(sizeof(uid_node_t));
-          new_recipient->uid = recipient;
-
-          new_recipient->next = message_ptr->recipients;
-          new_recipient->prev = message_ptr->recipients->prev;
-
-          message_ptr->recipients->prev->next = new_recipient;
-          message_ptr->recipients->prev = new_recipient;
-
-          return OK;
-        }
-        // Increment message pointer and counter
-        message_ptr = message_ptr->next;
-        i++;
-      }
-    }
-    mailbox = mailbox->next;
-  } while (strcmp("HEAD", mailbox->mailbox_name));
-  //} while (!found &&
-  //strcmp(mailbox_collection->head->mailbox_name,mailbox->mailbox_name));
-  // In case of not find a message for the recipient return error
+/// The caller's live handle @p handle if it allows @p mode, or NULL.
+static mailbox_handle_t *lookup_handle(int handle, int mode) {
+  mailbox_handle_t *h;
 
-  return ERROR;
+  if (handle < 0) {
+    return NULL;
+  }
+  h = &handles[handle % MAX_HANDLES];
+  if (h->mailbox == NULL || h->generation != handle / MAX_HANDLES ||
+      h->endpoint != who_e || (h->mode & mode) != mode) {
+    printf("Error: invalid or stale mailbox handle %d\n", handle);
+    return NULL;
+  }
+  return h;
 }
 
-/// Delete a message with a specific subject from a mailbox.
-int do_delete_message() {
+/* Open a mailbox for sending and/or receiving
+ * Looks the mailbox up and checks the caller's access for every mode asked
+ * for, once. Returns the handle, or ERROR.
+ */
+/// Open a handle on a mailbox.
+int do_open_mailbox() {
+  char *mailboxName;
   int caller_uid = m_in.m1_i1;
   int mailboxNameLen = m_in.m1_i2;
-  int subjectLen = m_in.m1_i3;
+  int mode = m_in.m1_i3;
 
-  char *mailboxName;
-  char *subject;
-
-  int mailboxNameBytes = mailboxNameLen * sizeof(char);
-  mailboxName = malloc(mailboxNameBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)mailboxName,
-               mailboxNameBytes);
-
-  int subjectBytes = subjectLen * sizeof(char);
-  subject = malloc(subjectBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p2, SELF, (vir_bytes)subject,
-               subjectBytes);
-
-  // find mailbox
-  mailbox_t *mailbox = mailbox_collection->head->next;
+  if (mode == 0 || (mode & ~(OPEN_SEND | OPEN_RECEIVE)) != 0) {
+    printf("Error: invalid open mode %d\n", mode);
+    return ERROR;
+  }
 
-  int found = 0;
-  while (strcmp(mailbox->mailbox_name, "HEAD") != 0 && !found) {
-    if (strcmp(mailbox->mailbox_name, mailboxName) == 0) {
-      found = 1;
-    } else {
-      mailbox = mailbox->next;
-    }
+  scratch_reset();
+  mailboxName =
+      scratch_copy_in(m_in.m1_p1, mailboxNameLen, MAX_MAILBOX_NAME_LEN);
+  if (mailboxName == NULL) {
+    printf("Error: invalid mailbox name\n");
+    return ERROR;
   }
 
-  if (!found) {
+  mailbox_t *mailbox = find_mailbox(mailboxName);
+
+  if (mailbox == NULL) {
     printf("Error: not found mailbox with given name: %s\n", mailboxName);
     return ERROR;
   }
 
-  // check owner
-  int privileges = get_privileges_for_user(caller_uid);
-  if ((privileges & 0b0100) == 0b0100) {
-    printf("Error: user with uid %d does not have remove_message privilege for "
-           "mailbox %s\n",
-           caller_uid, mailbox->mailbox_name);
+  if ((mode & OPEN_SEND) && !may_send(mailbox, caller_uid)) {
+    printf("The user is not allowed to write in the specified mailbox\n");
+    return ERROR;
+  }
+  if ((mode & OPEN_RECEIVE) && !may_receive(mailbox, caller_uid)) {
+    printf("The user is not allowed to read from the specified mailbox\n");
     return ERROR;
   }
 
-  // Find message by subject and remove
+  mailbox_handle_t *h = new_handle(mailbox, caller_uid, mode);
 
-  if (mailbox->number_of_messages == 0) {
-    printf("Error: mailbox %s is empty\n", mailboxName);
+  if (h == NULL) {
     return ERROR;
   }
-
-  int i = 0;
-  message_t *message_ptr = mailbox->head->next;
-  while (i < mailbox->number_of_messages) {
-    if (!strcmp(message_ptr->subject, subject)) {
-      message_ptr->prev->next = message_ptr->next;
-      message_ptr->next->prev = message_ptr->prev;
-      free(message_ptr);
-      printf("+Mailbox: Message with subject %s has been deleted\n", subject);
-      mailbox->number_of_messages--;
-      return OK;
-    }
-    message_ptr = message_ptr->next;
-    i++;
+  if ((mode & OPEN_RECEIVE) &&
+      (h->queue = open_queue(caller_uid, mailbox)) == NULL) {
+    h->mailbox = NULL;
+    return ERROR;
   }
-  printf("Error: message with subject %s not found in mailbox %s\n", subject,
-         mailboxName);
-  return ERROR;
+  return handle_value(h);
 }
 
-/// Grant sender privileges for a mailbox to a user.
-int do_add_sender() {
-  char *mailboxName;
-  int caller_uid = m_in.m1_i1;
-  int uid = m_in.m1_i2;
-  int mailboxNameLen = m_in.m1_i3;
+/// Give a mailbox handle back.
+int do_close_mailbox() {
+  mailbox_handle_t *h = lookup_handle(m_in.m1_i3, 0);
 
-  int mailboxNameBytes = mailboxNameLen * sizeof(char);
-  mailboxName = malloc(mailboxNameBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)mailboxName,
-               mailboxNameBytes);
+  if (h == NULL) {
+    return ERROR;
+  }
+  revoke_handle(h, h->mode);
+  return OK;
+}
 
-  // find mailbox
-  mailbox_t *mailbox = mailbox_collection->head->next;
+/* Deposit a message through a handle opened with OPEN_SEND
+ * Like do_add_to_mailbox(), without the mailbox name: no name copy, lookup
+ * or access check, only the check for room.
+ */
+/// Deposit a message into the mailbox behind a handle.
+int do_add_to_handle() {
+  int messageLen = m_in.m1_i1;
+  int subjectLen = m_in.m1_i2;
+  mailbox_handle_t *h = lookup_handle(m_in.m1_i3, OPEN_SEND);
 
-  int found = 0;
-  while (strcmp(mailbox->mailbox_name, "HEAD") != 0 && !found) {
-    if (strcmp(mailbox->mailbox_name, mailboxName) == 0) {
-      found = 1;
-    } else {
-      mailbox = mailbox->next;
-    }
+  if (h == NULL) {
+    return ERROR;
   }
 
-  if (!found) {
-    printf("Mailbox: mailbox %s does not exist!\n", mailboxName);
+  if (messageLen < 1 || messageLen > MAX_LARGE_MESSAGE_LEN) {
+    printf("Error: Length of the message > %d\n", MAX_LARGE_MESSAGE_LEN);
     return ERROR;
   }
 
-  // Check privileges
-  int privileges = get_privileges_for_user(caller_uid);
-  if ((privileges & 0b0010) == 0b0010) {
-    printf("Error: user with uid %d does not have add_sender privilege for "
-           "mailbox %s\n",
-           caller_uid, mailbox->mailbox_name);
+  if (subjectLen < 1 || subjectLen > MAX_SUBJECT_LEN) {
+    printf("Error: Length of the subject > %d\n", MAX_SUBJECT_LEN);
     return ERROR;
   }
 
-  // Find the user in senders list
-  int in_permission_list = 0;
+  if (has_room(h->mailbox) != OK) {
+    return ERROR;
+  }
 
-  uid_node_t *uid_p = mailbox->send_access->next;
+  return copy_in_message(h->mailbox, who_e, (vir_bytes)m_in.m1_p1,
+                         (vir_bytes)m_in.m1_p2, messageLen, subjectLen);
+}
+
+/* The oldest delivery queued for a receive handle's user from its mailbox.
+ * From a public mailbox, the user reads on in the public log until one
+ * turns up.
+ */
+static delivery_t *next_delivery(mailbox_handle_t *h) {
+  mailbox_queue_t *q = h->queue;
+  user_t *reader;
 
-  while ((uid_p->uid != -1) && !in_permission_list) {
-    if (uid == uid_p->uid) {
-      in_permission_list = 1;
+  if (q == NULL) {
+    return NULL;
+  }
+  if (q->head->queue_next == q->head && h->mailbox->mailbox_type == PUBLIC &&
+      (reader = getUser(h->uid)) != NULL) {
+    while (q->head->queue_next == q->head &&
+           pull_public(reader, reader->pending) != NULL) {
     }
-    uid_p = uid_p->next;
   }
+  return q->head->queue_next != q->head ? q->head->queue_next : NULL;
+}
 
-  // Return error if the users is already in the list
-  if (in_permission_list) {
-    printf("Error: User with uid %d is already in the senders list.\n", uid);
+/* Retrieve through a handle opened with OPEN_RECEIVE
+ * Hands out the oldest message queued for the handle's user from that
+ * mailbox, passing over those from other mailboxes. Never waits.
+ */
+/// Fetch a message from the mailbox behind a handle.
+int do_get_from_handle() {
+  int bufferSize = m_in.m1_i1;
+  mailbox_handle_t *h = lookup_handle(m_in.m1_i3, OPEN_RECEIVE);
+  delivery_t *d;
+
+  if (h == NULL) {
     return ERROR;
   }
 
-  // Add the user to the list
+  if ((d = next_delivery(h)) == NULL) {
+    return ERROR;
+  }
 
-  uid_node_t *new_user = malloc(sizeof(uid_node_t));
-  new_user->uid = uid;
+  if (body_length(d->message) <= bufferSize && hand_out_inline(d) == OK) {
+    return OK;
+  }
+  return hand_out(d, who_e, (vir_bytes)m_in.m1_p1, bufferSize);
+}
 
-  new_user->next = mailbox->send_access;
-  new_user->prev = mailbox->send_access->prev;
+/* Shared mailboxes */
 
-  mailbox->send_access->prev->next = new_user;
-  mailbox->send_access->prev = new_user;
+/// The caller's handle @p handle on a shared mailbox if it allows @p mode.
+static mailbox_handle_t *lookup_ring(int handle, int mode) {
+  mailbox_handle_t *h = lookup_handle(handle, mode);
 
-  printf("Added user with uid %d to the senders list of mailbox %s\n", uid,
-         mailbox->mailbox_name);
-  return OK;
+  if (h != NULL && !h->mailbox->shared) {
+    printf("Error: mailbox %s is not shared\n", h->mailbox->mailbox_name);
+    return NULL;
+  }
+  return h;
 }
 
-/// Grant receiver privileges for a mailbox to a user.
-int do_add_receiver() {
-  char *mailboxName;
+/* Map the payload arena of a shared mailbox into the caller
+ * Writable through a handle opened with OPEN_SEND, read-only otherwise.
+ * The reply carries the address in m1_p1, the number of slots in m1_i1 and
+ * the room for a body in each in m1_i2.
+ * A handle maps the arena once; mapping it again returns the same address.
+ * The mapping goes when the handle is closed or loses any of its access,
+ * and with the mailbox.
+ */
+/// Map a shared mailbox's slots into the caller.
+int do_ring_map() {
+  mailbox_handle_t *h = lookup_ring(m_in.m1_i3, 0);
+  void *addr;
 
-  int caller_uid = m_in.m1_i1;
-  int uid = m_in.m1_i2;
-  int mailboxNameLen = m_in.m1_i3;
+  if (h == NULL) {
+    return ERROR;
+  }
+  if (h->mapping != NULL) {
+    m_out.m1_p1 = h->mapping;
+    m_out.m1_i1 = h->mailbox->capacity;
+    m_out.m1_i2 = h->mailbox->body_size;
+    return OK;
+  }
 
-  int mailboxNameBytes = mailboxNameLen * sizeof(char);
+  if (h->mailbox->payload == NULL && alloc_payload(h->mailbox) != OK) {
+    printf("Error: out of memory mapping mailbox %s\n",
+           h->mailbox->mailbox_name);
+    return ERROR;
+  }
 
-  mailboxName = malloc(mailboxNameBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)mailboxName,
-               mailboxNameBytes);
+  // Wherever VM finds room in the caller
+  if (h->mode & OPEN_SEND) {
+    addr = vm_remap(who_e, sef_self(), NULL, h->mailbox->payload,
+                    arena_bytes(h->mailbox));
+  } else {
+    addr = vm_remap_ro(who_e, sef_self(), NULL, h->mailbox->payload,
+                       arena_bytes(h->mailbox));
+  }
+  if (addr == MAP_FAILED) {
+    printf("Error: unable to map mailbox %s\n", h->mailbox->mailbox_name);
+    return ERROR;
+  }
 
-  // find mailbox
-  mailbox_t *mailbox = mailbox_collection->head->next;
+  h->mapping = addr;
+  m_out.m1_p1 = addr;
+  m_out.m1_i1 = h->mailbox->capacity;
+  m_out.m1_i2 = h->mailbox->body_size;
+  return OK;
+}
 
-  int found = 0;
-  while (strcmp(mailbox->mailbox_name, "HEAD") != 0 && !found) {
-    if (strcmp(mailbox->mailbox_name, mailboxName) == 0) {
-      found = 1;
-    } else {
-      mailbox = mailbox->next;
-    }
-  }
+/* Claim a free slot of a shared mailbox for the sender to fill in
+ * Returns the slot, the one already claimed through the handle if any.
+ */
+/// Claim a slot of a shared mailbox.
+int do_ring_claim() {
+  mailbox_handle_t *h = lookup_ring(m_in.m1_i3, OPEN_SEND);
+  int slot;
 
-  if (!found) {
-    printf("Error: not found mailbox with given name: %s\n", mailboxName);
+  if (h == NULL) {
     return ERROR;
   }
+  if (h->claimed != -1) {
+    return h->claimed;
+  }
 
-  int privileges = get_privileges_for_user(caller_uid);
-  if ((privileges & 0b0001) == 0b0001) {
-    printf("Error: user with uid %d does not have add_receiver privilege for "
-           "mailbox %s\n",
-           caller_uid, mailbox->mailbox_name);
+  if (has_room(h->mailbox) != OK ||
+      (slot = take_payload_slot(h->mailbox)) == -1) {
+    printf("Error: no free slot in mailbox %s\n", h->mailbox->mailbox_name);
     return ERROR;
   }
+  h->claimed = slot;
+  return slot;
+}
 
-  // Find the user in receivers list
-  int in_permission_list = 0;
-
-  uid_node_t *uid_p = mailbox->receive_access->next;
+/* Deposit the slot m1_i1 claimed through the handle and filled in place
+ * The slot is queued for the mailbox's readers like a send_message().
+ */
+/// Post a filled slot of a shared mailbox.
+int do_ring_post() {
+  mailbox_handle_t *h = lookup_ring(m_in.m1_i3, OPEN_SEND);
+  int slot = m_in.m1_i1;
 
-  while ((uid_p->uid != -1) && !in_permission_list) {
-    if (uid == uid_p->uid) {
-      in_permission_list = 1;
-    }
-    uid_p = uid_p->next;
+  if (h == NULL) {
+    return ERROR;
+  }
+  if (h->claimed == -1 || slot != h->claimed) {
+    printf("Error: slot %d was not claimed\n", slot);
+    return ERROR;
   }
 
-  // Return error if the users is already in the list
-  if (in_permission_list) {
-    printf("Error: User with uid %d is already in the senders list.\n", uid);
+  message_t *msg = pool_alloc(&message_pool);
+  if (msg == NULL) {
+    printf("Error: out of memory adding message to mailbox %s\n",
+           h->mailbox->mailbox_name);
     return ERROR;
   }
 
-  // Add the user to the list
+  init_message(msg, h->mailbox, slot);
+  msg->message[h->mailbox->body_size - 1] = '\0';
+  msg->subject[MAX_SUBJECT_LEN - 1] = '\0';
+  h->claimed = -1;
 
-  uid_node_t *new_user = malloc(sizeof(uid_node_t));
-  new_user->uid = uid;
+  return post_message(h->mailbox, msg);
+}
 
-  new_user->next = mailbox->receive_access;
-  new_user->prev = mailbox->receive_access->prev;
+/// Take @p d off its reader's queue for @p h; its message stays until then.
+static void take_delivery(mailbox_handle_t *h, delivery_t *d) {
+  unqueue_delivery(d);
+  d->handle = h - handles;
+  d->message->held++;
+  h->taken = d;
+}
 
-  mailbox->receive_access->prev->next = new_user;
-  mailbox->receive_access->prev = new_user;
+/* Take the caller's oldest message queued in a shared mailbox
+ * Returns its slot, which stays put until the reader releases it or takes
+ * the next; the slot taken before through the handle is released.
+ */
+/// Take the next slot to read from a shared mailbox.
+int do_ring_take() {
+  mailbox_handle_t *h = lookup_ring(m_in.m1_i3, OPEN_RECEIVE);
+  delivery_t *d;
 
-  printf("Added user with uid %d to the receivers list of mailbox %s\n", uid,
-         mailbox->mailbox_name);
-  return OK;
+  if (h == NULL) {
+    return ERROR;
+  }
+  if (h->taken != NULL) {
+    finish_delivery(h->taken);
+  }
+
+  if ((d = next_delivery(h)) == NULL) {
+    return ERROR;
+  }
+
+  take_delivery(h, d);
+  return d->message->slot;
 }
 
-/// Revoke sender privileges from a user.
-int do_remove_sender() {
-  char *mailboxName;
+/// Release the slot m1_i1 taken from a shared mailbox.
+int do_ring_release() {
+  mailbox_handle_t *h = lookup_ring(m_in.m1_i3, OPEN_RECEIVE);
 
-  int caller_uid = m_in.m1_i1;
-  int uid = m_in.m1_i2;
-  int mailboxNameLen = m_in.m1_i3;
+  if (h == NULL) {
+    return ERROR;
+  }
+  if (h->taken == NULL || h->taken->message->slot != m_in.m1_i1) {
+    printf("Error: slot %d was not taken\n", m_in.m1_i1);
+    return ERROR;
+  }
+  finish_delivery(h->taken);
+  return OK;
+}
 
-  int mailboxNameBytes = mailboxNameLen * sizeof(char);
-  mailboxName = malloc(mailboxNameBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)mailboxName,
-               mailboxNameBytes);
+/* Mapped receives */
 
-  // find mailbox
-  mailbox_t *mailbox = mailbox_collection->head->next;
+/// The caller's view of @p mb for @p uid, mapping it in on first use.
+static view_t *get_view(mailbox_t *mb, int uid) {
+  view_t *v;
 
-  int found = 0;
-  while (strcmp(mailbox->mailbox_name, "HEAD") != 0 && !found) {
-    if (strcmp(mailbox->mailbox_name, mailboxName) == 0) {
-      found = 1;
-    } else {
-      mailbox = mailbox->next;
+  for (v = mb->views; v != NULL; v = v->next) {
+    if (v->endpoint == who_e && v->uid == uid) {
+      return v;
     }
   }
 
-  if (!found) {
-    printf("Error: not found mailbox with given name: %s\n", mailboxName);
-    return ERROR;
+  if ((v = pool_alloc(&view_pool)) == NULL) {
+    printf("Error: out of memory mapping mailbox %s\n", mb->mailbox_name);
+    return NULL;
   }
-
-  // Check to make sure that the current user is the owner of this mailbox
-  int privileges = get_privileges_for_user(caller_uid);
-  if ((privileges & 0b0010) == 0b0010) {
-    printf("Error: user with uid %d does not have remove_sender privilege for "
-           "mailbox %s\n",
-           caller_uid, mailbox->mailbox_name);
-    return ERROR;
+  v->addr = vm_remap_ro(who_e, sef_self(), NULL, mb->payload, arena_bytes(mb));
+  if (v->addr == MAP_FAILED) {
+    printf("Error: unable to map mailbox %s\n", mb->mailbox_name);
+    pool_free(&view_pool, v);
+    return NULL;
   }
+  v->endpoint = who_e;
+  v->uid = uid;
+  v->next = mb->views;
+  mb->views = v;
+  vm_watch_exit(who_e);
+  return v;
+}
 
-  // Find the user in senders list
+/// Take a free lease, growing the table if none is left; NULL if it is full.
+static lease_t *new_lease() {
+  lease_t *l;
+  int i;
 
-  uid_node_t *uid_p = mailbox->send_access->next;
+  if (free_lease == -1) {
+    int count = number_of_leases ? 2 * number_of_leases : LEASE_TABLE_MIN;
+    lease_t *table;
 
-  while (uid_p->uid != -1) {
-    if (uid == uid_p->uid) {
-      // Remove recipient
-      uid_p->prev->next = uid_p->next;
-      uid_p->next->prev = uid_p->prev;
-      free(uid_p);
-      printf("Removed user with uid %d from the senders list of mailbox %s\n",
-             uid, mailbox->mailbox_name);
-      return OK;
+    if (count > MAX_LEASES ||
+        (table = realloc(leases, count * sizeof(lease_t))) == NULL) {
+      printf("Error: no free leases\n");
+      return NULL;
+    }
+    for (i = count - 1; i >= number_of_leases; i--) {
+      table[i].delivery = NULL;
+      table[i].generation = 0;
+      table[i].next_free = free_lease;
+      free_lease = i;
     }
-    uid_p = uid_p->next;
+    leases = table;
+    number_of_leases = count;
   }
 
-  printf("Error: user uid %d not found in mailbox with given name: %s\n", uid,
-         mailboxName);
-  return ERROR;
+  l = &leases[free_lease];
+  free_lease = l->next_free;
+  l->generation = (l->generation + 1) % LEASE_GENERATIONS;
+  return l;
 }
 
-/// Revoke receiver privileges from a user.
-int do_remove_receiver() {
-  char *mailboxName;
+/// Give a lease's entry back; its delivery is no longer lent out.
+static void end_lease(lease_t *l) {
+  l->delivery->lease = -1;
+  l->delivery = NULL;
+  l->next_free = free_lease;
+  free_lease = l - leases;
+}
 
-  int caller_uid = m_in.m1_i1;
-  int uid = m_in.m1_i2;
-  int mailboxNameLen = m_in.m1_i3;
+/* Unlink the view at @p at from its mailbox and free it, retiring the
+ * messages lent out through it; it is unmapped from its holder if @p unmap
+ * is set.
+ */
+static void drop_view(view_t **at, int unmap) {
+  view_t *v = *at;
+  int i;
 
-  int mailboxNameBytes = mailboxNameLen * sizeof(char);
-  mailboxName = malloc(mailboxNameBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)mailboxName,
-               mailboxNameBytes);
+  for (i = 0; i < number_of_leases; i++) {
+    if (leases[i].delivery != NULL && leases[i].view == v) {
+      // Ends the lease
+      finish_delivery(leases[i].delivery);
+    }
+  }
+  *at = v->next;
+  if (unmap) {
+    vm_unmap(v->endpoint, v->addr);
+  }
+  pool_free(&view_pool, v);
+}
 
-  // find mailbox
-  mailbox_t *mailbox = mailbox_collection->head->next;
+/* Drop the views of @p mb (every mailbox if NULL) held for @p uid (every
+ * user if -1), retiring the messages lent out through them.
+ */
+static void revoke_views(mailbox_t *mb, int uid) {
+  view_t **at;
+
+  if (mb == NULL) {
+    if (!mailbox_collection) {
+      return;
+    }
+    for (mb = mailbox_collection->head->next; mb != mailbox_collection->head;
+         mb = mb->next) {
+      revoke_views(mb, uid);
+    }
+    return;
+  }
 
-  int found = 0;
-  while (strcmp(mailbox->mailbox_name, "HEAD") != 0 && !found) {
-    if (strcmp(mailbox->mailbox_name, mailboxName) == 0) {
-      found = 1;
+  for (at = &mb->views; *at != NULL;) {
+    if (uid == -1 || (*at)->uid == uid) {
+      drop_view(at, 1);
     } else {
-      mailbox = mailbox->next;
+      at = &(*at)->next;
     }
   }
+}
 
-  if (!found) {
-    printf("Error: not found mailbox with given name: %s\n", mailboxName);
+/* Lend a queued message out in place for RECEIVE_MAPPED: take it off its
+ * reader's queue under a new lease and point the caller at it through its
+ * view of the shared mailbox, mapped in on the first lend from there.
+ * Returns ERROR, leaving the message queued, if the mailbox is not shared
+ * or the view or lease cannot be had.
+ */
+static int lend_mapped(delivery_t *d) {
+  view_t *v;
+  lease_t *l;
+
+  if (!d->mailbox->shared || (v = get_view(d->mailbox, d->uid)) == NULL ||
+      (l = new_lease()) == NULL) {
     return ERROR;
   }
 
-  // Find the user in receivers list
+  unqueue_delivery(d);
+  l->delivery = d;
+  l->view = v;
+  d->lease = l - leases;
+  d->message->held++;
+  m_out.m1_p1 = (char *)v->addr + d->message->slot * slot_size(d->mailbox);
+  m_out.m1_i1 = d->lease + MAX_LEASES * l->generation;
+  return OK;
+}
 
-  int privileges = get_privileges_for_user(caller_uid);
-  if ((privileges & 0b0001) == 0b0001) {
-    printf("Error: user with uid %d does not have remove_receiver privilege "
-           "for mailbox %s\n",
-           caller_uid, mailbox->mailbox_name);
+/* End the lease m1_i3 on a message lent out by a mapped receive
+ * The message is retired like one copied out; the view stays for the next.
+ */
+/// Release a message received in place.
+int do_release_message() {
+  int lease = m_in.m1_i3;
+  lease_t *l;
+
+  if (lease < 0 || lease % MAX_LEASES >= number_of_leases) {
+    printf("Error: invalid lease %d\n", lease);
     return ERROR;
   }
+  l = &leases[lease % MAX_LEASES];
+  if (l->delivery == NULL || l->generation != lease / MAX_LEASES ||
+      l->view->endpoint != who_e) {
+    printf("Error: invalid or stale lease %d\n", lease);
+    return ERROR;
+  }
+  finish_delivery(l->delivery);
+  return OK;
+}
 
-  uid_node_t *uid_p = mailbox->receive_access->next;
+/* Process exits */
 
-  while (uid_p->uid != -1) {
-    if (uid == uid_p->uid) {
-      // Remove recipient
-      uid_p->prev->next = uid_p->next;
-      uid_p->next->prev = uid_p->prev;
-      free(uid_p);
-      printf("Removed user with uid %d from the receivers list of mailbox %s\n",
-             uid, mailbox->mailbox_name);
-      return OK;
+/* Forget what a process that has exited left with the service: its handles
+ * with the slots they claimed or took, its views with the messages lent
+ * through them, and the retrieve or deposit it was blocked in. Nothing is
+ * replied to it or unmapped from it any more.
+ */
+static void forget_endpoint(endpoint_t endpoint) {
+  mailbox_t *mb;
+  view_t **at;
+  int i;
+
+  for (i = 0; i < MAX_HANDLES; i++) {
+    mailbox_handle_t *h = &handles[i];
+
+    if (h->mailbox != NULL && h->endpoint == endpoint) {
+      h->mapping = NULL;
+      revoke_handle(h, h->mode);
     }
-    uid_p = uid_p->next;
   }
 
-  printf("Error: user with uid %d not found in mailbox with given name: %s\n",
-         uid, mailboxName);
-  return ERROR;
+  for (i = 0; users && i < users->number_of_slots; i++) {
+    user_t *user = &users->slots[i];
+    waiter_t *w, *next;
+
+    for (w = user->uid != -1 ? user->waiting : NULL; w != NULL; w = next) {
+      next = w->next != user->waiting ? w->next : NULL;
+      if (w->endpoint == endpoint) {
+        unqueue_waiter(user, w);
+        pool_free(&waiter_pool, w);
+      }
+    }
+  }
+
+  if (!mailbox_collection) {
+    return;
+  }
+  for (mb = mailbox_collection->head->next; mb != mailbox_collection->head;
+       mb = mb->next) {
+    sender_t *s, *next;
+
+    for (s = mb->senders; s != NULL; s = next) {
+      next = s->next != mb->senders ? s->next : NULL;
+      if (s->endpoint == endpoint) {
+        unqueue_sender(mb, s);
+        pool_free(&sender_pool, s);
+      }
+    }
+    for (at = &mb->views; *at != NULL;) {
+      if ((*at)->endpoint == endpoint) {
+        drop_view(at, 0);
+      } else {
+        at = &(*at)->next;
+      }
+    }
+  }
+}
+
+/* Clean up after the processes VM reports to have exited
+ * The service asks VM to watch a process once it holds a handle or a view
+ * or is blocked in a call; VM then notifies it of the exit, and the exited
+ * endpoints are queried one at a time.
+ */
+void process_exits() {
+  endpoint_t endpoint;
+  int r;
+
+  while ((r = vm_query_exit(&endpoint)) >= 0) {
+    printf("Mailbox: process %d exited\n", endpoint);
+    forget_endpoint(endpoint);
+    if (r == 0) {
+      break;
+    }
+  }
+  if (r < 0) {
+    printf("Mailbox: query exit error %d\n", r);
+  }
 }
 
 /* Debugging
@@ -1080,18 +3443,16 @@ int print_all_messages() {
   for (i = 1; i <= mailbox->number_of_messages; i++) {
     message_ptr = message_ptr->next;
 
-    uid_node_t *uids = message_ptr->recipients;
+    delivery_t *pending = message_ptr->deliveries;
     char *message = message_ptr->message;
 
     printf("**Message number %d\n", i);
-    printf("**Message content %s\n", message);
-    printf("**Recipients: ");
-
-    uids = uids->next;
+    printf("**Message content %.*s\n", MAX_MESSAGE_LEN - 1, message);
+    printf("**Pending recipients: ");
 
-    while (uids->uid != -1) {
-      printf(" %d, ", uids->uid);
-      uids = uids->next;
+    while (pending != NULL) {
+      printf(" %d, ", pending->uid);
+      pending = pending->message_next;
     }
     printf("\n");
   }
@@ -1,33 +1,358 @@
-#include <minix/syslib.h>
-#include "glo.h"
+#include "inc.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <lib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
-#define MAX_MESSAGE_COUNT 16
 #define OK 0
 #define ERROR -1
 #define MAX_MESSAGE_LEN 1024
+#ifndef MAX_LARGE_MESSAGE_LEN
+#define MAX_LARGE_MESSAGE_LEN (64 * 1024)
+#endif
 #define MAX_SUBJECT_LEN 140
+#define MAX_MAILBOX_NAME_LEN 64
 #define SECURE 0
 #define PUBLIC 1
+#define SHARED_MAILBOX 2
 
-/* UID LinkedList
- * uid: UID of a user
- * privileges: bitstring of privileges
- * prev: previous recipient process
- * next: following recipient process
+/* Mailbox capacity
+ * The most messages a mailbox holds, given when it is created (0 for
+ * DEFAULT_MAILBOX_CAPACITY). Every mailbox reserves that many payload slots
+ * out of MAILBOX_SLOT_BUDGET on creation, which bounds the memory all
+ * arenas together can take; a mailbox that does not fit is not created.
+ * A deposit into a full mailbox fails, or with MAILBOX_DEPOSIT_WAIT waits
+ * until a message is reclaimed.
+ */
+#define DEFAULT_MAILBOX_CAPACITY 16
+#ifndef MAILBOX_SLOT_BUDGET
+#define MAILBOX_SLOT_BUDGET 65536
+#endif
+
+/* Retrieve modes (m1_i3 of MAILBOX_RETRIEVE). RECEIVE_WAIT waits at most
+ * m1_ull1 milliseconds, or until a message arrives if that is 0.
+ * RECEIVE_MAPPED lends a message in a shared mailbox out in place instead
+ * of copying it: the reply carries its address in a read-only view of the
+ * arena (m1_p1) and the lease on it (m1_i1), -1 if the message was copied
+ * after all. MAILBOX_RELEASE ends the lease. */
+#define RECEIVE_NOWAIT 0
+#define RECEIVE_WAIT 1
+#define RECEIVE_MAPPED 2
+
+/* add_mailbox request
+ * The header, then the mailbox name (name_bytes with its terminator, padded
+ * to a multiple of sizeof(int)), then number_of_senders and
+ * number_of_receivers UIDs. The whole request is m1_i2 bytes at m1_p1.
+ * capacity is that of the mailbox, 0 for the default. body_size is the room
+ * for a body in each slot of a shared mailbox, terminator included, from
+ * MAX_MESSAGE_LEN (0 for that) up to MAX_LARGE_MESSAGE_LEN; 0 otherwise.
+ */
+typedef struct {
+    int mailbox_type;
+    int capacity;
+    int body_size;
+    int name_bytes;
+    int number_of_senders;
+    int number_of_receivers;
+} mailbox_request_t;
+
+#define MAX_ACL_UIDS 65536
+#define MAILBOX_REQUEST_PAD(n)                                                 \
+  (((n) + sizeof(int) - 1) / sizeof(int) * sizeof(int))
+
+/* Batches
+ * MAILBOX_RETRIEVE_BATCH fills the caller's buffer with descriptors for up to
+ * m1_i3 messages followed by the strings they refer to, in one copy.
+ * MAILBOX_DEPOSIT_BATCH takes the same layout from the caller. Offsets count
+ * from the start of the buffer; length includes the terminator of the body.
+ */
+
+#define MAX_BATCH_COUNT 64
+#define MAX_BATCH_BYTES (64 * 1024)
+
+typedef struct {
+    int mailbox;
+    int subject;
+    int body;
+    int length;
+} mail_desc_t;
+
+/* Inline mail
+ * Mail small enough travels in the request or reply message itself and
+ * needs no sys_datacopy at all. A MAILBOX_DEPOSIT_INLINE request carries
+ * mail_inline_t: the sender's UID, the lengths of the mailbox name, subject
+ * and body without terminators, and the three strings back to back. A
+ * MAILBOX_RETRIEVE reply carries mail_inline_reply_t: the body and its
+ * length with terminator, or a length of 0 if it was copied out instead.
+ */
+
+#define INLINE_PAYLOAD 56
+#define INLINE_TEXT (INLINE_PAYLOAD - 2 * (int)sizeof(int))
+
+typedef struct {
+    int uid;
+    unsigned char name_len;
+    unsigned char subject_len;
+    unsigned char body_len;
+    unsigned char unused;
+    char text[INLINE_TEXT];
+} mail_inline_t;
+
+typedef struct {
+    int length;
+    char body[INLINE_PAYLOAD - sizeof(int)];
+} mail_inline_reply_t;
+
+/* Slab pool
+ * Fixed-size objects carved out of slabs of objects_per_slab and recycled
+ * through a free list; slabs stay with the pool for the life of the service.
+ * in_use - objects handed out, high_water - the most ever handed out
+ */
+
+typedef struct pool_object {
+    struct pool_object *next;
+} pool_object_t;
+
+typedef struct {
+    const char *name;
+    int object_size;
+    int objects_per_slab;
+    pool_object_t *free_list;
+    int number_of_slabs;
+    int in_use;
+    int high_water;
+} pool_t;
+
+#define POOL_INITIALIZER(type, per_slab)                                       \
+  { #type, sizeof(type), (per_slab), NULL, 0, 0, 0 }
+
+/* Payload arena
+ * Each mailbox keeps the bodies and subjects of its messages in one block
+ * of one slot per message of its capacity, allocated on its first deposit.
+ * A slot holds the body, in a field of the mailbox's body_size, followed by
+ * the subject; free slots are chained through free_links starting at
+ * free_slot. Slots are PAYLOAD_SLOT_SIZE bytes but in shared mailboxes
+ * created with a larger body size, and MAILBOX_SLOT_BUDGET counts in that
+ * size.
+ */
+
+#define PAYLOAD_SLOT_SIZE (MAX_MESSAGE_LEN + MAX_SUBJECT_LEN)
+
+/* Shared mailboxes
+ * A mailbox created with SHARED_MAILBOX or'ed into its type keeps its
+ * arena in pages of its own, which MAILBOX_RING_MAP maps into the caller:
+ * writable through a handle opened with OPEN_SEND, read-only otherwise.
+ * Only slot numbers go through the service after that. A sender claims a
+ * free slot (MAILBOX_RING_CLAIM), fills it in place and posts it
+ * (MAILBOX_RING_POST); a reader takes the slot of its oldest message
+ * queued there (MAILBOX_RING_TAKE), reads it in place and releases it
+ * (MAILBOX_RING_RELEASE, or by taking the next). A handle holds at most one
+ * claimed and one taken slot. As senders can write the arena at any time,
+ * the service never reads a string in it past the end of its field. The
+ * mailbox's creator may make room for bodies longer than MAX_MESSAGE_LEN
+ * in every slot, so that large messages are written and read in place too.
+ */
+
+/* Large messages
+ * A body longer than MAX_MESSAGE_LEN, up to MAX_LARGE_MESSAGE_LEN bytes
+ * with its terminator, keeps its first MAX_MESSAGE_LEN bytes in its
+ * payload slot and the rest in a chain of chunks of CHUNK_SIZE bytes. It
+ * is deposited and retrieved in one call like any other; MAILBOX_PROBE
+ * tells a reader the size of its next message beforehand. Shared mailboxes
+ * keep every body whole in its slot instead, and take the ones that fit
+ * there; batches only take bodies of up to MAX_MESSAGE_LEN.
+ */
+
+#define CHUNK_SIZE 1024
+
+typedef struct chunk_struct {
+    struct chunk_struct *next;
+    char data[CHUNK_SIZE];
+} chunk_t;
+
+#define RING_PAGE_SIZE 4096
+#define RING_BYTES(slots, slot_size)                                           \
+  (((slots) * (slot_size) + RING_PAGE_SIZE - 1) / RING_PAGE_SIZE *             \
+   RING_PAGE_SIZE)
+
+/* Mapped receives
+ * RECEIVE_MAPPED lends a message in a shared mailbox out through a view:
+ * the mailbox's arena mapped read-only into the reader on its first lend
+ * from there, and reused by every later one. A view stays until the
+ * mailbox is removed or the reader loses its receive access.
+ * endpoint, uid - the reader
+ * addr - the arena in the reader
+ * next - the mailbox's next view
+ */
+
+typedef struct view_struct {
+    endpoint_t endpoint;
+    int uid;
+    void *addr;
+    struct view_struct *next;
+} view_t;
+
+/* Leases
+ * Each lent message is held by a lease until MAILBOX_RELEASE, in a table of
+ * its own that grows as needed up to MAX_LEASES entries. Like a handle, a
+ * lease is known by its index plus MAX_LEASES times its generation and is
+ * good only for the process it was granted to.
+ * delivery - the delivery lent out, NULL while the entry is free
+ * view - the view the reader was given its address in
+ * next_free - the next free entry while free, -1 ends the chain
+ */
+
+#define LEASE_TABLE_MIN 16
+#define MAX_LEASES 65536
+#define LEASE_GENERATIONS (1 << 14)
+
+typedef struct {
+    struct delivery_struct *delivery;
+    view_t *view;
+    int generation;
+    int next_free;
+} lease_t;
+
+/* Scratch arena
+ * Per-request copies of the strings a caller passes in (mailbox names,
+ * subjects, length strings). Handlers reset it before copying anything, so
+ * it never holds more than one request's worth.
+ */
+
+#define SCRATCH_SIZE 1024
+
+/* Objects preallocated per pool on first use, and added per slab after */
+#define MAILBOX_POOL_SLAB 16
+#define MESSAGE_POOL_SLAB 64
+#define DELIVERY_POOL_SLAB 256
+#define WAITER_POOL_SLAB 16
+#define CHUNK_POOL_SLAB 16
+#define SENDER_POOL_SLAB 16
+#define VIEW_POOL_SLAB 16
+
+/* User registry
+ * Open addressing hash table keyed by UID with the privilege bitstring
+ * stored inline. number_of_slots is a power of two and kept at most 3/4
+ * full; empty slots have uid -1. pending is the sentinel of the user's
+ * queue of messages not yet retrieved, in deposit order; public_seq is how
+ * far the user has read the public log (see public_log_t), whose messages
+ * join the queue only as the user gets to them; waiting is the oldest of
+ * the user's processes blocked in a retrieve, in a circular list, and is
+ * only set while it has nothing to retrieve.
  */
 
-typedef struct uid_node {
-    struct uid_node *prev;
+#define USER_REGISTRY_MIN_SLOTS 64
+
+struct delivery_struct;
+
+/* Blocked retrieve
+ * A process blocked in MAILBOX_RETRIEVE until a message is queued for its
+ * UID.
+ * endpoint - the caller, which gets no reply until then
+ * buffer, buffer_size - where the message is copied in the caller
+ * deadline, heap_index - expiry in clock ticks and position in the timeout
+ *   heap, for calls with a timeout (heap_index -1 otherwise)
+ * prev, next - neighbours among the user's waiters
+ * blocked_prev, blocked_next - neighbours among the oldest waiters of every
+ *   user, while this is the oldest of its user's
+ */
+
+typedef struct waiter_struct {
+    int uid;
+    endpoint_t endpoint;
+    vir_bytes buffer;
+    int buffer_size;
+    clock_t deadline;
+    int heap_index;
+    struct waiter_struct *prev;
+    struct waiter_struct *next;
+    struct waiter_struct *blocked_prev;
+    struct waiter_struct *blocked_next;
+} waiter_t;
+
+/* Blocked deposit
+ * A process blocked in MAILBOX_DEPOSIT_WAIT until its mailbox has room.
+ * Nothing is copied in before then: the body and subject are taken from
+ * the caller once the message is admitted.
+ * endpoint - the caller, which gets no reply until then
+ * body, subject, body_bytes, subject_bytes - the strings in the caller
+ * prev, next - neighbours among the mailbox's blocked senders
+ */
+
+typedef struct sender_struct {
+    int uid;
+    endpoint_t endpoint;
+    vir_bytes body;
+    vir_bytes subject;
+    int body_bytes;
+    int subject_bytes;
+    struct sender_struct *prev;
+    struct sender_struct *next;
+} sender_t;
+
+/* Receive timeouts
+ * Binary min-heap of the waiters with a timeout, keyed by deadline. A single
+ * timer is armed for the earliest; it is not moved when that waiter is
+ * served early, and just finds nothing due when it fires.
+ */
+
+#define TIMEOUT_HEAP_MIN 16
+
+typedef struct {
+    int number_of_waiters;
+    int capacity;
+    waiter_t **heap;
+    minix_timer_t timer;
+} timeout_heap_t;
+
+/* Mailbox queue
+ * A reader's pending deliveries from one mailbox, in the order of its
+ * pending queue, kept while the reader holds receive handles on the mailbox
+ * so that retrieves through them take the oldest one straight away.
+ * head - sentinel of the deliveries, chained through their queue_prev and
+ *   queue_next
+ * handles - receive handles sharing the queue
+ * next - the reader's next mailbox queue
+ */
+
+typedef struct mailbox_queue_struct {
+    struct mailbox_struct *mailbox;
+    struct delivery_struct *head;
+    int handles;
+    struct mailbox_queue_struct *next;
+} mailbox_queue_t;
+
+typedef struct {
     int uid;
     int privileges;
-    struct uid_node *next;
-} uid_node_t;
+    struct delivery_struct *pending;
+    uint64_t public_seq;
+    waiter_t *waiting;
+    mailbox_queue_t *queues;
+} user_t;
+
+typedef struct {
+    int number_of_users;
+    int number_of_slots;
+    user_t *slots;
+} user_registry_t;
+
+/* Access control list
+ * uids - UIDs in ascending order, without duplicates
+ * number_of_uids - entries in use, capacity - entries allocated
+ */
+
+/* Below this many entries a straight scan beats bisection */
+#define ACL_LINEAR_SCAN 32
+
+typedef struct {
+    int number_of_uids;
+    int capacity;
+    int *uids;
+} acl_t;
 
 /* PID LinkedList
  * pid: PID of a recipient process
@@ -41,42 +366,184 @@ typedef struct pid_node {
     struct pid_node *next;
 } pid_node_t;
 
+/* Pending delivery
+ * One per message and reader that has not retrieved it yet, created when
+ * the message is deposited into a secure mailbox, or when the reader gets
+ * to it in the public log.
+ * handle - handle that has taken the delivery off a shared mailbox, or -1
+ * lease - entry of the lease table lending the delivery out, or -1; both
+ *   are -1 while it is in the reader's pending queue
+ * prev, next - neighbours in the reader's pending queue
+ * queue_prev, queue_next - neighbours in the reader's queue for the mailbox,
+ *   if it has one; NULL otherwise
+ * message_prev, message_next - other outstanding deliveries of the message
+ */
+
+typedef struct delivery_struct {
+    int uid;
+    int handle;
+    int lease;
+    struct message_struct *message;
+    struct mailbox_struct *mailbox;
+    struct delivery_struct *prev;
+    struct delivery_struct *next;
+    struct delivery_struct *queue_prev;
+    struct delivery_struct *queue_next;
+    struct delivery_struct *message_prev;
+    struct delivery_struct *message_next;
+} delivery_t;
+
 /* Message LinkedList
- * recipients - recipients of this message
+ * deliveries - readers that have not retrieved this message yet
+ * readers_left - in a secure mailbox, deliveries other than the
+ *   superuser's; the message is reclaimed when the last of them is consumed
+ *   or withdrawn
+ * seq - deposit order across all mailboxes
+ * held - deliveries lent out or taken by a handle, which keep a public
+ *   message from being reclaimed for room
+ * slot - payload slot holding message and subject
  * message - the message value
+ * length, chunks - for a large message, the size of the body with its
+ *   terminator and the chunks past the slot; chunks is NULL otherwise
  * next - pointer to next message
  * prev - pointer to prev message
  */
 
 typedef struct message_struct {
-    uid_node_t *recipients;
+    delivery_t *deliveries;
+    int readers_left;
+    uint64_t seq;
+    int held;
+    int slot;
     char *message;
     char *subject;
+    int length;
+    chunk_t *chunks;
     struct message_struct *prev;
     struct message_struct *next;
 } message_t;
 
 /* Mailbox
- * number_of_messages - current number of messages in the mailbox (limit is 16)
+ * number_of_messages - current number of messages in the mailbox, at most
+ *   capacity
+ * name_len, name_hash - cached length and hash of mailbox_name
+ * shared - set if the arena is mapped into clients (SHARED_MAILBOX)
+ * body_size - room for the body in each slot, MAX_MESSAGE_LEN unless the
+ *   mailbox is shared and was created with more
+ * views - read-only mappings of a shared arena for mapped receives
+ * payload, free_slot - payload arena and its first free slot (-1 if full)
+ * free_links - the free slot after each free slot (-1 ends the chain)
+ * senders - the oldest of the processes blocked for room, in a circular
+ *   list
+ * ready, ready_next - set, and the next one, while on the list of mailboxes
+ *   that gained room with senders blocked on them
  * head - pointer to head of message linked list
+ * hash_next - next mailbox in the same bucket of the name index
  */
 
 typedef struct mailbox_struct {
   int owner;
   int number_of_messages;
+  int capacity;
   int mailbox_type;
   char *mailbox_name;
-  uid_node_t *send_access;
-  uid_node_t *receive_access;
+  int name_len;
+  unsigned int name_hash;
+  acl_t send_access;
+  acl_t receive_access;
+  int shared;
+  int body_size;
+  view_t *views;
+  char *payload;
+  int free_slot;
+  int *free_links;
+  sender_t *senders;
+  int ready;
+  struct mailbox_struct *ready_next;
   message_t *head;
   struct mailbox_struct *prev;
   struct mailbox_struct *next;
+  struct mailbox_struct *hash_next;
 } mailbox_t;
 
+/* Public log
+ * The messages of all public mailboxes, oldest first. A public mailbox may
+ * have any number of readers, so a deposit there queues nothing: it is
+ * appended here, and each reader takes the messages it may receive off the
+ * log in turn, from its public_seq on, as it retrieves. The entry of a
+ * reclaimed message is cleared (message NULL) and squeezed out once half the
+ * entries are.
+ * seq - the message's seq, ascending along the log
+ */
+
+#define PUBLIC_LOG_MIN 64
+
+typedef struct {
+    uint64_t seq;
+    struct message_struct *message;
+    struct mailbox_struct *mailbox;
+} log_entry_t;
+
+typedef struct {
+    int used;
+    int cleared;
+    int capacity;
+    log_entry_t *entries;
+} public_log_t;
+
+/* Mailbox collection
+ * head - sentinel of the list of mailboxes, in creation order
+ * reserved_slots - capacity of all mailboxes, at most MAILBOX_SLOT_BUDGET
+ * buckets - hash index on mailbox name, number_of_buckets is a power of two
+ */
+
+#define MAILBOX_INDEX_MIN_BUCKETS 16
+
 typedef struct {
     int number_of_mailboxes;
+    int reserved_slots;
     mailbox_t *head;
+    int number_of_buckets;
+    mailbox_t **buckets;
 } mailbox_collection_t;
 
+/* Mailbox handles
+ * MAILBOX_OPEN looks a mailbox up and checks the caller's access once; the
+ * handle it returns stands in for both on MAILBOX_DEPOSIT_HANDLE and
+ * MAILBOX_RETRIEVE_HANDLE. A handle is good only for the process that
+ * opened it and goes stale when the mailbox is removed, when the access it
+ * was opened for is revoked or when its user is removed. The value is the
+ * entry's index plus MAX_HANDLES times its generation, so a stale handle is
+ * never taken for a later open of the same entry.
+ * mailbox - NULL while the entry is free
+ * mode - OPEN_SEND and/or OPEN_RECEIVE
+ * claimed - slot claimed on a shared mailbox and not posted yet, or -1
+ * taken - delivery whose slot the reader has taken, or NULL
+ * queue - the user's queue for the mailbox, with OPEN_RECEIVE
+ * mapping - the arena as mapped into the holder by MAILBOX_RING_MAP,
+ *   unmapped when the handle loses any mode; NULL otherwise
+ */
+
+#define OPEN_SEND 1
+#define OPEN_RECEIVE 2
+
+#define MAX_HANDLES 256
+#define HANDLE_GENERATIONS (1 << 20)
+
+typedef struct {
+    mailbox_t *mailbox;
+    endpoint_t endpoint;
+    int uid;
+    int mode;
+    int generation;
+    int claimed;
+    delivery_t *taken;
+    mailbox_queue_t *queue;
+    void *mapping;
+} mailbox_handle_t;
+
 int create_mailbox();
 int init_msg_pid_list(message_t *m);
+mailbox_t *find_mailbox(const char *mailbox_name);
+int print_pool_stats();
+int acl_contains(const acl_t *acl, int uid);
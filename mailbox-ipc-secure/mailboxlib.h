@@ -11,20 +11,129 @@
 #include <string.h>
 #include <pwd.h>
 #include <unistd.h>
+#include <errno.h>
+#include <minix/rs.h>
 
 #define OK 0
 #define ERROR -1
+#define MAX_MESSAGE_LEN 1024
+#ifndef MAX_LARGE_MESSAGE_LEN
+#define MAX_LARGE_MESSAGE_LEN (64 * 1024)
+#endif
+#define MAX_SUBJECT_LEN 140
+#define MAX_MAILBOX_NAME_LEN 64
+#define RECEIVE_NOWAIT 0
+#define RECEIVE_WAIT 1
+#define RECEIVE_MAPPED 2
+#define MAX_BATCH_COUNT 64
+#define MAX_BATCH_BYTES (64 * 1024)
+#define OPEN_SEND 1
+#define OPEN_RECEIVE 2
+#define SHARED_MAILBOX 2
+#define DEFAULT_MAILBOX_CAPACITY 16
+#ifndef MAILBOX_SLOT_BUDGET
+#define MAILBOX_SLOT_BUDGET 65536
+#endif
 
+/* add_mailbox request
+ * The header, then the mailbox name (name_bytes with its terminator, padded
+ * to a multiple of sizeof(int)), then number_of_senders and
+ * number_of_receivers UIDs. The whole request is m1_i2 bytes at m1_p1.
+ * capacity is that of the mailbox, 0 for the default. body_size is the room
+ * for a body in each slot of a shared mailbox, 0 for MAX_MESSAGE_LEN.
+ */
+typedef struct {
+    int mailbox_type;
+    int capacity;
+    int body_size;
+    int name_bytes;
+    int number_of_senders;
+    int number_of_receivers;
+} mailbox_request_t;
+
+#define MAX_ACL_UIDS 65536
+#define MAILBOX_REQUEST_PAD(n)                                                 \
+  (((n) + sizeof(int) - 1) / sizeof(int) * sizeof(int))
+
+/* One message of a batch retrieve. mailbox, subject and body are offsets of
+ * the strings from the start of the batch buffer; length is the size of the
+ * body including its terminator. */
+typedef struct {
+    int mailbox;
+    int subject;
+    int body;
+    int length;
+} mail_desc_t;
+
+/* Mail that fits in the payload of the message itself (see mailbox.h) */
+
+#define INLINE_PAYLOAD 56
+#define INLINE_TEXT (INLINE_PAYLOAD - 2 * (int)sizeof(int))
+
+typedef struct {
+    int uid;
+    unsigned char name_len;
+    unsigned char subject_len;
+    unsigned char body_len;
+    unsigned char unused;
+    char text[INLINE_TEXT];
+} mail_inline_t;
+
+typedef struct {
+    int length;
+    char body[INLINE_PAYLOAD - sizeof(int)];
+} mail_inline_reply_t;
+
+/* Slots of a shared mailbox mapped with ring_map(): each holds the body,
+ * then the subject. The RING_SIZED_ forms address the slots of a mailbox
+ * created with another body size, as reported by ring_map_sized() */
+#define RING_SLOT_SIZE (MAX_MESSAGE_LEN + MAX_SUBJECT_LEN)
+#define RING_SIZED_BODY(ring, slot, body_size)                                 \
+  ((char *)(ring) + (slot) * ((body_size) + MAX_SUBJECT_LEN))
+#define RING_SIZED_SUBJECT(ring, slot, body_size)                              \
+  (RING_SIZED_BODY(ring, slot, body_size) + (body_size))
+#define RING_BODY(ring, slot) RING_SIZED_BODY(ring, slot, MAX_MESSAGE_LEN)
+#define RING_SUBJECT(ring, slot) RING_SIZED_SUBJECT(ring, slot, MAX_MESSAGE_LEN)
+
+/* String at offset off of a batch buffer */
+#define MAIL_FIELD(buffer, off) ((char *)(buffer) + (off))
+
+/* A batch of messages being packed for send_messages(): max descriptors at
+ * the front of buffer, the strings after them */
+typedef struct {
+    char *buffer;
+    int size;
+    int max;
+    int count;
+    int used;
+} mail_batch_t;
+
+
+/* Send a request to the mailbox service. Its endpoint is looked up by name
+ * on the first call and kept for the life of the process. */
+int mailbox_syscall(int call, message *m) {
+  static endpoint_t mailbox_ep;
+  static int mailbox_found;
+
+  if (!mailbox_found) {
+    if (minix_rs_lookup("mailbox", &mailbox_ep) != OK) {
+      errno = ESRCH;
+      return ERROR;
+    }
+    mailbox_found = 1;
+  }
+  return(_syscall(mailbox_ep, call, m));
+}
 
 /* Debug System Calls */
 int show_users() {
   message m;
-  return(_syscall(PM_PROC_NR, PM_SHOW_USERS, &m));
+  return(mailbox_syscall(MAILBOX_SHOW_USERS, &m));
 }
 
 int show_mailboxes() {
   message m;
-  return(_syscall(PM_PROC_NR, PM_SHOW_MAILBOXES, &m));
+  return(mailbox_syscall(MAILBOX_SHOW_MAILBOXES, &m));
 }
 
 /* Main System Calls */
@@ -39,8 +148,11 @@ int update_privileges(char *username, int privileges)
 	    m.m1_i2 = privileges;
 	    m.m1_i3 = geteuid();
 
-	    return(_syscall(PM_PROC_NR, PM_UPDATE_PRIVILEGES, &m));
+	    return(mailbox_syscall(MAILBOX_UPDATE_PRIVILEGES, &m));
 	  }
+
+	  printf("Error: user does not exist.\n");
+	  return ERROR;
 }
 
 
@@ -54,8 +166,11 @@ int remove_user(char *username)
 	    m.m1_i1 = pwd->pw_uid;
 	    m.m1_i3 = geteuid();
 
-	    return(_syscall(PM_PROC_NR, PM_REMOVE_USER, &m));
+	    return(mailbox_syscall(MAILBOX_REMOVE_USER, &m));
 	  }
+
+	  printf("Error: user does not exist.\n");
+	  return ERROR;
 }
 
 int add_user(char *username, int privileges){
@@ -69,7 +184,7 @@ int add_user(char *username, int privileges){
     m.m1_i2 = privileges;
     m.m1_i3 = geteuid();
 
-    return(_syscall(PM_PROC_NR, PM_ADD_USER, &m));
+    return(mailbox_syscall(MAILBOX_ADD_USER, &m));
   }
 
   printf("Error: user does not exist.\n");
@@ -79,41 +194,129 @@ int add_user(char *username, int privileges){
 /* Add a new mailbox to the collection
  * mailbox_type - 0 or 1 (secure or public)
  * mailbox_name - name of the mailbox
- * send_access - space delimited string of uids
- * receive_access - space delimited string of uids
+ * senders, receivers - UIDs given send and receive access (secure) or
+ *                      denied it (public), in any order
+ * capacity - most messages it holds at a time, 0 for
+ *            DEFAULT_MAILBOX_CAPACITY; fails if that is more than is left
+ *            of MAILBOX_SLOT_BUDGET
+ * body_size - for a shared mailbox, the longest body its slots hold with
+ *             the terminator, up to MAX_LARGE_MESSAGE_LEN; 0 for
+ *             MAX_MESSAGE_LEN. Each slot takes as many slots of the budget
+ *             as it needs room for.
  */
-int add_mailbox(int mailbox_type, char *mailbox_name, char *send_access, char *receive_access){
-
+int add_mailbox_slots(int mailbox_type, char *mailbox_name,
+                      const int *senders, int number_of_senders,
+                      const int *receivers, int number_of_receivers,
+                      int capacity, int body_size)
+{
+  mailbox_request_t *request;
+  int name_bytes = strlen(mailbox_name) + 1;
+  int name_space = MAILBOX_REQUEST_PAD(name_bytes);
+  int request_bytes = sizeof(mailbox_request_t) + name_space +
+                      (number_of_senders + number_of_receivers) * sizeof(int);
+  char *p;
   message m;
+  int status;
+
+  request = malloc(request_bytes);
+  if (request == NULL) {
+    return ERROR;
+  }
+  request->mailbox_type = mailbox_type;
+  request->capacity = capacity;
+  request->body_size = body_size;
+  request->name_bytes = name_bytes;
+  request->number_of_senders = number_of_senders;
+  request->number_of_receivers = number_of_receivers;
+
+  p = (char *) (request + 1);
+  memset(p, 0, name_space);
+  memcpy(p, mailbox_name, name_bytes);
+  p += name_space;
+  memcpy(p, senders, number_of_senders * sizeof(int));
+  p += number_of_senders * sizeof(int);
+  memcpy(p, receivers, number_of_receivers * sizeof(int));
 
   m.m1_i1 = getuid();
-  m.m1_i2 = strlen(mailbox_name) + 1;
+  m.m1_i2 = request_bytes;
+  m.m1_p1 = (char *) request;
 
-  m.m1_p1 = mailbox_name;
-  m.m1_p2 = send_access;
-  m.m1_p3 = receive_access;
+  status = mailbox_syscall(MAILBOX_ADD_MAILBOX, &m);
+  free(request);
+  return status;
+}
 
-  int send_access_len = strlen(send_access) + 1;
-  int receive_access_len = strlen(receive_access) + 1;
+/* Like add_mailbox_slots(), with slots of the default size */
+int add_mailbox_sized(int mailbox_type, char *mailbox_name,
+                      const int *senders, int number_of_senders,
+                      const int *receivers, int number_of_receivers,
+                      int capacity)
+{
+  return add_mailbox_slots(mailbox_type, mailbox_name, senders,
+                           number_of_senders, receivers, number_of_receivers,
+                           capacity, 0);
+}
 
-  char *mailbox_type_buf = malloc(snprintf(NULL, 0, "%d", mailbox_type) + 1);
-  sprintf(mailbox_type_buf, "%d", mailbox_type);
+/* Like add_mailbox_sized(), with the default capacity */
+int add_mailbox_uids(int mailbox_type, char *mailbox_name,
+                     const int *senders, int number_of_senders,
+                     const int *receivers, int number_of_receivers)
+{
+  return add_mailbox_sized(mailbox_type, mailbox_name, senders,
+                           number_of_senders, receivers, number_of_receivers,
+                           0);
+}
 
-  // Concatenate lengths of send and receive into a char *
-  char *buf1 = malloc(snprintf(NULL, 0, "%d", send_access_len) + 1);
-  char *buf2 = malloc(snprintf(NULL, 0, "%d", receive_access_len) + 1);
-  sprintf(buf1, "%d", send_access_len);
-  sprintf(buf2, "%d", receive_access_len);
+/* Parse a space delimited string of UIDs into a new array */
+int *parse_uids(char *uid_list, int *count)
+{
+  int *uids = malloc((strlen(uid_list) / 2 + 1) * sizeof(int));
+  char *p = uid_list, *end;
 
-  char *send_receive_lens = strcat(mailbox_type_buf, " ");
-  send_receive_lens = strcat(send_receive_lens, buf1);
-  send_receive_lens = strcat(send_receive_lens, " ");
-  send_receive_lens = strcat(send_receive_lens, buf2);
+  *count = 0;
+  if (uids == NULL) {
+    return NULL;
+  }
+  for (;;) {
+    long uid = strtol(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    uids[(*count)++] = (int) uid;
+    p = end;
+  }
+  return uids;
+}
 
-  m.m1_i3 = strlen(send_receive_lens) + 1;
-  m.m1_p4 = send_receive_lens;
+/* Add a new mailbox to the collection
+ * mailbox_type - 0 or 1 (secure or public)
+ * mailbox_name - name of the mailbox
+ * send_access - space delimited string of uids
+ * receive_access - space delimited string of uids
+ * capacity - as for add_mailbox_sized()
+ */
+int add_mailbox_capacity(int mailbox_type, char *mailbox_name,
+                         char *send_access, char *receive_access,
+                         int capacity)
+{
+  int number_of_senders, number_of_receivers;
+  int *senders = parse_uids(send_access, &number_of_senders);
+  int *receivers = parse_uids(receive_access, &number_of_receivers);
+  int status = ERROR;
+
+  if (senders != NULL && receivers != NULL) {
+    status = add_mailbox_sized(mailbox_type, mailbox_name,
+                               senders, number_of_senders,
+                               receivers, number_of_receivers, capacity);
+  }
+  free(senders);
+  free(receivers);
+  return status;
+}
 
-  return(_syscall(PM_PROC_NR, PM_ADD_MAILBOX, &m));
+int add_mailbox(int mailbox_type, char *mailbox_name, char *send_access, char *receive_access){
+  return add_mailbox_capacity(mailbox_type, mailbox_name, send_access,
+                              receive_access, 0);
 }
 
 int remove_mailbox(char *mailbox_name){
@@ -124,20 +327,44 @@ int remove_mailbox(char *mailbox_name){
 
   m.m1_p1 = mailbox_name;
 
-  return(_syscall(PM_PROC_NR, PM_REMOVE_MAILBOX, &m));
+  return(mailbox_syscall(MAILBOX_REMOVE_MAILBOX, &m));
 }
 
-int send_message(char *mailbox_name,
-                 char *message_subject,
-                 char *message_data
-                 )
+/* Send mail that fits in the message itself, without any copy by the
+ * service; returns ERROR with nothing sent if it does not fit */
+int send_message_inline(char *mailbox_name, char *message_subject,
+                        char *message_data)
 {
+  size_t mailboxNameLen = strlen(mailbox_name);
+  size_t subjectLen = strlen(message_subject);
+  size_t messageLen = strlen(message_data);
+  mail_inline_t request;
+  message m;
 
+  if (mailboxNameLen + subjectLen + messageLen > INLINE_TEXT) {
+    return ERROR;
+  }
+  request.uid = getuid();
+  request.name_len = (unsigned char) mailboxNameLen;
+  request.subject_len = (unsigned char) subjectLen;
+  request.body_len = (unsigned char) messageLen;
+  request.unused = 0;
+  memcpy(request.text, mailbox_name, mailboxNameLen);
+  memcpy(request.text + mailboxNameLen, message_subject, subjectLen);
+  memcpy(request.text + mailboxNameLen + subjectLen, message_data, messageLen);
+
+  memcpy(m.m_u8.data, &request, sizeof(request));
+  return(mailbox_syscall(MAILBOX_DEPOSIT_INLINE, &m));
+}
+
+/* Deposit mail through the service's copy: MAILBOX_DEPOSIT, or
+ * MAILBOX_DEPOSIT_WAIT to wait for room */
+int send_message_call(int call, char *mailbox_name, char *message_subject,
+                      char *message_data)
+{
   size_t mailboxNameLen = strlen(mailbox_name) + 1;
   size_t subjectLen = strlen(message_subject) + 1;
   size_t messageLen = strlen(message_data) + 1;
-
-	//struct passwd *pwd = getpwnam(username);
 	message m;
 
 	m.m1_p1 = message_data;
@@ -148,45 +375,389 @@ int send_message(char *mailbox_name,
 	m.m1_i3 = (int) mailboxNameLen;
 	m.m1_ull1 = (uint64_t) getuid();
 
-	return(_syscall(PM_PROC_NR, PM_DEPOSIT, &m));
+	return(mailbox_syscall(call, &m));
+}
+
+int send_message(char *mailbox_name,
+                 char *message_subject,
+                 char *message_data
+                 )
+{
+
+  size_t mailboxNameLen = strlen(mailbox_name) + 1;
+  size_t subjectLen = strlen(message_subject) + 1;
+  size_t messageLen = strlen(message_data) + 1;
+
+	//struct passwd *pwd = getpwnam(username);
+
+	// Short mail goes in the message itself
+	if (mailboxNameLen + subjectLen + messageLen - 3 <= INLINE_TEXT) {
+		return send_message_inline(mailbox_name, message_subject,
+		                           message_data);
+	}
+
+	return send_message_call(MAILBOX_DEPOSIT, mailbox_name,
+	                         message_subject, message_data);
+}
+
+/* Like send_message(), but if the mailbox is full blocks until a message
+ * in it is reclaimed instead of failing */
+int send_message_wait(char *mailbox_name, char *message_subject,
+                      char *message_data)
+{
+	return send_message_call(MAILBOX_DEPOSIT_WAIT, mailbox_name,
+	                         message_subject, message_data);
 }
 
 
 
-int receive_message(char *destBuffer, size_t bufferSize)//, int recipient)
+/* A short body comes back in the reply instead of being copied */
+void take_inline_reply(message *m, char *destBuffer, size_t bufferSize)
 {
+	mail_inline_reply_t reply;
 
-	//struct passwd *pwd = getpwnam(username);
+	memcpy(&reply, m->m_u8.data, sizeof(reply));
+	if (reply.length > 0 && reply.length <= (int) sizeof(reply.body) &&
+	    (size_t) reply.length <= bufferSize) {
+		memcpy(destBuffer, reply.body, reply.length);
+	}
+}
 
+/* Retrieve the caller's oldest queued message
+ * mode - RECEIVE_NOWAIT fails if nothing is queued, RECEIVE_WAIT blocks
+ *        until a message is deposited for the caller
+ * timeout_ms - with RECEIVE_WAIT, fail after this many milliseconds
+ *              (0 waits for ever)
+ */
+int receive_message_mode(char *destBuffer, size_t bufferSize, int mode,
+                         int timeout_ms)
+{
   message m;
 	m.m1_p1 = destBuffer;
-	//m.m1_i1 = recipient;
-	m.m1_i1 = (int) bufferSize + 1;
+	m.m1_i1 = (int) bufferSize;
 	m.m1_i2 = getuid();
+	m.m1_i3 = mode;
+	m.m1_ull1 = (uint64_t) (timeout_ms > 0 ? timeout_ms : 0);
 
-	int status = _syscall(PM_PROC_NR, PM_RETRIEVE, &m);
+	int status = mailbox_syscall(MAILBOX_RETRIEVE, &m);
+	if (status != ERROR)
+	{
+		take_inline_reply(&m, destBuffer, bufferSize);
+	}
 	if (status == ERROR)
 	{
 		printf("ERROR: The process couldn't retrieve any message\n");
 	}
 	else
 	{
-		printf("+User: message (%d bytes) \"%s\" received\n", m.m1_i2, destBuffer);
+		printf("+User: message \"%s\" received\n", destBuffer);
 	}
 
 		return status;
 }
 
+/* Size of the caller's next message, terminator included: a buffer that
+ * large receives it. Returns ERROR if nothing is queued.
+ */
+int probe_message(void)
+{
+  message m;
+	m.m1_i2 = getuid();
+
+	return(mailbox_syscall(MAILBOX_PROBE, &m));
+}
+
+int receive_message(char *destBuffer, size_t bufferSize)
+{
+	return receive_message_mode(destBuffer, bufferSize, RECEIVE_NOWAIT, 0);
+}
+
+/* Like receive_message(), but blocks until a message arrives */
+int receive_message_wait(char *destBuffer, size_t bufferSize)
+{
+	return receive_message_mode(destBuffer, bufferSize, RECEIVE_WAIT, 0);
+}
+
+/* Like receive_message_wait(), but gives up with ERROR after timeout_ms
+ * milliseconds */
+int receive_message_timeout(char *destBuffer, size_t bufferSize, int timeout_ms)
+{
+	if (timeout_ms <= 0) {
+		return receive_message(destBuffer, bufferSize);
+	}
+	return receive_message_mode(destBuffer, bufferSize, RECEIVE_WAIT,
+	                            timeout_ms);
+}
+
+/* Like receive_message(), but a message in a shared mailbox is lent out in
+ * place rather than copied, however long: *body points at it in a
+ * read-only mapping and *lease is to be passed to release_message() when
+ * done with it. The mailbox is mapped into the caller on its first lend
+ * from there and stays mapped for the next ones. Other mail is copied into
+ * destBuffer as usual, with *body set to destBuffer and *lease to -1.
+ */
+int receive_message_mapped(char *destBuffer, size_t bufferSize, char **body,
+                           int *lease)
+{
+  message m;
+	m.m1_p1 = destBuffer;
+	m.m1_i1 = (int) bufferSize;
+	m.m1_i2 = getuid();
+	m.m1_i3 = RECEIVE_MAPPED;
+	m.m1_ull1 = 0;
+
+	int status = mailbox_syscall(MAILBOX_RETRIEVE, &m);
+	if (status != ERROR)
+	{
+		*lease = m.m1_i1;
+		*body = *lease != -1 ? m.m1_p1 : destBuffer;
+	}
+	return status;
+}
+
+/* End the lease on a message from receive_message_mapped(); *body must
+ * not be read after that */
+int release_message(int lease)
+{
+  message m;
+	m.m1_i3 = lease;
+
+	return(mailbox_syscall(MAILBOX_RELEASE, &m));
+}
+
+/* Retrieve up to max_messages of the caller's queued messages in one call
+ * buffer - receives max_messages descriptors (mail_desc_t) followed by the
+ *          strings they refer to; should be aligned for int
+ * Returns the number of messages retrieved (0 if none were queued), or
+ * ERROR if the buffer cannot hold the descriptors or the next message.
+ */
+int receive_messages(void *buffer, size_t bufferSize, int max_messages)
+{
+  message m;
+	m.m1_p1 = buffer;
+	m.m1_i1 = bufferSize > MAX_BATCH_BYTES ? MAX_BATCH_BYTES : (int) bufferSize;
+	m.m1_i2 = getuid();
+	m.m1_i3 = max_messages;
+
+	return(mailbox_syscall(MAILBOX_RETRIEVE_BATCH, &m));
+}
+
+/* Start packing a batch of up to max_messages into buffer (int-aligned) */
+int send_batch_init(mail_batch_t *batch, void *buffer, size_t bufferSize,
+                    int max_messages)
+{
+	if (max_messages < 1 || max_messages > MAX_BATCH_COUNT ||
+	    bufferSize < max_messages * sizeof(mail_desc_t)) {
+		return ERROR;
+	}
+	batch->buffer = buffer;
+	batch->size = bufferSize > MAX_BATCH_BYTES ? MAX_BATCH_BYTES
+	                                           : (int) bufferSize;
+	batch->max = max_messages;
+	batch->count = 0;
+	batch->used = max_messages * sizeof(mail_desc_t);
+	return OK;
+}
+
+/* Append a message to a batch. Returns ERROR if the batch is full. */
+int send_batch_add(mail_batch_t *batch, char *mailbox_name,
+                   char *message_subject, char *message_data)
+{
+	int mailboxNameLen = strlen(mailbox_name) + 1;
+	int subjectLen = strlen(message_subject) + 1;
+	int messageLen = strlen(message_data) + 1;
+	mail_desc_t *desc = (mail_desc_t *) batch->buffer + batch->count;
+
+	if (batch->count == batch->max ||
+	    batch->used + mailboxNameLen + subjectLen + messageLen > batch->size) {
+		return ERROR;
+	}
+
+	desc->mailbox = batch->used;
+	memcpy(batch->buffer + batch->used, mailbox_name, mailboxNameLen);
+	batch->used += mailboxNameLen;
+	desc->subject = batch->used;
+	memcpy(batch->buffer + batch->used, message_subject, subjectLen);
+	batch->used += subjectLen;
+	desc->body = batch->used;
+	desc->length = messageLen;
+	memcpy(batch->buffer + batch->used, message_data, messageLen);
+	batch->used += messageLen;
+
+	batch->count++;
+	return OK;
+}
+
+/* Deposit every message of a batch in one call
+ * status - if not NULL, receives OK or ERROR for each message
+ * Returns the number of messages deposited. The batch is repacked for the
+ * call; start over with send_batch_init() to send another.
+ */
+int send_messages(mail_batch_t *batch, int *status)
+{
+	message m;
+
+	// Descriptors not used are left out of the copy
+	if (batch->count < batch->max) {
+		int unused = (batch->max - batch->count) * sizeof(mail_desc_t);
+		mail_desc_t *desc = (mail_desc_t *) batch->buffer;
+		int i;
+
+		memmove(batch->buffer + batch->count * sizeof(mail_desc_t),
+		        batch->buffer + batch->max * sizeof(mail_desc_t),
+		        batch->used - batch->max * sizeof(mail_desc_t));
+		for (i = 0; i < batch->count; i++) {
+			desc[i].mailbox -= unused;
+			desc[i].subject -= unused;
+			desc[i].body -= unused;
+		}
+		batch->used -= unused;
+		batch->max = batch->count;
+	}
+
+	m.m1_p1 = batch->buffer;
+	m.m1_p2 = (char *) status;
+	m.m1_i1 = batch->used;
+	m.m1_i2 = batch->count;
+	m.m1_ull1 = (uint64_t) getuid();
+
+	return(mailbox_syscall(MAILBOX_DEPOSIT_BATCH, &m));
+}
+
+/* Open a mailbox once for the calls below, which then skip the name copy,
+ * lookup and access check
+ * mode - OPEN_SEND, OPEN_RECEIVE or both
+ * Returns the handle, or ERROR. It fails from then on once the mailbox is
+ * removed or the access it was opened for is revoked.
+ */
+int open_mailbox(char *mailbox_name, int mode)
+{
+  message m;
+	m.m1_p1 = mailbox_name;
+	m.m1_i1 = getuid();
+	m.m1_i2 = strlen(mailbox_name) + 1;
+	m.m1_i3 = mode;
+
+	return(mailbox_syscall(MAILBOX_OPEN, &m));
+}
+
+int close_mailbox(int handle)
+{
+  message m;
+	m.m1_i3 = handle;
+
+	return(mailbox_syscall(MAILBOX_CLOSE, &m));
+}
+
+/* Like send_message(), into the mailbox opened as handle */
+int send_message_handle(int handle, char *message_subject, char *message_data)
+{
+  message m;
+	m.m1_p1 = message_data;
+	m.m1_p2 = message_subject;
+	m.m1_i1 = (int) strlen(message_data) + 1;
+	m.m1_i2 = (int) strlen(message_subject) + 1;
+	m.m1_i3 = handle;
+
+	return(mailbox_syscall(MAILBOX_DEPOSIT_HANDLE, &m));
+}
+
+/* Like receive_message(), but only from the mailbox opened as handle */
+int receive_message_handle(int handle, char *destBuffer, size_t bufferSize)
+{
+  message m;
+	m.m1_p1 = destBuffer;
+	m.m1_i1 = (int) bufferSize;
+	m.m1_i3 = handle;
+
+	int status = mailbox_syscall(MAILBOX_RETRIEVE_HANDLE, &m);
+	if (status != ERROR)
+	{
+		take_inline_reply(&m, destBuffer, bufferSize);
+	}
+	return status;
+}
+
+/* Map the slots of a mailbox created with SHARED_MAILBOX or'ed into its
+ * type, through a handle on it: writable if opened with OPEN_SEND.
+ * Returns the address of slot 0 and sets *slots to their number and
+ * *body_size to the room for a body in each, or returns NULL. Mapping
+ * through the same handle again returns the same address. The mapping is
+ * valid until the handle is closed or goes stale: once the mailbox is
+ * removed or the access the handle was opened for is revoked, the service
+ * unmaps it and it must no longer be touched.
+ */
+void *ring_map_sized(int handle, int *slots, int *body_size)
+{
+  message m;
+	m.m1_i3 = handle;
+
+	if (mailbox_syscall(MAILBOX_RING_MAP, &m) == ERROR) {
+		return NULL;
+	}
+	*slots = m.m1_i1;
+	*body_size = m.m1_i2;
+	return m.m1_p1;
+}
+
+/* Like ring_map_sized(), for mailboxes with slots of the default size */
+void *ring_map(int handle, int *slots)
+{
+	int body_size;
+
+	return ring_map_sized(handle, slots, &body_size);
+}
+
+/* Claim a free slot to fill in with RING_BODY() and RING_SUBJECT();
+ * returns the slot, or ERROR if the mailbox is full */
+int ring_claim(int handle)
+{
+  message m;
+	m.m1_i3 = handle;
+
+	return(mailbox_syscall(MAILBOX_RING_CLAIM, &m));
+}
+
+/* Deposit the claimed slot once filled in */
+int ring_post(int handle, int slot)
+{
+  message m;
+	m.m1_i1 = slot;
+	m.m1_i3 = handle;
+
+	return(mailbox_syscall(MAILBOX_RING_POST, &m));
+}
+
+/* Take the slot of the caller's oldest message in the mailbox, releasing
+ * the one taken before; returns the slot, or ERROR if none is queued */
+int ring_take(int handle)
+{
+  message m;
+	m.m1_i3 = handle;
+
+	return(mailbox_syscall(MAILBOX_RING_TAKE, &m));
+}
+
+/* Let the slot taken be reused once read */
+int ring_release(int handle, int slot)
+{
+  message m;
+	m.m1_i1 = slot;
+	m.m1_i3 = handle;
+
+	return(mailbox_syscall(MAILBOX_RING_RELEASE, &m));
+}
+
 int delete_message (char *mailbox_name, char *subject) {
-    int mailbox_name_len = strlen(mailbox_name);
-    int subject_len = strlen(subject);
+    int mailbox_name_len = strlen(mailbox_name) + 1;
+    int subject_len = strlen(subject) + 1;
     message m;
     m.m1_p1 = mailbox_name;
     m.m1_p2 = subject;
     m.m1_i1 = getuid();
     m.m1_i2 = mailbox_name_len;
     m.m1_i3 = subject_len;
-    return(_syscall(PM_PROC_NR, PM_DELETE_MESSAGE, &m));
+    return(mailbox_syscall(MAILBOX_DELETE_MESSAGE, &m));
 
 }
 
@@ -200,7 +771,7 @@ int add_sender (char *mailbox_name,char *username) {
     m.m1_i3 = mailbox_name_len;
     m.m1_p1 = mailbox_name;
 
-    return(_syscall(PM_PROC_NR, PM_ADD_SENDER, &m));
+    return(mailbox_syscall(MAILBOX_ADD_SENDER, &m));
   }
   printf("Error: user does not exist.\n");
   return ERROR;
@@ -217,7 +788,7 @@ int add_receiver (char *mailbox_name,char *username) {
     m.m1_i3 = mailbox_name_len;
     m.m1_p1 = mailbox_name;
 
-    return(_syscall(PM_PROC_NR, PM_ADD_RECEIVER, &m));
+    return(mailbox_syscall(MAILBOX_ADD_RECEIVER, &m));
   }
   printf("Error: user does not exist.\n");
   return ERROR;
@@ -234,7 +805,7 @@ int remove_sender (char *mailbox_name,char *username) {
     m.m1_i3 = mailbox_name_len;
     m.m1_p1 = mailbox_name;
 
-    return(_syscall(PM_PROC_NR, PM_REMOVE_SENDER, &m));
+    return(mailbox_syscall(MAILBOX_REMOVE_SENDER, &m));
   }
   printf("Error: user does not exist.\n");
   return ERROR;
@@ -251,7 +822,7 @@ int remove_receiver (char *mailbox_name,char *username) {
     m.m1_i3 = mailbox_name_len;
     m.m1_p1 = mailbox_name;
 
-    return(_syscall(PM_PROC_NR, PM_REMOVE_RECEIVER, &m));
+    return(mailbox_syscall(MAILBOX_REMOVE_RECEIVER, &m));
   }
   printf("Error: user does not exist.\n");
   return ERROR;
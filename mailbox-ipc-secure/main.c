@@ -0,0 +1,124 @@
+/* This file contains the main program of the mailbox service. The engine
+ * used to run inside PM; as a service of its own, a flood of mailbox calls
+ * no longer holds up fork, exec, wait and signal delivery.
+ *
+ * The entry points into this file are:
+ *   main:		starts the service and runs its request loop
+ *   mailbox_reply:	send the reply to a request
+ */
+
+#include "inc.h"
+
+/* Global variables, declared in glo.h */
+message m_in;
+message m_out;
+endpoint_t who_e;
+int call_nr;
+
+static void send_reply(endpoint_t who, message *m);
+static void sef_local_startup(void);
+static int sef_cb_init_fresh(int type, sef_init_info_t *info);
+
+/*===========================================================================*
+ *				main					     *
+ *===========================================================================*/
+int main(void)
+{
+/* Handle one request at a time, in the order they arrive. A handler may
+ * fill in m_out besides returning the result. One that returns EDONTREPLY
+ * keeps its caller blocked until mailbox_reply() is called for it later.
+ */
+  int r, ipc_status;
+  unsigned int index;
+
+  sef_local_startup();
+
+  for (;;) {
+	if ((r = sef_receive_status(ANY, &m_in, &ipc_status)) != OK)
+		panic("mailbox: sef_receive_status failed: %d", r);
+
+	if (is_ipc_notify(ipc_status)) {
+		/* Receive timeouts are PM-style libsys timers */
+		if (m_in.m_source == CLOCK)
+			expire_timers(m_in.m_notify.timestamp);
+		/* Processes the service has asked VM to watch have exited */
+		if (m_in.m_source == VM_PROC_NR)
+			process_exits();
+		/* Room they held lets in senders blocked on it */
+		admit_senders();
+		continue;
+	}
+
+	who_e = m_in.m_source;
+	call_nr = m_in.m_type;
+	memset(&m_out, 0, sizeof(m_out));
+	index = (unsigned int)(call_nr - MAILBOX_BASE);
+
+	if (index < NR_MAILBOX_CALLS && call_vec[index] != NULL)
+		r = (*call_vec[index])();
+	else
+		r = ENOSYS;
+
+	if (r != EDONTREPLY) {
+		m_out.m_type = r;
+		send_reply(who_e, &m_out);
+	}
+
+	/* Room the request made lets in senders blocked on it */
+	admit_senders();
+  }
+
+  return OK;
+}
+
+/*===========================================================================*
+ *				mailbox_reply				     *
+ *===========================================================================*/
+void mailbox_reply(endpoint_t who, int result)
+{
+/* Reply to a request that was left without one. */
+  message m;
+
+  memset(&m, 0, sizeof(m));
+  m.m_type = result;
+  send_reply(who, &m);
+}
+
+/*===========================================================================*
+ *				send_reply				     *
+ *===========================================================================*/
+static void send_reply(endpoint_t who, message *m)
+{
+/* A caller that died while blocked is gone by the time we reply; its
+ * endpoint is no longer valid and the reply is dropped.
+ */
+  int r;
+
+  if ((r = ipc_sendnb(who, m)) != OK)
+	printf("mailbox: unable to reply to %d: %d\n", who, r);
+}
+
+/*===========================================================================*
+ *			       sef_local_startup			     *
+ *===========================================================================*/
+static void sef_local_startup(void)
+{
+  sef_setcb_init_fresh(sef_cb_init_fresh);
+  sef_setcb_init_restart(sef_cb_init_fresh);
+
+  sef_setcb_signal_handler(sef_cb_signal_handler_term);
+
+  sef_startup();
+}
+
+/*===========================================================================*
+ *				sef_cb_init_fresh			     *
+ *===========================================================================*/
+static int sef_cb_init_fresh(int UNUSED(type), sef_init_info_t *UNUSED(info))
+{
+/* Preallocate the pools and the user registry before the first request;
+ * mailboxes are set up on first use.
+ */
+  init_users();
+  return OK;
+}
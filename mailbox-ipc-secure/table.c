@@ -1,75 +1,39 @@
-/* This file contains the table used to map system call numbers onto the
+/* This file contains the table used to map mailbox request numbers onto the
  * routines that perform them.
  */
 
-#define _TABLE
+#include "inc.h"
 
-#include "pm.h"
-#include <minix/callnr.h>
-#include <signal.h>
-#include "mproc.h"
+#define CALL(n)	[((n) - MAILBOX_BASE)]
 
-#define CALL(n)	[((n) - PM_BASE)]
-
-int (* const call_vec[NR_PM_CALLS])(void) = {
-	CALL(PM_EXIT)		= do_exit,		/* _exit(2) */
-	CALL(PM_FORK)		= do_fork,		/* fork(2) */
-	CALL(PM_WAIT4)		= do_wait4,		/* wait4(2) */
-	CALL(PM_GETPID)		= do_get,		/* get[p]pid(2) */
-	CALL(PM_SETUID)		= do_set,		/* setuid(2) */
-	CALL(PM_GETUID)		= do_get,		/* get[e]uid(2) */
-	CALL(PM_STIME)		= do_stime,		/* stime(2) */
-	CALL(PM_PTRACE)		= do_trace,		/* ptrace(2) */
-	CALL(PM_SETGROUPS)	= do_set,		/* setgroups(2) */
-	CALL(PM_GETGROUPS)	= do_get,		/* getgroups(2) */
-	CALL(PM_KILL)		= do_kill,		/* kill(2) */
-	CALL(PM_SETGID)		= do_set,		/* setgid(2) */
-	CALL(PM_GETGID)		= do_get,		/* get[e]gid(2) */
-	CALL(PM_EXEC)		= do_exec,		/* execve(2) */
-	CALL(PM_SETSID)		= do_set,		/* setsid(2) */
-	CALL(PM_GETPGRP)	= do_get,		/* getpgrp(2) */
-	CALL(PM_ITIMER)		= do_itimer,		/* [gs]etitimer(2) */
-	CALL(PM_GETMCONTEXT)	= do_getmcontext,	/* getmcontext(2) */
-	CALL(PM_SETMCONTEXT)	= do_setmcontext,	/* setmcontext(2) */
-	CALL(PM_SIGACTION)	= do_sigaction,		/* sigaction(2) */
-	CALL(PM_SIGSUSPEND)	= do_sigsuspend,	/* sigsuspend(2) */
-	CALL(PM_SIGPENDING)	= do_sigpending,	/* sigpending(2) */
-	CALL(PM_SIGPROCMASK)	= do_sigprocmask,	/* sigprocmask(2) */
-	CALL(PM_SIGRETURN)	= do_sigreturn,		/* sigreturn(2) */
-	CALL(PM_SYSUNAME)	= do_sysuname,		/* sysuname(2) */
-	CALL(PM_GETPRIORITY)	= do_getsetpriority,	/* getpriority(2) */
-	CALL(PM_SETPRIORITY)	= do_getsetpriority,	/* setpriority(2) */
-	CALL(PM_GETTIMEOFDAY)	= do_time,		/* gettimeofday(2) */
-	CALL(PM_SETEUID)	= do_set,		/* geteuid(2) */
-	CALL(PM_SETEGID)	= do_set,		/* setegid(2) */
-	CALL(PM_ISSETUGID)	= do_get,		/* issetugid */
-	CALL(PM_GETSID)		= do_get,		/* getsid(2) */
-	CALL(PM_CLOCK_GETRES)	= do_getres,		/* clock_getres(2) */
-	CALL(PM_CLOCK_GETTIME)	= do_gettime,		/* clock_gettime(2) */
-	CALL(PM_CLOCK_SETTIME)	= do_settime,		/* clock_settime(2) */
-	CALL(PM_GETRUSAGE)	= do_getrusage,		/* getrusage(2) */
-	CALL(PM_REBOOT)		= do_reboot,		/* reboot(2) */
-	CALL(PM_SVRCTL)		= do_svrctl,		/* svrctl(2) */
-	CALL(PM_SPROF)		= do_sprofile,		/* sprofile(2) */
-	CALL(PM_SRV_FORK)	= do_srv_fork,		/* srv_fork(2) */
-	CALL(PM_SRV_KILL)	= do_srv_kill,		/* srv_kill(2) */
-	CALL(PM_EXEC_NEW)	= do_newexec,
-	CALL(PM_EXEC_RESTART)	= do_execrestart,
-	CALL(PM_GETEPINFO)	= do_getepinfo,		/* getepinfo(2) */
-	CALL(PM_GETPROCNR)	= do_getprocnr,		/* getprocnr(2) */
-	CALL(PM_GETSYSINFO)	= do_getsysinfo,	/* getsysinfo(2) */
-	CALL(PM_DEPOSIT)	= do_add_to_mailbox,	/* add_to_mailbox 48*/
-	CALL(PM_RETRIEVE)       = do_get_from_mailbox,     /* get_from_mailbox 40*/
-	CALL(PM_ADD_USER)       = do_add_user,           /* add_user 49 */
-	CALL(PM_ADD_MAILBOX)    = do_add_mailbox,           /* add_mailbox 50 */
-	CALL(PM_REMOVE_USER)    = do_remove_user,	/* remove_user 51 */
-	CALL(PM_UPDATE_PRIVILEGES) = do_update_privileges, /* update_privileges */
-	CALL(PM_DELETE_MESSAGE) = do_delete_message,
-	CALL(PM_REMOVE_MAILBOX) = do_remove_mailbox, /* remove_mailbox */
-	CALL(PM_ADD_SENDER) = do_add_sender,
-	CALL(PM_ADD_RECEIVER) = do_add_receiver,
-	CALL(PM_REMOVE_SENDER) = do_remove_sender,
-	CALL(PM_REMOVE_RECEIVER) = do_remove_receiver,
-	CALL(PM_SHOW_USERS) = do_show_users,
-	CALL(PM_SHOW_MAILBOXES) = do_show_mailboxes
+int (* const call_vec[NR_MAILBOX_CALLS])(void) = {
+	CALL(MAILBOX_DEPOSIT)	= do_add_to_mailbox,	/* send_message */
+	CALL(MAILBOX_RETRIEVE)	= do_get_from_mailbox,	/* receive_message */
+	CALL(MAILBOX_ADD_USER)	= do_add_user,		/* add_user */
+	CALL(MAILBOX_ADD_MAILBOX) = do_add_mailbox,	/* add_mailbox */
+	CALL(MAILBOX_REMOVE_USER) = do_remove_user,	/* remove_user */
+	CALL(MAILBOX_UPDATE_PRIVILEGES) = do_update_privileges, /* update_privileges */
+	CALL(MAILBOX_DELETE_MESSAGE) = do_delete_message, /* delete_message */
+	CALL(MAILBOX_REMOVE_MAILBOX) = do_remove_mailbox, /* remove_mailbox */
+	CALL(MAILBOX_ADD_SENDER) = do_add_sender,
+	CALL(MAILBOX_ADD_RECEIVER) = do_add_receiver,
+	CALL(MAILBOX_REMOVE_SENDER) = do_remove_sender,
+	CALL(MAILBOX_REMOVE_RECEIVER) = do_remove_receiver,
+	CALL(MAILBOX_SHOW_USERS) = do_show_users,
+	CALL(MAILBOX_SHOW_MAILBOXES) = do_show_mailboxes,
+	CALL(MAILBOX_RETRIEVE_BATCH) = do_get_batch_from_mailbox,
+	CALL(MAILBOX_DEPOSIT_BATCH) = do_add_batch_to_mailbox,
+	CALL(MAILBOX_DEPOSIT_INLINE) = do_add_inline_to_mailbox,
+	CALL(MAILBOX_OPEN) = do_open_mailbox,		/* open_mailbox */
+	CALL(MAILBOX_CLOSE) = do_close_mailbox,		/* close_mailbox */
+	CALL(MAILBOX_DEPOSIT_HANDLE) = do_add_to_handle,
+	CALL(MAILBOX_RETRIEVE_HANDLE) = do_get_from_handle,
+	CALL(MAILBOX_RING_MAP) = do_ring_map,		/* ring_map */
+	CALL(MAILBOX_RING_CLAIM) = do_ring_claim,	/* ring_claim */
+	CALL(MAILBOX_RING_POST) = do_ring_post,		/* ring_post */
+	CALL(MAILBOX_RING_TAKE) = do_ring_take,		/* ring_take */
+	CALL(MAILBOX_RING_RELEASE) = do_ring_release,	/* ring_release */
+	CALL(MAILBOX_PROBE) = do_probe_mailbox,		/* probe_message */
+	CALL(MAILBOX_DEPOSIT_WAIT) = do_add_to_mailbox,	/* send_message_wait */
+	CALL(MAILBOX_RELEASE) = do_release_message	/* release_message */
 };
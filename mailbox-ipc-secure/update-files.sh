@@ -2,26 +2,28 @@
 
 # Copy files to appropriate location in Minix
 
-# Copy process manager's files
-pmFiles="mailbox.h mailbox.c proto.h table.c"
-for fl in $pmFiles; do
-    cp $fl /usr/src/minix/servers/pm
+# Copy the mailbox service's files
+serviceDir=/usr/src/minix/servers/mailbox
+serviceFiles="main.c table.c mailbox.c mailbox.h inc.h glo.h proto.h"
+mkdir -p $serviceDir
+for fl in $serviceFiles; do
+    cp $fl $serviceDir
 done
 
-# Copy strtok files
-cp /usr/src/lib/libc/string/strtok.c /usr/src/minix/lib/libminc/
-cp /usr/src/lib/libc/string/strtok_r.c /usr/src/minix/lib/libminc/
-
 # Copy Makefiles
 cp header_Makefile /usr/src/minix/include/Makefile
-cp pm_Makefile /usr/src/minix/servers/pm/Makefile
-cp libminc_Makefile /usr/src/minix/lib/libminc/Makefile
+cp mailbox_Makefile $serviceDir/Makefile
 
 # Copy callnr.h to include/
 
 cp callnr.h /usr/src/minix/include/minix
 cp mailboxlib.h /usr/src/minix/include
 
-# Build
-cd /usr/src/releasetools
-make hdboot
+# Copy the service's privileges
+mkdir -p /etc/system.conf.d
+cp system.conf /etc/system.conf.d/mailbox
+
+# Build and install the headers and the service, then start it
+(cd /usr/src/minix/include && make install)
+(cd $serviceDir && make && make install)
+minix-service up /service/mailbox
@@ -1,48 +1,141 @@
 /**
  * @file mailbox.c
  * @brief Implementation of basic mailbox system calls.
+ *
+ * PM receives one request at a time and runs its handler to completion
+ * before taking the next, so its message queue already serializes every
+ * mailbox call in arrival order and no handler takes a lock. A host that
+ * runs these handlers from several threads must likewise call them one at
+ * a time (the simulator holds its PM lock around each call).
  */
 
-#include "glo.h"
-#include "mailboxlib.h"
-#include <minix/syslib.h>
+#include "mailbox.h"
 
 /** Global mailbox instance used by all operations */
 static mailbox_t *mailbox;
-/** Mutex flag for protecting mailbox operations */
-static int mutex;
+/** Pools for the message, delivery and inbox nodes allocated on every call */
+static pool_t message_pool = POOL_INITIALIZER(message_t, MESSAGE_POOL_SLAB);
+static pool_t delivery_pool = POOL_INITIALIZER(delivery_t, DELIVERY_POOL_SLAB);
+static pool_t inbox_pool = POOL_INITIALIZER(inbox_t, INBOX_POOL_SLAB);
 
 /**
- * @brief Print all messages currently stored in the mailbox.
+ * @brief Carve a new slab into free objects.
  *
- * Walks the mailbox list and displays each message's recipients.
- * Used only for debugging.
+ * @param pool Pool to grow.
+ * @return OK on success, ERROR if out of memory.
+ */
+static int pool_grow(pool_t *pool) {
+  char *slab = malloc(pool->objects_per_slab * pool->object_size);
+  int i;
+
+  if (slab == NULL) {
+    return ERROR;
+  }
+  for (i = pool->objects_per_slab - 1; i >= 0; i--) {
+    pool_object_t *obj = (pool_object_t *)(slab + i * pool->object_size);
+    obj->next = pool->free_list;
+    pool->free_list = obj;
+  }
+  pool->number_of_slabs++;
+  return OK;
+}
+
+/**
+ * @brief Grow a pool until it has at least @a count free objects.
  *
- * @return Always 0.
+ * Lets a call allocate everything it needs before changing any state.
+ *
+ * @param pool Pool to grow.
+ * @param count Objects the caller is about to take.
+ * @return OK on success, ERROR if out of memory.
  */
-int print_all_messages() {
+static int pool_reserve(pool_t *pool, int count) {
+  while (pool->number_of_slabs * pool->objects_per_slab - pool->in_use <
+         count) {
+    if (pool_grow(pool) != OK) {
+      return ERROR;
+    }
+  }
+  return OK;
+}
 
-  int i;
-  message_t *message_ptr = mailbox->head;
+/**
+ * @brief Take an object from a pool, growing it by a slab when empty.
+ *
+ * @param pool Pool to allocate from.
+ * @return The object, or NULL if out of memory.
+ */
+static void *pool_alloc(pool_t *pool) {
+  pool_object_t *obj;
+
+  if (pool->free_list == NULL && pool_grow(pool) != OK) {
+    return NULL;
+  }
+  obj = pool->free_list;
+  pool->free_list = obj->next;
+  if (++pool->in_use > pool->high_water) {
+    pool->high_water = pool->in_use;
+  }
+  return obj;
+}
+
+/**
+ * @brief Return an object to its pool.
+ *
+ * @param pool Pool the object was allocated from.
+ * @param p Object to release.
+ */
+static void pool_free(pool_t *pool, void *p) {
+  pool_object_t *obj = p;
 
-  for (i = 1; i <= mailbox->number_of_messages; i++) {
-    message_ptr = message_ptr->next;
+  obj->next = pool->free_list;
+  pool->free_list = obj;
+  pool->in_use--;
+}
 
-    pid_node_t *pids = message_ptr->recipients;
-    char *message = message_ptr->message;
+/**
+ * @brief Print usage and high-water marks of the node pools.
+ *
+ * Used only for debugging.
+ *
+ * @return Always 0.
+ */
+int print_pool_stats() {
+  pool_t *pools[] = {&message_pool, &delivery_pool, &inbox_pool};
+  int i;
 
-    // printf("**Message number %d\n", i);
-    // printf("**Message content %s\n", message);
-    // printf("**Recipients: ");
+  for (i = 0; i < 3; i++) {
+    printf("%s: in use %d, high water %d, allocated %d\n", pools[i]->name,
+           pools[i]->in_use, pools[i]->high_water,
+           pools[i]->number_of_slabs * pools[i]->objects_per_slab);
+  }
+  return 0;
+}
 
-    pids = pids->next;
+/**
+ * @brief Print all messages currently stored in the mailbox.
+ *
+ * Walks the inbox index and displays the messages each PID has pending.
+ * Used only for debugging.
+ *
+ * @return Always 0.
+ */
+int print_all_messages() {
 
-    while (pids->pid != -1) {
-      printf(" %d, ", pids->pid);
-      pids = pids->next;
+  int i;
+  inbox_t *inbox;
+  delivery_t *d;
+
+  for (i = 0; i < INBOX_BUCKETS; i++) {
+    for (inbox = mailbox->inboxes[i]; inbox != NULL; inbox = inbox->hash_next) {
+      printf("%d:", inbox->pid);
+      for (d = inbox->head; d != NULL; d = d->next) {
+        printf(" \"%s\",", d->message->message);
+      }
+      printf("\n");
     }
-    printf("\n");
   }
+  print_pool_stats();
 
   return 0;
 }
@@ -50,17 +143,20 @@ int print_all_messages() {
 /**
  * @brief Create and initialize the global mailbox instance.
  *
- * Allocates the mailbox structure and sets up the sentinel node used
- * for the internal message list.
+ * Allocates the mailbox structure, preallocates the node pools and sets
+ * up the sentinel node used for the internal message list.
  *
  * @return OK on success.
  */
 int create_mailbox() {
-  mailbox = malloc(sizeof(mailbox_t));
-  mailbox->head = malloc(sizeof(message_t));
+  mailbox = calloc(1, sizeof(mailbox_t));
+
+  pool_grow(&message_pool);
+  pool_grow(&delivery_pool);
+  pool_grow(&inbox_pool);
 
   // Sentinel value
-  message_t *head = malloc(sizeof(message_t));
+  message_t *head = pool_alloc(&message_pool);
   head->message = "HEAD";
   head->prev = head;
   head->next = head;
@@ -68,70 +164,169 @@ int create_mailbox() {
   mailbox->head = head;
   mailbox->number_of_messages = 0;
 
-  mutex = 0;
-
   return OK;
 }
 
 /**
- * @brief Initialize the recipient list for a message.
+ * @brief Sort recipient PIDs and drop repeated ones.
  *
- * Allocates and sets up the sentinel node used by the message's
- * recipient linked list.
+ * A PID listed twice still receives the message once.
  *
- * @param m Message instance to initialize.
- * @return OK on success.
+ * @param pids PIDs as passed by the sender.
+ * @param count Entries in @a pids.
+ * @return Entries left in @a pids.
  */
-int init_msg_pid_list(message_t *m) {
-  m->recipients = malloc(sizeof(pid_node_t));
-  m->recipients->prev = m->recipients;
+static int sort_recipients(int *pids, int count) {
+  int i, j, pid, n = 0;
 
-  // Sentinel value
-  // Use negative -1 for head pid
-  m->recipients->pid = -1;
-  m->recipients->next = m->recipients;
+  for (i = 1; i < count; i++) {
+    pid = pids[i];
+    for (j = i; j > 0 && pids[j - 1] > pid; j--) {
+      pids[j] = pids[j - 1];
+    }
+    pids[j] = pid;
+  }
+  for (i = 0; i < count; i++) {
+    if (n == 0 || pids[n - 1] != pids[i]) {
+      pids[n++] = pids[i];
+    }
+  }
+  return n;
+}
 
-  return OK;
+/**
+ * @brief Find the bucket of the inbox index that holds a PID.
+ *
+ * @param pid PID of a recipient process.
+ * @return Head of the bucket's chain.
+ */
+static inbox_t **inbox_bucket(int pid) {
+  return &mailbox->inboxes[(unsigned int)pid & (INBOX_BUCKETS - 1)];
+}
+
+/**
+ * @brief Look up the inbox of a PID.
+ *
+ * @param pid PID of a recipient process.
+ * @return The inbox, or NULL if nothing is pending for @a pid.
+ */
+static inbox_t *find_inbox(int pid) {
+  inbox_t *inbox = *inbox_bucket(pid);
+
+  while (inbox != NULL && inbox->pid != pid) {
+    inbox = inbox->hash_next;
+  }
+  return inbox;
+}
+
+/**
+ * @brief Queue a message for one recipient.
+ *
+ * Creates the recipient's inbox if it has none. The caller must have
+ * reserved a delivery and an inbox.
+ *
+ * @param pid PID of the recipient process.
+ * @param m Message to queue.
+ */
+static void deliver(int pid, message_t *m) {
+  inbox_t *inbox = find_inbox(pid);
+  delivery_t *d = pool_alloc(&delivery_pool);
+
+  if (inbox == NULL) {
+    inbox_t **bucket = inbox_bucket(pid);
+
+    inbox = pool_alloc(&inbox_pool);
+    inbox->pid = pid;
+    inbox->head = NULL;
+    inbox->hash_next = *bucket;
+    *bucket = inbox;
+  }
+
+  d->message = m;
+  d->next = NULL;
+  if (inbox->head == NULL) {
+    inbox->head = d;
+  } else {
+    inbox->tail->next = d;
+  }
+  inbox->tail = d;
+}
+
+/**
+ * @brief Remove an empty inbox from the index and release it.
+ *
+ * @param inbox Inbox with no deliveries left.
+ */
+static void drop_inbox(inbox_t *inbox) {
+  inbox_t **link = inbox_bucket(inbox->pid);
+
+  while (*link != inbox) {
+    link = &(*link)->hash_next;
+  }
+  *link = inbox->hash_next;
+  pool_free(&inbox_pool, inbox);
+}
+
+/**
+ * @brief Release a message and its content.
+ *
+ * The message must already be unlinked from the mailbox.
+ *
+ * @param m Message to release.
+ */
+static void free_message(message_t *m) {
+  free(m->message);
+  pool_free(&message_pool, m);
 }
 
 /**
  * @brief Add a new message to the mailbox.
  *
  * The mailbox is created on demand if it does not yet exist. The message
- * content and recipient list are copied from user space. If the mailbox is
- * full the call fails.
+ * content and the array of recipient PIDs are copied from user space, and
+ * the message is queued in the inbox of each PID. If the mailbox is full
+ * the call fails.
  *
  * @return OK on success, ERROR on failure.
  */
 int add_to_mailbox() {
-  while (mutex == 1)
-    ;
-  mutex = 1;
   char *message;
-  char *stringRecipients;
   int messageLen;
-  int recipientsStringLen;
+  int recipientsLen;
+  int recipients[MAX_RECIPIENTS];
+  int i;
 
   // If message size > MAX_MESSAGE_LEN return error
   messageLen = m_in.m1_i1;
-  recipientsStringLen = m_in.m1_i2;
+  recipientsLen = m_in.m1_i2;
 
-  if (messageLen > MAX_MESSAGE_LEN) {
+  if (messageLen < 1 || messageLen > MAX_MESSAGE_LEN) {
     printf("Error: received message size exceeds %d chars\n", MAX_MESSAGE_LEN);
-    mutex = 0;
+    return ERROR;
+  }
+  if (recipientsLen < 1 || recipientsLen > MAX_RECIPIENTS) {
+    printf("Error: a message takes 1 to %d recipients\n", MAX_RECIPIENTS);
     return ERROR;
   }
 
   int messageBytes = messageLen * sizeof(char);
-  int recipientsStringBytes = recipientsStringLen * sizeof(char);
 
   message = malloc(messageBytes);
-  stringRecipients = malloc(recipientsStringBytes);
+  if (message == NULL) {
+    printf("Error: out of memory\n");
+    return ERROR;
+  }
 
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)message,
-               messageBytes);
-  sys_datacopy(who_e, (vir_bytes)m_in.m1_p2, SELF, (vir_bytes)stringRecipients,
-               recipientsStringBytes);
+  if (sys_datacopy(who_e, (vir_bytes)m_in.m1_p1, SELF, (vir_bytes)message,
+                   messageBytes) != OK ||
+      sys_datacopy(who_e, (vir_bytes)m_in.m1_p2, SELF, (vir_bytes)recipients,
+                   recipientsLen * sizeof(int)) != OK) {
+    printf("Error: unable to copy the message in\n");
+    free(message);
+    return ERROR;
+  }
+  message[messageLen - 1] = '\0';
+  recipientsLen = sort_recipients(recipients, recipientsLen);
 
   printf("Mailbox: New message sent. Message content with %d bytes: %s\n",
          messageBytes, message);
@@ -144,31 +339,24 @@ int add_to_mailbox() {
   }
 
   if (mailbox->number_of_messages < MAX_MESSAGE_COUNT) {
-    message_t *new_message = malloc(sizeof(message_t));
+    // Reserve every node up front so queueing cannot fail halfway
+    if (pool_reserve(&delivery_pool, recipientsLen) != OK ||
+        pool_reserve(&inbox_pool, recipientsLen) != OK) {
+      printf("Error: out of memory\n");
+      free(message);
+      return ERROR;
+    }
+    message_t *new_message = pool_alloc(&message_pool);
+    if (new_message == NULL) {
+      printf("Error: out of memory\n");
+      free(message);
+      return ERROR;
+    }
     new_message->message = message;
+    new_message->recipients_left = recipientsLen;
 
-    // Create a head node for the recipients linked list
-    init_msg_pid_list(new_message);
-
-    const char delim[2] = " ";
-    char *rec_p = strtok(stringRecipients, delim);
-
-    // printf("*Debug: first pid is %s\n", rec_p);
-    while (rec_p != NULL) {
-      pid_node_t *new_recipient = malloc(sizeof(pid_node_t));
-
-      new_recipient->pid = atoi(rec_p);
-
-      new_recipient->next = new_message->recipients;
-      new_recipient->prev = new_message->recipients->prev;
-
-      new_message->recipients->prev->next = new_recipient;
-      new_message->recipients->prev = new_recipient;
-
-      rec_p = strtok(NULL, delim);
-      if (rec_p != NULL) {
-        // printf("*Debug: next pid will be %s\n", rec_p);
-      }
+    for (i = 0; i < recipientsLen; i++) {
+      deliver(recipients[i], new_message);
     }
 
     new_message->next = mailbox->head;
@@ -185,28 +373,21 @@ int add_to_mailbox() {
     /* print_all_messages(); */
   } else {
     printf("Error: mailbox is full\n");
-    mutex = 0;
+    free(message);
     return ERROR;
   }
-  mutex = 0;
   return OK;
 }
 
 /**
  * @brief Retrieve a message for the calling process.
  *
- * Removes the process from the recipient list of the first matching
- * message. If all recipients have consumed the message it is removed
- * from the mailbox.
+ * Pops the oldest delivery from the process's inbox. If all recipients
+ * have consumed the message it is removed from the mailbox.
  *
  * @return OK if a message was delivered, ERROR otherwise.
  */
 int get_from_mailbox() {
-  while (mutex == 1)
-    ;
-  mutex = 1;
-
-  char *message;
   int recipient = m_in.m1_i1;
   int bufferSize = m_in.m1_i2;
 
@@ -216,69 +397,43 @@ int get_from_mailbox() {
   if (bufferSize < MAX_MESSAGE_LEN) {
     // printf("Error: insufficient buffer size, should be %d chars\n",
     // MAX_MESSAGE_LEN);
-    mutex = 0;
     return (ERROR);
   }
 
   // Return error if there are no messages in the mailbox
   if (!mailbox || mailbox->number_of_messages == 0) {
     printf("Error: mailbox is empty or has not been created\n");
-    mutex = 0;
     return ERROR;
-  } else {
-    int i = 0;
-    message_t *message_ptr = mailbox->head->next;
-
-    // Iterate over existing messages
-    while (i < mailbox->number_of_messages) {
-      // printf("Mailbox: Checking message number %d\n", i);
-      pid_node_t *recipient_p = message_ptr->recipients->next;
-      // pid_node_t *recipient_p = message_ptr->recipients;
-
-      // Iterate over messages assigned recipients
-      while (recipient_p->pid != -1) {
-        // printf("Mailbox:Checking pid %d\n", recipient_p->pid);
-        //  If the message was sent to current recipient consume it
-        if (recipient_p->pid == recipient) {
-          // printf("Mailbox: Pid %d success\n", recipient_p->pid);
-
-          int messageBytes = strlen(message_ptr->message) * sizeof(char);
-          // Copy the content of the message
-          sys_datacopy(SELF, (vir_bytes)message_ptr->message, who_e,
-                       (vir_bytes)m_in.m1_p1, messageBytes);
-
-          // printf("Mailbox: Message obtained is %s\n", m_in.m1_p1);
-
-          // Remove recipient
-          recipient_p->prev->next = recipient_p->next;
-          recipient_p->next->prev = recipient_p->prev;
-          pid_node_t *next_node = recipient_p->next;
-          pid_node_t *prev_node = recipient_p->prev;
-          free(recipient_p);
-
-          // Test if the message has to be garbage collected
-          if ((next_node->pid == -1) && (prev_node->pid == -1)) {
-            message_ptr->prev->next = message_ptr->next;
-            message_ptr->next->prev = message_ptr->prev;
-            printf("+Mailbox: Message \"%s\" has been garbage collected\n",
-                   message_ptr->message);
-            free(message_ptr);
-            mailbox->number_of_messages--;
-          }
-          mutex = 0;
-          return OK;
-        }
-        // Otherwise increment recipient's pointer
-        else {
-          recipient_p = recipient_p->next;
-        }
-      }
-      // Increment message pointer and counter
-      message_ptr = message_ptr->next;
-      i++;
+  }
+
+  inbox_t *inbox = find_inbox(recipient);
+  if (inbox != NULL) {
+    delivery_t *d = inbox->head;
+    message_t *message_ptr = d->message;
+
+    int messageBytes = strlen(message_ptr->message) * sizeof(char);
+    // Copy the content of the message
+    sys_datacopy(SELF, (vir_bytes)message_ptr->message, who_e,
+                 (vir_bytes)m_in.m1_p1, messageBytes);
+
+    // Remove the delivery, and the inbox with its last one
+    inbox->head = d->next;
+    pool_free(&delivery_pool, d);
+    if (inbox->head == NULL) {
+      drop_inbox(inbox);
+    }
+
+    // Test if the message has to be garbage collected
+    if (--message_ptr->recipients_left == 0) {
+      message_ptr->prev->next = message_ptr->next;
+      message_ptr->next->prev = message_ptr->prev;
+      printf("+Mailbox: Message \"%s\" has been garbage collected\n",
+             message_ptr->message);
+      free_message(message_ptr);
+      mailbox->number_of_messages--;
     }
+    return OK;
   }
   // In case of not find a message for the recipient return error
-  mutex = 0;
   return ERROR;
 }
@@ -0,0 +1,97 @@
+#include <minix/syslib.h>
+#include "glo.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <lib.h>
+#include <string.h>
+
+#define MAX_MESSAGE_COUNT 16
+#define OK 0
+#define ERROR -1
+#define MAX_MESSAGE_LEN 1024
+#define MAX_RECIPIENTS 64
+
+/* Slab pool
+ * Fixed-size objects carved out of slabs of objects_per_slab and recycled
+ * through a free list; slabs stay with the pool for the life of PM.
+ * in_use - objects handed out, high_water - the most ever handed out
+ */
+
+typedef struct pool_object {
+  struct pool_object *next;
+} pool_object_t;
+
+typedef struct {
+  const char *name;
+  int object_size;
+  int objects_per_slab;
+  pool_object_t *free_list;
+  int number_of_slabs;
+  int in_use;
+  int high_water;
+} pool_t;
+
+#define POOL_INITIALIZER(type, per_slab)                                       \
+  { #type, sizeof(type), (per_slab), NULL, 0, 0, 0 }
+
+/* Objects preallocated per pool on first use, and added per slab after;
+ * enough for a full mailbox and a few recipients per message */
+#define MESSAGE_POOL_SLAB (MAX_MESSAGE_COUNT + 1)
+#define DELIVERY_POOL_SLAB (4 * (MAX_MESSAGE_COUNT + 1))
+#define INBOX_POOL_SLAB 16
+
+/* Buckets of the inbox index; a power of two */
+#define INBOX_BUCKETS 64
+
+/* Message LinkedList
+ * recipients_left - deliveries of this message not retrieved yet; the
+ *   message is collected when it drops to 0
+ * message - the message value
+ * next - pointer to next message
+ * prev - pointer to prev message
+ */
+
+typedef struct message_struct {
+  int recipients_left;
+  char *message;
+  struct message_struct *prev;
+  struct message_struct *next;
+} message_t;
+
+/* Pending delivery
+ * message - message waiting for the inbox's PID
+ * next - following delivery in the same inbox
+ */
+
+typedef struct delivery_struct {
+  message_t *message;
+  struct delivery_struct *next;
+} delivery_t;
+
+/* Inbox
+ * Deliveries for one PID in deposit order, retrieved from head and
+ * appended at tail. An inbox exists only while it holds deliveries.
+ * hash_next - next inbox in the same bucket of the index
+ */
+
+typedef struct inbox_struct {
+  int pid;
+  delivery_t *head;
+  delivery_t *tail;
+  struct inbox_struct *hash_next;
+} inbox_t;
+
+/* Mailbox
+ * number_of_messages - current number of messages in the mailbox (limit is 16)
+ * head - pointer to head of message linked list
+ * inboxes - index of the inboxes by PID
+ */
+
+typedef struct {
+  int number_of_messages;
+  message_t *head;
+  inbox_t *inboxes[INBOX_BUCKETS];
+} mailbox_t;
+
+int create_mailbox();
+int print_pool_stats();
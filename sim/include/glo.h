@@ -0,0 +1,17 @@
+/* Host stand-in for PM's glo.h. */
+
+#ifndef _SIM_GLO_H
+#define _SIM_GLO_H
+
+#include <minix/ipc.h>
+
+struct mproc;
+
+extern struct mproc *mp; /* process slot of the current caller */
+extern int who_p, who_e; /* caller's slot number and endpoint */
+extern int call_nr;      /* system call number */
+extern message m_in;     /* the incoming message itself */
+
+extern int (*const call_vec[])(void);
+
+#endif
@@ -0,0 +1,33 @@
+/* Host stand-in for MINIX <lib.h>.
+ *
+ * Besides the message type and _syscall(), this redirects the libc calls
+ * mailboxlib.h uses to identify its caller (getuid, geteuid, getpwnam) to
+ * the simulated client bound to the calling thread, and routes printf()
+ * through sim_printf() so handler chatter can be silenced when measuring.
+ */
+
+#ifndef _SIM_LIB_H
+#define _SIM_LIB_H
+
+#include <stdio.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <minix/ipc.h>
+#include <minix/callnr.h>
+
+#define PM_PROC_NR ((endpoint_t)0)
+
+int _syscall(endpoint_t who, int syscallnr, message *msgptr);
+
+uid_t sim_getuid(void);
+uid_t sim_geteuid(void);
+struct passwd *sim_getpwnam(const char *name);
+int sim_printf(const char *fmt, ...);
+
+#define getuid sim_getuid
+#define geteuid sim_geteuid
+#define getpwnam sim_getpwnam
+#define printf sim_printf
+
+#endif
@@ -0,0 +1,5 @@
+/* Host stand-in for <minix/callnr.h>: picks up the callnr.h of the
+ * mailbox variant being built, which is on the include path.
+ */
+
+#include <callnr.h>
@@ -0,0 +1,10 @@
+/* Host stand-in for <minix/com.h>. The mailbox handlers need nothing from
+ * it beyond SELF, which the harness defines in <minix/syslib.h>.
+ */
+
+#ifndef _SIM_MINIX_COM_H
+#define _SIM_MINIX_COM_H
+
+#include <minix/syslib.h>
+
+#endif
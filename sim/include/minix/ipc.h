@@ -0,0 +1,51 @@
+/* Host stand-in for <minix/ipc.h>.
+ *
+ * Only the pieces of the MINIX message ABI that the mailbox handlers and
+ * mailboxlib.h touch are modelled: endpoints, the fixed-size message with
+ * its m1 and raw byte layouts, and the field accessor macros.
+ */
+
+#ifndef _SIM_MINIX_IPC_H
+#define _SIM_MINIX_IPC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef int endpoint_t;
+typedef uintptr_t vir_bytes;
+typedef uintptr_t phys_bytes;
+
+/* Payload bytes in a message, as on MINIX 3.4 */
+#define SIM_MSG_PAYLOAD 56
+
+typedef struct {
+  int m1i1, m1i2, m1i3;
+  char *m1p1, *m1p2, *m1p3, *m1p4;
+  uint64_t m1ull1;
+} mess_1;
+
+typedef struct {
+  uint8_t data[SIM_MSG_PAYLOAD];
+} mess_u8;
+
+typedef struct {
+  endpoint_t m_source;
+  int m_type;
+  union {
+    mess_1 m_m1;
+    mess_u8 m_u8;
+    uint8_t size[SIM_MSG_PAYLOAD];
+  } m_u;
+} message;
+
+#define m1_i1 m_u.m_m1.m1i1
+#define m1_i2 m_u.m_m1.m1i2
+#define m1_i3 m_u.m_m1.m1i3
+#define m1_p1 m_u.m_m1.m1p1
+#define m1_p2 m_u.m_m1.m1p2
+#define m1_p3 m_u.m_m1.m1p3
+#define m1_p4 m_u.m_m1.m1p4
+#define m1_ull1 m_u.m_m1.m1ull1
+#define m_u8 m_u.m_u8
+
+#endif
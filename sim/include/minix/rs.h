@@ -0,0 +1,12 @@
+/* Host stand-in for <minix/rs.h>: looking up a service's endpoint by name.
+ * The harness knows only the server it simulates.
+ */
+
+#ifndef _SIM_MINIX_RS_H
+#define _SIM_MINIX_RS_H
+
+#include <minix/ipc.h>
+
+int minix_rs_lookup(const char *name, endpoint_t *value);
+
+#endif
@@ -0,0 +1,26 @@
+/* Host stand-in for <minix/syslib.h>.
+ *
+ * sys_datacopy() is a plain memcpy() between simulated address spaces,
+ * which all live in the harness process.
+ */
+
+#ifndef _SIM_MINIX_SYSLIB_H
+#define _SIM_MINIX_SYSLIB_H
+
+#include <minix/ipc.h>
+
+#define OK 0
+#define SELF ((endpoint_t)0x8ace)
+
+/* Handler results meaning "do not reply now": SUSPEND in PM, EDONTREPLY
+ * (from <errno.h> on MINIX) in other services */
+#define SUSPEND (-998)
+#define EDONTREPLY (-999)
+
+/* The calling server's own endpoint (<minix/sef.h> on MINIX) */
+endpoint_t sef_self(void);
+
+int sys_datacopy(endpoint_t src_proc, vir_bytes src_vir, endpoint_t dst_proc,
+                 vir_bytes dst_vir, phys_bytes bytes);
+
+#endif
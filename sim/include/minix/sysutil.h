@@ -0,0 +1,19 @@
+/* Host stand-in for <minix/sysutil.h>: the uptime clock.
+ *
+ * Ticks count from the first call at sys_hz() per second, like the
+ * CLOCK task's uptime on MINIX.
+ */
+
+#ifndef _SIM_MINIX_SYSUTIL_H
+#define _SIM_MINIX_SYSUTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Clock ticks per second */
+#define SIM_HZ 60
+
+clock_t getticks(void);
+uint32_t sys_hz(void);
+
+#endif
@@ -0,0 +1,26 @@
+/* Host stand-in for <minix/timers.h>. */
+
+#ifndef _SIM_MINIX_TIMERS_H
+#define _SIM_MINIX_TIMERS_H
+
+#include <time.h>
+
+typedef void (*tmr_func_t)(int arg);
+
+typedef struct minix_timer {
+  struct minix_timer *tmr_next;
+  clock_t tmr_exp_time;
+  tmr_func_t tmr_func;
+  int tmr_arg;
+} minix_timer_t;
+
+#define TMR_NEVER ((clock_t)-1)
+
+/* libtimers as PM and the mailbox service use it. Watchdogs run with the
+ * server lock held, as if the server had received the CLOCK notification
+ * for their expiry time. */
+void init_timer(minix_timer_t *tp);
+void set_timer(minix_timer_t *tp, clock_t ticks, tmr_func_t watchdog, int arg);
+void cancel_timer(minix_timer_t *tp);
+
+#endif
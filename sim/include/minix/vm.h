@@ -0,0 +1,21 @@
+/* Host stand-in for <minix/vm.h>: mapping a server's pages into a client.
+ *
+ * Clients live in the harness process along with the server, so a remap
+ * hands back the server's own address and an unmap has nothing to undo.
+ * Exits of watched clients are queued by sim_exit() for vm_query_exit().
+ */
+
+#ifndef _SIM_MINIX_VM_H
+#define _SIM_MINIX_VM_H
+
+#include <stddef.h>
+#include <minix/ipc.h>
+
+void *vm_remap(endpoint_t d, endpoint_t s, void *da, void *sa, size_t size);
+void *vm_remap_ro(endpoint_t d, endpoint_t s, void *da, void *sa,
+                  size_t size);
+int vm_unmap(endpoint_t endpt, void *addr);
+int vm_watch_exit(endpoint_t ep);
+int vm_query_exit(endpoint_t *endpt);
+
+#endif
@@ -0,0 +1,26 @@
+/* Host stand-in for PM's mproc.h: just the process slot fields the
+ * mailbox handlers and the harness use.
+ */
+
+#ifndef _SIM_MPROC_H
+#define _SIM_MPROC_H
+
+#include <minix/ipc.h>
+
+#define NR_PROCS 256
+
+/* Flag values */
+#define IN_USE 0x00001 /* set when 'mproc' slot in use */
+
+struct mproc {
+  endpoint_t mp_endpoint;
+  pid_t mp_pid;
+  uid_t mp_realuid;
+  uid_t mp_effuid;
+  unsigned mp_flags;
+  message mp_reply;
+};
+
+extern struct mproc mproc[NR_PROCS];
+
+#endif
@@ -0,0 +1,20 @@
+/* Host stand-in for PM's pm.h: everything table.c and proto.h expect to
+ * be in scope.
+ */
+
+#ifndef _SIM_PM_H
+#define _SIM_PM_H
+
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+#include <minix/ipc.h>
+#include <minix/syslib.h>
+#include <minix/sysutil.h>
+#include <minix/timers.h>
+
+#include "proto.h"
+#include "glo.h"
+
+#endif
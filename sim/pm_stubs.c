@@ -0,0 +1,47 @@
+/**
+ * @file pm_stubs.c
+ * @brief Non-mailbox PM calls referenced by table.c.
+ *
+ * The harness only simulates the mailbox calls; everything else in the
+ * call vector fails with ENOSYS.
+ */
+
+#include "pm.h"
+
+#define PM_STUB(name)                                                          \
+  int name(void) { return -ENOSYS; }
+
+PM_STUB(do_exit)
+PM_STUB(do_fork)
+PM_STUB(do_srv_fork)
+PM_STUB(do_wait4)
+PM_STUB(do_get)
+PM_STUB(do_set)
+PM_STUB(do_stime)
+PM_STUB(do_time)
+PM_STUB(do_getres)
+PM_STUB(do_gettime)
+PM_STUB(do_settime)
+PM_STUB(do_trace)
+PM_STUB(do_kill)
+PM_STUB(do_srv_kill)
+PM_STUB(do_exec)
+PM_STUB(do_newexec)
+PM_STUB(do_execrestart)
+PM_STUB(do_itimer)
+PM_STUB(do_getmcontext)
+PM_STUB(do_setmcontext)
+PM_STUB(do_sigaction)
+PM_STUB(do_sigsuspend)
+PM_STUB(do_sigpending)
+PM_STUB(do_sigprocmask)
+PM_STUB(do_sigreturn)
+PM_STUB(do_sysuname)
+PM_STUB(do_getsetpriority)
+PM_STUB(do_getrusage)
+PM_STUB(do_reboot)
+PM_STUB(do_svrctl)
+PM_STUB(do_sprofile)
+PM_STUB(do_getepinfo)
+PM_STUB(do_getprocnr)
+PM_STUB(do_getsysinfo)
@@ -0,0 +1,472 @@
+/**
+ * @file sim.c
+ * @brief PM stand-in that drives the mailbox handlers on the host.
+ *
+ * Variants whose callnr.h defines MAILBOX_BASE run the mailbox as a service
+ * of its own; for those the harness plays that service instead of PM.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "pm.h"
+#include "mproc.h"
+#include <lib.h>
+#include <minix/rs.h>
+#include <minix/vm.h>
+
+#include "sim.h"
+
+/* Endpoint of process slot n; kept clear of PM_PROC_NR and SELF */
+#define SIM_EP_BASE 0x100
+#define SIM_SLOT(ep) ((ep) - SIM_EP_BASE)
+
+#define SIM_MAX_PASSWD 1024
+
+/* The server the handlers belong to, its calls and its "no reply yet"
+ * result */
+#ifdef MAILBOX_BASE
+#define SIM_SERVER_EP ((endpoint_t)0x6d62)
+#define SIM_CALL_BASE MAILBOX_BASE
+#define SIM_NR_CALLS NR_MAILBOX_CALLS
+#define SIM_SUSPEND EDONTREPLY
+#else
+#define SIM_SERVER_EP PM_PROC_NR
+#define SIM_CALL_BASE PM_BASE
+#define SIM_NR_CALLS NR_PM_CALLS
+#define SIM_SUSPEND SUSPEND
+#endif
+
+/* PM globals (glo.h, mproc.h) */
+struct mproc mproc[NR_PROCS];
+struct mproc *mp;
+int who_p, who_e;
+int call_nr;
+message m_in;
+
+#ifdef MAILBOX_BASE
+/* The mailbox service fills in its replies here rather than in mp_reply */
+message m_out;
+#endif
+
+int sim_verbose;
+
+/* The PM lock: held while a handler runs, as the server handles one call at
+ * a time */
+static pthread_mutex_t pm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reply_cond = PTHREAD_COND_INITIALIZER;
+
+/* Set by reply(), cleared when the client picks the reply up */
+static int replied[NR_PROCS];
+
+/* Clients whose exit the server watches, and those that have exited since
+ * it last asked */
+static int watched[NR_PROCS];
+static endpoint_t exited[NR_PROCS];
+static int number_exited;
+static pid_t next_pid = 100;
+static struct sim_stats stats;
+
+static struct {
+  char name[32];
+  struct passwd pw;
+} passwd_db[SIM_MAX_PASSWD];
+static int passwd_count;
+
+static __thread endpoint_t sim_self = -1;
+
+/* Uptime origin, and the armed timers, earliest first */
+static struct timespec boot_time;
+static minix_timer_t *timers;
+static pthread_cond_t timer_cond;
+static int clock_running;
+
+void reply(int proc_nr, int result);
+
+static void sim_init(void) {
+  static int initialized;
+
+  if (initialized) {
+    return;
+  }
+  initialized = 1;
+  sim_verbose = getenv("SIM_VERBOSE") != NULL;
+  clock_gettime(CLOCK_MONOTONIC, &boot_time);
+}
+
+/// Look up the process slot of a live client endpoint, or -1.
+static int sim_slot(endpoint_t ep) {
+  int slot = SIM_SLOT(ep);
+
+  if (slot < 0 || slot >= NR_PROCS || !(mproc[slot].mp_flags & IN_USE) ||
+      mproc[slot].mp_endpoint != ep) {
+    return -1;
+  }
+  return slot;
+}
+
+/// Slot of the client bound to the calling thread.
+static int sim_current(void) {
+  int slot = sim_slot(sim_self);
+
+  if (slot < 0) {
+    fprintf(stderr, "sim: thread is not attached to a client\n");
+    abort();
+  }
+  return slot;
+}
+
+endpoint_t sim_spawn(uid_t uid) {
+  int slot;
+
+  pthread_mutex_lock(&pm_lock);
+  sim_init();
+  for (slot = 0; slot < NR_PROCS; slot++) {
+    if (!(mproc[slot].mp_flags & IN_USE)) {
+      break;
+    }
+  }
+  if (slot == NR_PROCS) {
+    pthread_mutex_unlock(&pm_lock);
+    fprintf(stderr, "sim: process table full\n");
+    abort();
+  }
+
+  memset(&mproc[slot], 0, sizeof(mproc[slot]));
+  mproc[slot].mp_endpoint = SIM_EP_BASE + slot;
+  mproc[slot].mp_pid = next_pid++;
+  mproc[slot].mp_realuid = uid;
+  mproc[slot].mp_effuid = uid;
+  mproc[slot].mp_flags = IN_USE;
+  replied[slot] = 0;
+  watched[slot] = 0;
+  pthread_mutex_unlock(&pm_lock);
+
+  return mproc[slot].mp_endpoint;
+}
+
+void sim_exit(endpoint_t ep) {
+  int slot;
+
+  pthread_mutex_lock(&pm_lock);
+  if ((slot = sim_slot(ep)) >= 0) {
+    mproc[slot].mp_flags = 0;
+    if (watched[slot]) {
+      watched[slot] = 0;
+      exited[number_exited++] = ep;
+    }
+    // Whatever call it was blocked in never completes
+    reply(slot, -EINTR);
+  }
+#ifdef MAILBOX_BASE
+  // VM's notification of the exit
+  if (number_exited > 0) {
+    process_exits();
+    admit_senders();
+  }
+#endif
+  pthread_mutex_unlock(&pm_lock);
+}
+
+void sim_attach(endpoint_t ep) { sim_self = ep; }
+
+int sim_passwd(const char *name, uid_t uid) {
+  if (passwd_count == SIM_MAX_PASSWD ||
+      strlen(name) >= sizeof(passwd_db[0].name)) {
+    return -1;
+  }
+  strcpy(passwd_db[passwd_count].name, name);
+  passwd_db[passwd_count].pw.pw_name = passwd_db[passwd_count].name;
+  passwd_db[passwd_count].pw.pw_uid = uid;
+  passwd_count++;
+  return 0;
+}
+
+void sim_get_stats(struct sim_stats *st) {
+  pthread_mutex_lock(&pm_lock);
+  *st = stats;
+  pthread_mutex_unlock(&pm_lock);
+}
+
+void sim_reset_stats(void) {
+  pthread_mutex_lock(&pm_lock);
+  memset(&stats, 0, sizeof(stats));
+  pthread_mutex_unlock(&pm_lock);
+}
+
+/* libc stand-ins used by mailboxlib.h (see include/lib.h) */
+
+uid_t sim_getuid(void) { return mproc[sim_current()].mp_realuid; }
+
+uid_t sim_geteuid(void) { return mproc[sim_current()].mp_effuid; }
+
+struct passwd *sim_getpwnam(const char *name) {
+  int i;
+
+  for (i = 0; i < passwd_count; i++) {
+    if (strcmp(passwd_db[i].name, name) == 0) {
+      return &passwd_db[i].pw;
+    }
+  }
+  return NULL;
+}
+
+int sim_printf(const char *fmt, ...) {
+  va_list ap;
+  int r;
+
+  if (!sim_verbose) {
+    return 0;
+  }
+  va_start(ap, fmt);
+  r = vprintf(fmt, ap);
+  va_end(ap);
+  return r;
+}
+
+/* Server side */
+
+int minix_rs_lookup(const char *name, endpoint_t *value) {
+#ifdef MAILBOX_BASE
+  if (strcmp(name, "mailbox") == 0) {
+    *value = SIM_SERVER_EP;
+    return OK;
+  }
+#endif
+  return -ESRCH;
+}
+
+/// Send the reply for process slot @p proc_nr, waking its client.
+void reply(int proc_nr, int result) {
+  mproc[proc_nr].mp_reply.m_type = result;
+  replied[proc_nr] = 1;
+  pthread_cond_broadcast(&reply_cond);
+}
+
+#ifdef MAILBOX_BASE
+/// The mailbox service's reply to @p who; dropped if the client has exited.
+void mailbox_reply(endpoint_t who, int result) {
+  int slot = sim_slot(who);
+
+  if (slot >= 0) {
+    reply(slot, result);
+  }
+}
+#endif
+
+int sys_datacopy(endpoint_t src_proc, vir_bytes src_vir, endpoint_t dst_proc,
+                 vir_bytes dst_vir, phys_bytes bytes) {
+  if ((src_proc != SELF && sim_slot(src_proc) < 0) ||
+      (dst_proc != SELF && sim_slot(dst_proc) < 0)) {
+    return -EINVAL;
+  }
+  // Address 0 stands for one the client has not mapped
+  if ((src_proc != SELF && src_vir == 0) ||
+      (dst_proc != SELF && dst_vir == 0)) {
+    return -EFAULT;
+  }
+
+  memcpy((void *)dst_vir, (const void *)src_vir, bytes);
+  stats.datacopies++;
+  stats.datacopy_bytes += bytes;
+  return OK;
+}
+
+endpoint_t sef_self(void) { return SIM_SERVER_EP; }
+
+void *vm_remap(endpoint_t d, endpoint_t s, void *da, void *sa, size_t size) {
+  if (sim_slot(d) < 0 || s != SIM_SERVER_EP) {
+    return MAP_FAILED;
+  }
+  stats.remaps++;
+  return sa;
+}
+
+void *vm_remap_ro(endpoint_t d, endpoint_t s, void *da, void *sa,
+                  size_t size) {
+  return vm_remap(d, s, da, sa, size);
+}
+
+int vm_unmap(endpoint_t endpt, void *addr) {
+  stats.unmaps++;
+  return OK;
+}
+
+int vm_watch_exit(endpoint_t ep) {
+  int slot = sim_slot(ep);
+
+  if (slot < 0) {
+    return -EINVAL;
+  }
+  watched[slot] = 1;
+  return OK;
+}
+
+/// Hand out one exited endpoint; 1 if more are left, 0 if not.
+int vm_query_exit(endpoint_t *endpt) {
+  if (number_exited == 0) {
+    return -ESRCH;
+  }
+  *endpt = exited[--number_exited];
+  return number_exited > 0;
+}
+
+/* Clock and timers */
+
+clock_t getticks(void) {
+  struct timespec now;
+  int64_t ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ns = (int64_t)(now.tv_sec - boot_time.tv_sec) * 1000000000 +
+       (now.tv_nsec - boot_time.tv_nsec);
+  return (clock_t)(ns * SIM_HZ / 1000000000);
+}
+
+uint32_t sys_hz(void) { return SIM_HZ; }
+
+/// CLOCK_MONOTONIC time at which uptime reaches @p ticks.
+static struct timespec tick_time(clock_t ticks) {
+  struct timespec t = boot_time;
+  int64_t ns = (int64_t)ticks * 1000000000 / SIM_HZ + t.tv_nsec;
+
+  t.tv_sec += ns / 1000000000;
+  t.tv_nsec = ns % 1000000000;
+  return t;
+}
+
+/// Stand-in for the CLOCK task: run watchdogs as their timers expire.
+static void *clock_task(void *arg) {
+  minix_timer_t *tp;
+
+  pthread_mutex_lock(&pm_lock);
+  for (;;) {
+    if (timers == NULL) {
+      pthread_cond_wait(&timer_cond, &pm_lock);
+      continue;
+    }
+    if (timers->tmr_exp_time > getticks()) {
+      struct timespec until = tick_time(timers->tmr_exp_time);
+      pthread_cond_timedwait(&timer_cond, &pm_lock, &until);
+      continue;
+    }
+    tp = timers;
+    timers = tp->tmr_next;
+    tp->tmr_exp_time = TMR_NEVER;
+    tp->tmr_func(tp->tmr_arg);
+  }
+  return NULL;
+}
+
+void init_timer(minix_timer_t *tp) {
+  tp->tmr_next = NULL;
+  tp->tmr_exp_time = TMR_NEVER;
+  tp->tmr_func = NULL;
+}
+
+void set_timer(minix_timer_t *tp, clock_t ticks, tmr_func_t watchdog,
+               int arg) {
+  minix_timer_t **at;
+
+  if (!clock_running) {
+    pthread_condattr_t attr;
+    pthread_t thread;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_create(&thread, NULL, clock_task, NULL);
+    pthread_detach(thread);
+    clock_running = 1;
+  }
+
+  cancel_timer(tp);
+  tp->tmr_exp_time = getticks() + ticks;
+  tp->tmr_func = watchdog;
+  tp->tmr_arg = arg;
+  for (at = &timers; *at != NULL && (*at)->tmr_exp_time <= tp->tmr_exp_time;
+       at = &(*at)->tmr_next) {
+  }
+  tp->tmr_next = *at;
+  *at = tp;
+  pthread_cond_signal(&timer_cond);
+}
+
+void cancel_timer(minix_timer_t *tp) {
+  minix_timer_t **at;
+
+  if (tp->tmr_exp_time == TMR_NEVER) {
+    return;
+  }
+  for (at = &timers; *at != NULL; at = &(*at)->tmr_next) {
+    if (*at == tp) {
+      *at = tp->tmr_next;
+      break;
+    }
+  }
+  tp->tmr_exp_time = TMR_NEVER;
+}
+
+/* Client side: the sendrec() to the server and its receive/dispatch/reply */
+int _syscall(endpoint_t who, int syscallnr, message *msgptr) {
+  int slot = sim_current();
+  int index = syscallnr - SIM_CALL_BASE;
+  int result;
+
+  if (who != SIM_SERVER_EP) {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  pthread_mutex_lock(&pm_lock);
+  msgptr->m_type = syscallnr;
+  msgptr->m_source = mproc[slot].mp_endpoint;
+
+  m_in = *msgptr;
+  who_e = m_in.m_source;
+  who_p = slot;
+  mp = &mproc[slot];
+  call_nr = syscallnr;
+  memset(&mp->mp_reply, 0, sizeof(mp->mp_reply));
+#ifdef MAILBOX_BASE
+  memset(&m_out, 0, sizeof(m_out));
+#endif
+  replied[slot] = 0;
+  stats.calls++;
+
+  if (index >= 0 && index < SIM_NR_CALLS && call_vec[index] != NULL) {
+    result = (*call_vec[index])();
+  } else {
+    result = -ENOSYS;
+  }
+
+  if (result != SIM_SUSPEND) {
+#ifdef MAILBOX_BASE
+    mp->mp_reply = m_out;
+#endif
+    reply(who_p, result);
+  } else {
+    stats.suspends++;
+  }
+#ifdef MAILBOX_BASE
+  admit_senders();
+#endif
+
+  while (!replied[slot]) {
+    pthread_cond_wait(&reply_cond, &pm_lock);
+  }
+  *msgptr = mproc[slot].mp_reply;
+  pthread_mutex_unlock(&pm_lock);
+
+  if (msgptr->m_type < 0) {
+    errno = -msgptr->m_type;
+    return -1;
+  }
+  return msgptr->m_type;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file sim.h
+ * @brief Host simulation harness for the mailbox handlers.
+ *
+ * The harness stands in for the process manager, or for the mailbox
+ * service where a variant runs the mailbox outside PM: it owns the process
+ * table, m_in, who_e and the other server globals, dispatches _syscall()
+ * through the real table.c, and implements sys_datacopy() as a memcpy and
+ * vm_remap() as handing back the address it is given.
+ * Each simulated client is a process slot with its own endpoint and UID;
+ * a thread binds itself to a client with sim_attach() and then calls the
+ * unmodified mailboxlib.h functions.
+ *
+ * Calls are serialized, just like in the single-threaded server, so any
+ * number of threads may drive the harness at once.
+ */
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <minix/ipc.h>
+#include <sys/types.h>
+
+/** Counters kept by the harness */
+struct sim_stats {
+  unsigned long calls;          /**< requests dispatched to the server */
+  unsigned long datacopies;     /**< sys_datacopy() calls */
+  unsigned long datacopy_bytes; /**< bytes moved by sys_datacopy() */
+  unsigned long suspends;       /**< requests left without a reply */
+  unsigned long remaps;         /**< vm_remap() calls */
+  unsigned long unmaps;         /**< vm_unmap() calls */
+};
+
+/** Print handler output when non-zero (also set by SIM_VERBOSE) */
+extern int sim_verbose;
+
+/// Create a simulated client process running as @p uid.
+endpoint_t sim_spawn(uid_t uid);
+
+/// Release the process slot of a simulated client. A call it is blocked in
+/// fails with EINTR, and the server is told of the exit if it watches it.
+void sim_exit(endpoint_t ep);
+
+/// Make the calling thread act as client @p ep.
+void sim_attach(endpoint_t ep);
+
+/// Add a password entry so getpwnam() can resolve @p name.
+int sim_passwd(const char *name, uid_t uid);
+
+/// Take a snapshot of the harness counters.
+void sim_get_stats(struct sim_stats *st);
+
+/// Zero the harness counters.
+void sim_reset_stats(void);
+
+#endif
@@ -0,0 +1,130 @@
+/* ================================================= *
+ *   Host regression test for the mailbox IPC        *
+ * ================================================= */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mailboxlib.h>
+
+#include "sim.h"
+
+/* MAX_MESSAGE_COUNT of the PM side */
+#define MAILBOX_CAPACITY 16
+
+static int failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,        \
+              #cond);                                                          \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+int main(int argc, char *argv[]) {
+  char buf[MAX_MESSAGE_LEN];
+  char big[MAX_MESSAGE_LEN + 1];
+  int both[2] = {2001, 2002};
+  int one[1] = {2001};
+  int many[MAX_RECIPIENTS + 1];
+  int i;
+
+  sim_attach(sim_spawn(1000));
+
+  /* Nothing there before the first deposit */
+  CHECK(receive_message(buf, sizeof(buf), 2001) == ERROR);
+
+  CHECK(send_message("first", strlen("first"), both, 2) == OK);
+  CHECK(send_message("second", strlen("second"), one, 1) == OK);
+
+  /* A receiver gets its messages in deposit order, once each */
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message(buf, sizeof(buf), 2001) == OK);
+  CHECK(strcmp(buf, "first") == 0);
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message(buf, sizeof(buf), 2001) == OK);
+  CHECK(strcmp(buf, "second") == 0);
+  CHECK(receive_message(buf, sizeof(buf), 2001) == ERROR);
+
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message(buf, sizeof(buf), 2002) == OK);
+  CHECK(strcmp(buf, "first") == 0);
+  CHECK(receive_message(buf, sizeof(buf), 2002) == ERROR);
+
+  /* Undersized receive buffers and oversized messages are refused */
+  CHECK(send_message("short", strlen("short"), one, 1) == OK);
+  CHECK(receive_message(buf, 16, 2001) == ERROR);
+  CHECK(receive_message(buf, sizeof(buf), 2001) == OK);
+
+  memset(big, 'x', MAX_MESSAGE_LEN);
+  big[MAX_MESSAGE_LEN] = '\0';
+  CHECK(send_message(big, MAX_MESSAGE_LEN, one, 1) == ERROR);
+
+  /* A deposit whose message or recipients cannot be copied in queues
+   * nothing */
+  CHECK(send_message("lost", strlen("lost"), NULL, 1) == ERROR);
+  CHECK(send_message(NULL, 4, one, 1) == ERROR);
+  CHECK(receive_message(buf, sizeof(buf), 2001) == ERROR);
+
+  /* Recipients come in any order; repeated PIDs get the message once */
+  for (i = 0; i < MAX_RECIPIENTS; i++) {
+    many[i] = 3000 + (i * 37) % MAX_RECIPIENTS;
+  }
+  many[1] = many[0];
+  CHECK(send_message("multi", strlen("multi"), many, MAX_RECIPIENTS) == OK);
+  for (i = 0; i < MAX_RECIPIENTS; i++) {
+    int expected = i != (37 % MAX_RECIPIENTS);
+
+    memset(buf, 0, sizeof(buf));
+    CHECK((receive_message(buf, sizeof(buf), 3000 + i) == OK) == expected);
+    CHECK(!expected || strcmp(buf, "multi") == 0);
+    CHECK(receive_message(buf, sizeof(buf), 3000 + i) == ERROR);
+  }
+  many[MAX_RECIPIENTS] = 3000;
+  CHECK(send_message("multi", strlen("multi"), many, MAX_RECIPIENTS + 1) ==
+        ERROR);
+  CHECK(send_message("multi", strlen("multi"), many, 0) == ERROR);
+
+  /* Each PID reads its own queue in deposit order, whatever else is
+   * pending; the mailbox still holds MAILBOX_CAPACITY messages */
+  for (i = 0; i < MAILBOX_CAPACITY; i++) {
+    char text[16];
+    int pair[2] = {4000, 4001 + i};
+
+    snprintf(text, sizeof(text), "m%d", i);
+    CHECK(send_message(text, strlen(text), pair, 2) == OK);
+  }
+  CHECK(send_message("over", strlen("over"), one, 1) == ERROR);
+  for (i = MAILBOX_CAPACITY - 1; i >= 0; i--) {
+    char text[16];
+
+    snprintf(text, sizeof(text), "m%d", i);
+    memset(buf, 0, sizeof(buf));
+    CHECK(receive_message(buf, sizeof(buf), 4001 + i) == OK);
+    CHECK(strcmp(buf, text) == 0);
+  }
+  for (i = 0; i < MAILBOX_CAPACITY; i++) {
+    char text[16];
+
+    snprintf(text, sizeof(text), "m%d", i);
+    memset(buf, 0, sizeof(buf));
+    CHECK(receive_message(buf, sizeof(buf), 4000) == OK);
+    CHECK(strcmp(buf, text) == 0);
+  }
+  CHECK(receive_message(buf, sizeof(buf), 4000) == ERROR);
+
+  /* Fully delivered messages are collected, so the mailbox never fills */
+  for (i = 0; i < 64; i++) {
+    CHECK(send_message("loop", strlen("loop"), one, 1) == OK);
+    CHECK(receive_message(buf, sizeof(buf), 2001) == OK);
+  }
+
+  if (failures) {
+    fprintf(stderr, "test_ipc: %d check(s) failed\n", failures);
+    return 1;
+  }
+  fprintf(stderr, "test_ipc: all checks passed\n");
+  return 0;
+}
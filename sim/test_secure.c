@@ -0,0 +1,1000 @@
+/* ================================================= *
+ *   Host regression test for the secure mailbox     *
+ * ================================================= */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mailboxlib.h>
+
+#include "sim.h"
+
+#define SECURE_MAILBOX 0
+#define PUBLIC_MAILBOX 1
+
+#define MAILBOX_CAPACITY DEFAULT_MAILBOX_CAPACITY
+
+static int failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,        \
+              #cond);                                                          \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+/* Issue a user administration call for a UID without a passwd entry */
+static int user_call(int call, int uid, int privileges) {
+  message m;
+  m.m1_i1 = uid;
+  m.m1_i2 = privileges;
+  m.m1_i3 = geteuid();
+  return (mailbox_syscall(call, &m));
+}
+
+/* A client blocked in receive_message_wait() or receive_message_timeout()
+ * on its own thread */
+struct waiter {
+  endpoint_t ep;
+  int timeout_ms;
+  pthread_t thread;
+  int status;
+  char buf[MAX_MESSAGE_LEN];
+};
+
+static void *wait_for_message(void *arg) {
+  struct waiter *w = arg;
+
+  sim_attach(w->ep);
+  if (w->timeout_ms > 0) {
+    w->status = receive_message_timeout(w->buf, sizeof(w->buf), w->timeout_ms);
+  } else {
+    w->status = receive_message_wait(w->buf, sizeof(w->buf));
+  }
+  return NULL;
+}
+
+/* A client blocked in send_message_wait() on its own thread */
+struct sender {
+  endpoint_t ep;
+  char *mailbox, *body;
+  pthread_t thread;
+  int status;
+};
+
+static void *wait_for_room(void *arg) {
+  struct sender *s = arg;
+
+  sim_attach(s->ep);
+  s->status = send_message_wait(s->mailbox, "queued", s->body);
+  return NULL;
+}
+
+/// Start @p s sending and return once the service has suspended it.
+static void start_sender(struct sender *s, endpoint_t ep, char *mailbox,
+                         char *body) {
+  struct sim_stats before, now;
+
+  sim_get_stats(&before);
+  s->ep = ep;
+  s->mailbox = mailbox;
+  s->body = body;
+  s->status = 1;
+  pthread_create(&s->thread, NULL, wait_for_room, s);
+  do {
+    sched_yield();
+    sim_get_stats(&now);
+  } while (now.suspends == before.suspends);
+}
+
+/// Start @p w waiting and return once the service has suspended it.
+static void start_waiter(struct waiter *w, endpoint_t ep, int timeout_ms) {
+  struct sim_stats before, now;
+
+  sim_get_stats(&before);
+  w->ep = ep;
+  w->timeout_ms = timeout_ms;
+  w->status = 1;
+  w->buf[0] = '\0';
+  pthread_create(&w->thread, NULL, wait_for_message, w);
+  do {
+    sched_yield();
+    sim_get_stats(&now);
+  } while (now.suspends == before.suspends);
+}
+
+int main(int argc, char *argv[]) {
+  char buf[MAX_MESSAGE_LEN];
+  char name[32];
+  static char acl[32768];
+  endpoint_t root, alice, bob, carol;
+  int i;
+
+  sim_passwd("root", 0);
+  sim_passwd("alice", 1000);
+  sim_passwd("bob", 1001);
+  sim_passwd("carol", 1002);
+
+  root = sim_spawn(0);
+  alice = sim_spawn(1000);
+  bob = sim_spawn(1001);
+  carol = sim_spawn(1002);
+
+  /* Only the superuser registers users */
+  sim_attach(alice);
+  CHECK(add_user("bob", 0b1011) == ERROR);
+
+  sim_attach(root);
+  CHECK(add_user("alice", 0b1011) == OK);
+  CHECK(add_user("bob", 0b1011) == OK);
+  CHECK(add_user("carol", 0b1011) == OK);
+  CHECK(add_user("alice", 0b1011) == ERROR);
+  CHECK(add_user("nobody", 0b1011) == ERROR);
+
+  /* Grow the user registry well past its initial size, then remove
+   * every other user so deletions have to repair probe sequences */
+  for (i = 0; i < 5000; i++) {
+    CHECK(user_call(MAILBOX_ADD_USER, 50000 + i, 0b1011) == OK);
+  }
+  for (i = 0; i < 5000; i += 2) {
+    CHECK(user_call(MAILBOX_REMOVE_USER, 50000 + i, 0) == OK);
+  }
+  for (i = 0; i < 5000; i++) {
+    CHECK(user_call(MAILBOX_UPDATE_PRIVILEGES, 50000 + i, 0b1011) ==
+          (i % 2 ? OK : ERROR));
+  }
+  CHECK(user_call(MAILBOX_UPDATE_PRIVILEGES, 1000, 0b1011) == OK);
+
+  /* alice owns a secure mailbox: alice sends, bob receives */
+  sim_attach(alice);
+  CHECK(add_mailbox(SECURE_MAILBOX, "inbox", "1000", "1001") == OK);
+  CHECK(add_mailbox(SECURE_MAILBOX, "inbox", "1000", "1001") == ERROR);
+  CHECK(send_message("inbox", "greeting", "hello bob") == OK);
+  CHECK(send_message("nowhere", "greeting", "hello bob") == ERROR);
+
+  sim_attach(carol);
+  CHECK(send_message("inbox", "spam", "not allowed") == ERROR);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+
+  sim_attach(bob);
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "hello bob") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+
+  /* Public mailbox: everyone but the denied UIDs */
+  sim_attach(alice);
+  CHECK(add_mailbox(PUBLIC_MAILBOX, "news", "1001", "1002") == OK);
+  CHECK(send_message("news", "headline", "extra") == OK);
+
+  sim_attach(bob);
+  CHECK(send_message("news", "headline", "denied") == ERROR);
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "extra") == 0);
+
+  sim_attach(carol);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+
+  /* Public mail is read off one log for all readers, in deposit order with
+   * their other mail; a reader blocked for mail is woken by it unless
+   * denied */
+  struct waiter reader, denied;
+  sim_attach(alice);
+  CHECK(send_message("news", "headline", "public one") == OK);
+  CHECK(send_message("inbox", "greeting", "secure") == OK);
+  CHECK(send_message("news", "headline", "public two") == OK);
+  sim_attach(bob);
+  CHECK(probe_message() == (int)strlen("public one") + 1);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "public one") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "secure") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "public two") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+  start_waiter(&reader, sim_spawn(1001), 0);
+  start_waiter(&denied, sim_spawn(1002), 20);
+  sim_attach(alice);
+  CHECK(send_message("news", "headline", "wake up") == OK);
+  pthread_join(reader.thread, NULL);
+  pthread_join(denied.thread, NULL);
+  CHECK(reader.status == OK && strcmp(reader.buf, "wake up") == 0);
+  CHECK(denied.status == ERROR);
+  sim_exit(reader.ep);
+  sim_exit(denied.ep);
+
+  /* Enough mailboxes to grow the name index several times */
+  sim_attach(alice);
+  for (i = 0; i < 200; i++) {
+    snprintf(name, sizeof(name), "box%d", i);
+    CHECK(add_mailbox(PUBLIC_MAILBOX, name, "", "") == OK);
+  }
+  for (i = 0; i < 200; i += 2) {
+    snprintf(name, sizeof(name), "box%d", i);
+    CHECK(remove_mailbox(name) == OK);
+  }
+  CHECK(send_message("box0", "gone", "gone") == ERROR);
+  CHECK(send_message("box199", "last", "last") == OK);
+  CHECK(send_message("inbox", "again", "still indexed") == OK);
+
+  /* Large access lists given unsorted, with duplicates and unknown UIDs */
+  acl[0] = '\0';
+  for (i = 4999; i >= 1; i -= 2) {
+    snprintf(name, sizeof(name), "%d %d ", 50000 + i, 50000 + i);
+    strcat(acl, name);
+  }
+  strcat(acl, "1000 99999");
+  CHECK(add_mailbox(SECURE_MAILBOX, "crowd", acl, acl) == OK);
+
+  /* The same given as UID arrays */
+  static int uids[2 * 5000];
+  message m;
+  for (i = 0; i < 5000; i++) {
+    uids[2 * i] = uids[2 * i + 1] = 54999 - i;
+  }
+  CHECK(add_mailbox_uids(SECURE_MAILBOX, "crowd2", uids, 10000, uids,
+                         10000) == OK);
+  CHECK(add_mailbox_uids(SECURE_MAILBOX, "crowd2", uids, 1, uids, 1) ==
+        ERROR);
+  CHECK(remove_mailbox("crowd2") == OK);
+
+  /* A request whose size disagrees with its header is refused */
+  mailbox_request_t request = {SECURE_MAILBOX, 0, 0, 8, 1, 1};
+  m.m1_i1 = 1000;
+  m.m1_i2 = sizeof(request);
+  m.m1_p1 = (char *)&request;
+  CHECK(mailbox_syscall(MAILBOX_ADD_MAILBOX, &m) == ERROR);
+  CHECK(send_message("crowd", "hi", "hi crowd") == OK);
+  sim_attach(bob);
+  CHECK(send_message("crowd", "hi", "not yet") == ERROR);
+
+  /* Grant and revoke bob's send access */
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1000) == OK);
+  sim_attach(alice);
+  CHECK(add_sender("crowd", "bob") == OK);
+  CHECK(add_sender("crowd", "bob") == ERROR);
+  sim_attach(bob);
+  CHECK(send_message("crowd", "hi", "now allowed") == OK);
+  sim_attach(alice);
+  CHECK(remove_sender("crowd", "bob") == OK);
+  CHECK(remove_sender("crowd", "bob") == ERROR);
+  CHECK(remove_receiver("crowd", "alice") == OK);
+  CHECK(remove_receiver("crowd", "alice") == ERROR);
+  sim_attach(bob);
+  CHECK(send_message("crowd", "hi", "revoked") == ERROR);
+
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1011) == OK);
+
+  /* Readers get their queued messages oldest first across mailboxes, and
+   * lose them when their access or the mailbox goes away */
+  sim_attach(bob);
+  while (receive_message(buf, sizeof(buf)) == OK) {
+  }
+  sim_attach(carol);
+  while (receive_message(buf, sizeof(buf)) == OK) {
+  }
+  sim_attach(alice);
+  CHECK(add_mailbox(SECURE_MAILBOX, "first", "1000", "1001 1002") == OK);
+  CHECK(add_mailbox(SECURE_MAILBOX, "second", "1000", "1001 1002") == OK);
+  CHECK(send_message("second", "s", "one") == OK);
+  CHECK(send_message("first", "s", "two") == OK);
+  CHECK(send_message("second", "s", "three") == OK);
+  CHECK(send_message("first", "s", "four") == OK);
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1000) == OK);
+  sim_attach(alice);
+  CHECK(remove_receiver("second", "carol") == OK);
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1011) == OK);
+
+  sim_attach(bob);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "one") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "two") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "three") == 0);
+  sim_attach(carol);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "two") == 0);
+  sim_attach(alice);
+  CHECK(remove_mailbox("first") == OK);
+  sim_attach(bob);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+  sim_attach(carol);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+
+  /* A message is reclaimed once every eligible reader has it, so a mailbox
+   * with active readers never stays full */
+  sim_attach(alice);
+  CHECK(add_mailbox(SECURE_MAILBOX, "pair", "1000", "1001 1002") == OK);
+  for (i = 0; i < MAILBOX_CAPACITY; i++) {
+    CHECK(send_message("pair", "s", "fill") == OK);
+  }
+  CHECK(send_message("pair", "s", "full") == ERROR);
+  sim_attach(bob);
+  for (i = 0; i < MAILBOX_CAPACITY; i++) {
+    CHECK(receive_message(buf, sizeof(buf)) == OK);
+  }
+  sim_attach(alice);
+  CHECK(send_message("pair", "s", "carol is behind") == ERROR);
+  sim_attach(carol);
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  sim_attach(alice);
+  CHECK(send_message("pair", "s", "room for one") == OK);
+  CHECK(send_message("pair", "s", "full again") == ERROR);
+
+  /* Withdrawing the last reader reclaims the rest */
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1000) == OK);
+  sim_attach(alice);
+  CHECK(remove_receiver("pair", "carol") == OK);
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1011) == OK);
+  sim_attach(bob);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "room for one") == 0);
+  sim_attach(alice);
+  for (i = 0; i < 10 * MAILBOX_CAPACITY; i++) {
+    CHECK(send_message("pair", "s", "steady") == OK);
+    sim_attach(bob);
+    CHECK(receive_message(buf, sizeof(buf)) == OK);
+    sim_attach(alice);
+  }
+  CHECK(remove_mailbox("pair") == OK);
+  CHECK(show_mailboxes() == OK);
+
+  /* Registered users who never read a public mailbox (carol here) do not
+   * hold it up: when full, it gives its oldest message not held by a reader
+   * up to the next deposit */
+  struct sender held_up;
+  int taker, taken;
+  sim_attach(alice);
+  CHECK(add_mailbox_capacity(PUBLIC_MAILBOX | SHARED_MAILBOX, "feed", "", "",
+                             1) == OK);
+  for (i = 0; i < 10 * MAILBOX_CAPACITY; i++) {
+    snprintf(name, sizeof(name), "f%d", i);
+    CHECK(send_message("feed", "s", name) == OK);
+    sim_attach(bob);
+    CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, name) == 0);
+    sim_attach(alice);
+  }
+  CHECK(send_message("feed", "s", "missed") == OK);
+  CHECK(send_message("feed", "s", "kept") == OK);
+  sim_attach(bob);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "kept") == 0);
+  sim_attach(alice);
+  CHECK(send_message("feed", "s", "held") == OK);
+  sim_attach(bob);
+  taker = open_mailbox("feed", OPEN_RECEIVE);
+  CHECK((taken = ring_take(taker)) >= 0);
+  sim_attach(alice);
+  CHECK(send_message("feed", "s", "no room") == ERROR);
+  start_sender(&held_up, sim_spawn(1000), "feed", "let in");
+  sim_attach(bob);
+  CHECK(ring_release(taker, taken) == OK);
+  pthread_join(held_up.thread, NULL);
+  CHECK(held_up.status == OK);
+  CHECK(close_mailbox(taker) == OK);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "let in") == 0);
+  sim_attach(carol);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "let in") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+  sim_exit(held_up.ep);
+  sim_attach(alice);
+  CHECK(remove_mailbox("feed") == OK);
+
+  /* Payload slots freed out of order are reused without mixing up contents */
+  sim_attach(alice);
+  memset(acl, 'x', MAX_MAILBOX_NAME_LEN);
+  acl[MAX_MAILBOX_NAME_LEN] = '\0';
+  CHECK(add_mailbox(SECURE_MAILBOX, acl, "1000", "1001") == ERROR);
+  CHECK(add_mailbox(SECURE_MAILBOX, "slots", "1000", "1001") == OK);
+  for (i = 0; i < MAILBOX_CAPACITY; i++) {
+    snprintf(name, sizeof(name), "m%d", i);
+    CHECK(send_message("slots", name, name) == OK);
+  }
+  CHECK(delete_message("slots", "m3") == OK);
+  CHECK(delete_message("slots", "m3") == ERROR);
+  CHECK(delete_message("slots", "m7") == OK);
+  CHECK(send_message("slots", "late", "late one") == OK);
+  CHECK(send_message("slots", "late", "late two") == OK);
+  CHECK(send_message("slots", "late", "no room") == ERROR);
+  sim_attach(bob);
+  for (i = 0; i < MAILBOX_CAPACITY; i++) {
+    if (i == 3 || i == 7) {
+      continue;
+    }
+    snprintf(name, sizeof(name), "m%d", i);
+    CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, name) == 0);
+  }
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "late one") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "late two") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+
+  /* Blocked retrieves complete when a message is deposited for them; the
+   * superuser and the last counted reader both get it */
+  struct waiter root_waiter, bob_waiter, carol_waiter;
+  sim_attach(root);
+  while (receive_message(buf, sizeof(buf)) == OK) {
+  }
+  start_waiter(&root_waiter, root, 0);
+  start_waiter(&bob_waiter, bob, 0);
+  sim_attach(alice);
+  CHECK(send_message("inbox", "wake", "wake up") == OK);
+  pthread_join(root_waiter.thread, NULL);
+  pthread_join(bob_waiter.thread, NULL);
+  CHECK(root_waiter.status == OK && strcmp(root_waiter.buf, "wake up") == 0);
+  CHECK(bob_waiter.status == OK && strcmp(bob_waiter.buf, "wake up") == 0);
+  sim_attach(bob);
+  CHECK(receive_message_wait(buf, 0) == ERROR);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+
+  /* Messages for other readers leave a waiter asleep; removing its user
+   * fails the call */
+  start_waiter(&carol_waiter, carol, 0);
+  sim_attach(alice);
+  CHECK(send_message("inbox", "not carol", "for bob") == OK);
+  sim_attach(root);
+  CHECK(remove_user("carol") == OK);
+  pthread_join(carol_waiter.thread, NULL);
+  CHECK(carol_waiter.status == ERROR);
+  CHECK(add_user("carol", 0b1011) == OK);
+  sim_attach(bob);
+  CHECK(receive_message_wait(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "for bob") == 0);
+
+  /* Timed retrieves: waiters served early leave the timeout heap, the rest
+   * fail as their timeouts pass, whatever order they started in */
+  static struct waiter timed[32];
+  sim_attach(alice);
+  CHECK(add_mailbox(SECURE_MAILBOX, "timed", "1000", "1002") == OK);
+  for (i = 0; i < 32; i++) {
+    start_waiter(&timed[i], sim_spawn(1002),
+                 i < 8 ? 10000 : 10 + (i * 37) % 200);
+  }
+  sim_attach(alice);
+  for (i = 0; i < 8; i++) {
+    snprintf(name, sizeof(name), "t%d", i);
+    CHECK(send_message("timed", "t", name) == OK);
+  }
+  for (i = 0; i < 32; i++) {
+    pthread_join(timed[i].thread, NULL);
+    snprintf(name, sizeof(name), "t%d", i);
+    CHECK(i < 8 ? timed[i].status == OK && strcmp(timed[i].buf, name) == 0
+                : timed[i].status == ERROR);
+    sim_exit(timed[i].ep);
+  }
+  sim_attach(carol);
+  CHECK(receive_message_timeout(buf, sizeof(buf), 20) == ERROR);
+  sim_attach(alice);
+  CHECK(send_message("timed", "t", "queued") == OK);
+  sim_attach(carol);
+  CHECK(receive_message_timeout(buf, sizeof(buf), 20) == OK &&
+        strcmp(buf, "queued") == 0);
+
+  /* Batch retrieves hand out the oldest messages across mailboxes and stop
+   * at the batch size or the first message that does not fit */
+  static int batch[1024];
+  mail_desc_t *desc = (mail_desc_t *)batch;
+  sim_attach(alice);
+  CHECK(add_mailbox(SECURE_MAILBOX, "batch", "1000", "1002") == OK);
+  for (i = 0; i < 5; i++) {
+    snprintf(name, sizeof(name), "b%d", i);
+    CHECK(send_message(i % 2 ? "batch" : "timed", name, name) == OK);
+  }
+  sim_attach(carol);
+  CHECK(receive_messages(batch, 3 * sizeof(mail_desc_t), 3) == ERROR);
+  CHECK(receive_messages(batch, 2 * sizeof(mail_desc_t), 3) == ERROR);
+  CHECK(receive_messages(batch, sizeof(batch), 3) == 3);
+  for (i = 0; i < 3; i++) {
+    snprintf(name, sizeof(name), "b%d", i);
+    CHECK(strcmp(MAIL_FIELD(batch, desc[i].mailbox),
+                 i % 2 ? "batch" : "timed") == 0);
+    CHECK(strcmp(MAIL_FIELD(batch, desc[i].subject), name) == 0);
+    CHECK(strcmp(MAIL_FIELD(batch, desc[i].body), name) == 0);
+    CHECK(desc[i].length == (int)strlen(name) + 1);
+  }
+  CHECK(receive_messages(batch, 10 * sizeof(mail_desc_t) + 12, 10) == 1);
+  CHECK(strcmp(MAIL_FIELD(batch, desc[0].subject), "b3") == 0);
+  CHECK(receive_messages(batch, sizeof(batch), 10) == 1);
+  CHECK(strcmp(MAIL_FIELD(batch, desc[0].body), "b4") == 0);
+  CHECK(receive_messages(batch, sizeof(batch), 10) == 0);
+  CHECK(receive_messages(batch, sizeof(batch), MAX_BATCH_COUNT + 1) == ERROR);
+
+  /* Batch deposits report a status per record and go on past failures */
+  static int packed[1024];
+  mail_batch_t out;
+  int status[32];
+  sim_attach(alice);
+  CHECK(send_batch_init(&out, packed, sizeof(packed), 8) == OK);
+  CHECK(send_batch_add(&out, "batch", "s0", "v0") == OK);
+  CHECK(send_batch_add(&out, "nowhere", "s1", "v1") == OK);
+  CHECK(send_batch_add(&out, "timed", "s2", "v2") == OK);
+  CHECK(send_batch_add(&out, "batch", "s3", "v3") == OK);
+  CHECK(send_batch_add(&out, "batch", "s4", "too long") == OK);
+  ((mail_desc_t *)packed)[4].length = MAX_MESSAGE_LEN + 1;
+  CHECK(send_messages(&out, status) == 3);
+  CHECK(status[0] == OK && status[1] == ERROR && status[2] == OK &&
+        status[3] == OK && status[4] == ERROR);
+  sim_attach(carol);
+  CHECK(receive_messages(batch, sizeof(batch), 10) == 3);
+  CHECK(strcmp(MAIL_FIELD(batch, desc[0].body), "v0") == 0);
+  CHECK(strcmp(MAIL_FIELD(batch, desc[1].mailbox), "timed") == 0);
+  CHECK(strcmp(MAIL_FIELD(batch, desc[1].subject), "s2") == 0);
+  CHECK(strcmp(MAIL_FIELD(batch, desc[2].body), "v3") == 0);
+
+  sim_attach(alice);
+  CHECK(send_batch_init(&out, packed, sizeof(packed), 20) == OK);
+  for (i = 0; i < 20; i++) {
+    CHECK(send_batch_add(&out, "batch", "s", "burst") == OK);
+  }
+  CHECK(send_batch_add(&out, "batch", "s", "one too many") == ERROR);
+  CHECK(send_messages(&out, status) == MAILBOX_CAPACITY);
+  CHECK(status[MAILBOX_CAPACITY - 1] == OK && status[MAILBOX_CAPACITY] == ERROR);
+  sim_attach(bob);
+  CHECK(send_batch_init(&out, packed, sizeof(packed), 1) == OK);
+  CHECK(send_batch_add(&out, "batch", "s", "not a sender") == OK);
+  CHECK(send_messages(&out, NULL) == 0);
+  sim_attach(carol);
+  CHECK(receive_messages(batch, sizeof(batch), MAX_BATCH_COUNT) ==
+        MAILBOX_CAPACITY);
+
+  /* Short mail travels in the request and reply messages themselves; mail
+   * that does not fit is copied as before */
+  struct sim_stats sent, received;
+  char longer[INLINE_TEXT + 1];
+  sim_attach(alice);
+  sim_get_stats(&sent);
+  CHECK(send_message("batch", "id", "42") == OK);
+  sim_attach(carol);
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "42") == 0);
+  sim_get_stats(&received);
+  CHECK(received.datacopies == sent.datacopies);
+
+  memset(longer, 'y', INLINE_TEXT);
+  longer[INLINE_TEXT] = '\0';
+  sim_attach(alice);
+  CHECK(send_message_inline("batch", "s", longer) == ERROR);
+  CHECK(send_message("batch", "s", longer) == OK);
+  sim_attach(carol);
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, longer) == 0);
+  sim_get_stats(&sent);
+  CHECK(sent.datacopies > received.datacopies);
+
+  /* Handles are opened once and used without the mailbox name; they stay
+   * with the opening process and go stale when the access they were opened
+   * for is revoked or the mailbox is removed */
+  int sender, receiver, stale;
+  sim_attach(alice);
+  CHECK(add_mailbox(SECURE_MAILBOX, "handles", "1000 1001", "1002") == OK);
+  CHECK(open_mailbox("nowhere", OPEN_SEND) == ERROR);
+  CHECK(open_mailbox("handles", OPEN_RECEIVE) == ERROR);
+  sender = open_mailbox("handles", OPEN_SEND);
+  CHECK(sender >= 0);
+  sim_attach(carol);
+  CHECK(open_mailbox("handles", OPEN_SEND | OPEN_RECEIVE) == ERROR);
+  receiver = open_mailbox("handles", OPEN_RECEIVE);
+  CHECK(receiver >= 0);
+  CHECK(send_message_handle(sender, "s", "not carol's handle") == ERROR);
+  CHECK(send_message_handle(receiver, "s", "opened to receive") == ERROR);
+  CHECK(receive_message_handle(receiver, buf, sizeof(buf)) == ERROR);
+
+  sim_attach(alice);
+  CHECK(send_message("batch", "s", "elsewhere") == OK);
+  sim_get_stats(&sent);
+  CHECK(send_message_handle(sender, "s", "by handle") == OK);
+  sim_get_stats(&received);
+  CHECK(received.datacopies == sent.datacopies + 2);
+
+  sim_attach(carol);
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message_handle(receiver, buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "by handle") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "elsewhere") == 0);
+
+  /* Receive handles on one mailbox share the reader's queue for it, which
+   * starts with whatever was already pending from the mailbox */
+  CHECK(close_mailbox(receiver) == OK);
+  sim_attach(alice);
+  CHECK(send_message_handle(sender, "s", "first") == OK);
+  CHECK(send_message("batch", "s", "other") == OK);
+  CHECK(send_message_handle(sender, "s", "second") == OK);
+  sim_attach(carol);
+  receiver = open_mailbox("handles", OPEN_RECEIVE);
+  stale = open_mailbox("handles", OPEN_RECEIVE);
+  CHECK(receiver >= 0 && stale >= 0 && stale != receiver);
+  CHECK(receive_message_handle(stale, buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "first") == 0);
+  CHECK(close_mailbox(stale) == OK);
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "other") == 0);
+  CHECK(receive_message_handle(receiver, buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "second") == 0);
+  CHECK(receive_message_handle(receiver, buf, sizeof(buf)) == ERROR);
+
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1000) == OK);
+  sim_attach(alice);
+  CHECK(remove_sender("handles", "alice") == OK);
+  CHECK(send_message_handle(sender, "s", "revoked") == ERROR);
+  CHECK(add_sender("handles", "alice") == OK);
+  CHECK(send_message_handle(sender, "s", "still stale") == ERROR);
+  stale = sender;
+  sender = open_mailbox("handles", OPEN_SEND);
+  CHECK(sender >= 0 && sender != stale);
+  CHECK(send_message_handle(stale, "s", "still stale") == ERROR);
+  CHECK(close_mailbox(sender) == OK);
+  CHECK(close_mailbox(sender) == ERROR);
+  CHECK(remove_mailbox("handles") == OK);
+  sim_attach(carol);
+  CHECK(receive_message_handle(receiver, buf, sizeof(buf)) == ERROR);
+  CHECK(close_mailbox(receiver) == ERROR);
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1011) == OK);
+
+  /* Shared mailboxes: payloads are written and read in place through the
+   * mapped slots and only slot numbers go through the service; a taken
+   * slot is not reused until released */
+  int plain, ring_sender, ring_reader, slot, slots;
+  char *ring, *view;
+  sim_attach(alice);
+  plain = open_mailbox("inbox", OPEN_SEND);
+  CHECK(ring_map(plain, &slots) == NULL);
+  CHECK(ring_claim(plain) == ERROR);
+  CHECK(close_mailbox(plain) == OK);
+
+  CHECK(add_mailbox(SECURE_MAILBOX | SHARED_MAILBOX, "ring", "1000",
+                    "1001 1002") == OK);
+  ring_sender = open_mailbox("ring", OPEN_SEND);
+  ring = ring_map(ring_sender, &slots);
+  CHECK(ring != NULL && slots == MAILBOX_CAPACITY);
+  sim_attach(bob);
+  ring_reader = open_mailbox("ring", OPEN_RECEIVE);
+  view = ring_map(ring_reader, &slots);
+  CHECK(view != NULL);
+  sim_get_stats(&sent);
+  CHECK(ring_map(ring_reader, &slots) == view);
+  sim_get_stats(&received);
+  CHECK(received.remaps == sent.remaps);
+
+  sim_attach(alice);
+  sim_get_stats(&sent);
+  slot = ring_claim(ring_sender);
+  CHECK(slot >= 0 && slot < slots);
+  CHECK(ring_claim(ring_sender) == slot);
+  strcpy(RING_BODY(ring, slot), "telemetry");
+  strcpy(RING_SUBJECT(ring, slot), "t0");
+  CHECK(ring_post(ring_sender, (slot + 1) % slots) == ERROR);
+  CHECK(ring_post(ring_sender, slot) == OK);
+  CHECK(ring_post(ring_sender, slot) == ERROR);
+
+  sim_attach(bob);
+  CHECK(ring_take(ring_reader) == slot);
+  CHECK(strcmp(RING_BODY(view, slot), "telemetry") == 0);
+  CHECK(strcmp(RING_SUBJECT(view, slot), "t0") == 0);
+  CHECK(ring_release(ring_reader, slot) == OK);
+  CHECK(ring_release(ring_reader, slot) == ERROR);
+  CHECK(ring_take(ring_reader) == ERROR);
+  sim_get_stats(&received);
+  CHECK(received.datacopies == sent.datacopies);
+
+  sim_attach(carol);
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "telemetry") == 0);
+
+  sim_attach(alice);
+  CHECK((slot = ring_claim(ring_sender)) >= 0);
+  strcpy(RING_BODY(ring, slot), "held");
+  strcpy(RING_SUBJECT(ring, slot), "t1");
+  CHECK(ring_post(ring_sender, slot) == OK);
+  sim_attach(bob);
+  CHECK(ring_take(ring_reader) == slot);
+  sim_attach(carol);
+  CHECK(receive_message(buf, sizeof(buf)) == OK);
+  CHECK(strcmp(buf, "held") == 0);
+  sim_attach(alice);
+  CHECK(ring_claim(ring_sender) != slot);
+  CHECK(strcmp(RING_BODY(view, slot), "held") == 0);
+
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1000) == OK);
+  sim_attach(alice);
+  sim_get_stats(&sent);
+  CHECK(remove_receiver("ring", "bob") == OK);
+  sim_get_stats(&received);
+  CHECK(received.unmaps == sent.unmaps + 1);
+  sim_attach(bob);
+  CHECK(ring_take(ring_reader) == ERROR);
+  sim_attach(alice);
+  plain = open_mailbox("ring", OPEN_SEND);
+  CHECK(ring_claim(plain) == slot);
+  CHECK(remove_mailbox("ring") == OK);
+  sim_get_stats(&sent);
+  CHECK(sent.unmaps == received.unmaps + 1);
+  CHECK(ring_claim(ring_sender) == ERROR);
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1011) == OK);
+
+  /* Mapped receives lend a message of a shared mailbox out in place to
+   * each of its readers, through a view of the mailbox mapped into each on
+   * its first lend and kept for the next; other mail is copied as usual */
+  char blob[512], *body;
+  int lease, other;
+  memset(blob, 'z', sizeof(blob) - 1);
+  blob[sizeof(blob) - 1] = '\0';
+  sim_attach(alice);
+  CHECK(add_mailbox(SECURE_MAILBOX | SHARED_MAILBOX, "blob", "1000",
+                    "1001 1002") == OK);
+  CHECK(send_message("blob", "config", blob) == OK);
+  sim_get_stats(&sent);
+  sim_attach(bob);
+  CHECK(receive_message_mapped(buf, sizeof(buf), &body, &lease) == OK);
+  CHECK(lease != -1 && body != buf && strcmp(body, blob) == 0);
+  sim_attach(carol);
+  CHECK(receive_message_mapped(buf, sizeof(buf), &body, &other) == OK);
+  CHECK(other != -1 && other != lease && strcmp(body, blob) == 0);
+  sim_get_stats(&received);
+  CHECK(received.datacopies == sent.datacopies);
+  CHECK(received.remaps == sent.remaps + 2);
+  CHECK(release_message(other) == OK);
+  CHECK(release_message(other) == ERROR);
+  CHECK(release_message(lease) == ERROR);
+  sim_attach(bob);
+  CHECK(release_message(lease) == OK);
+  sim_get_stats(&sent);
+  CHECK(sent.unmaps == received.unmaps);
+
+  sim_attach(alice);
+  CHECK(send_message("inbox", "plain", blob) == OK);
+  sim_attach(bob);
+  memset(buf, 0, sizeof(buf));
+  CHECK(receive_message_mapped(buf, sizeof(buf), &body, &lease) == OK);
+  CHECK(lease == -1 && body == buf && strcmp(buf, blob) == 0);
+
+  sim_attach(alice);
+  CHECK(send_message("blob", "config", blob) == OK);
+  sim_get_stats(&sent);
+  sim_attach(bob);
+  CHECK(receive_message_mapped(buf, sizeof(buf), &body, &lease) == OK);
+  CHECK(lease != -1 && strcmp(body, blob) == 0);
+  sim_get_stats(&received);
+  CHECK(received.remaps == sent.remaps);
+  sim_attach(alice);
+  CHECK(remove_mailbox("blob") == OK);
+  sim_get_stats(&sent);
+  CHECK(sent.unmaps == received.unmaps + 2);
+  sim_attach(bob);
+  CHECK(release_message(lease) == ERROR);
+  sim_attach(carol);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+
+  /* A shared mailbox made with room for larger bodies keeps them whole in
+   * its slots, and lends them out like any other; leases are not bounded
+   * by the handle table */
+  static char wide[4200];
+  int writers[] = {1000}, readers[] = {1001}, leased[20], body_size;
+  memset(wide, 'w', 2999);
+  wide[2999] = '\0';
+  sim_attach(alice);
+  CHECK(add_mailbox_slots(SECURE_MAILBOX, "wide", writers, 1, readers, 1, 0,
+                          4096) == ERROR);
+  CHECK(add_mailbox_slots(SECURE_MAILBOX | SHARED_MAILBOX, "wide", writers, 1,
+                          readers, 1, 0, MAX_LARGE_MESSAGE_LEN + 1) == ERROR);
+  CHECK(add_mailbox_slots(SECURE_MAILBOX | SHARED_MAILBOX, "wide", writers, 1,
+                          readers, 1, 24, 4096) == OK);
+  plain = open_mailbox("wide", OPEN_SEND);
+  CHECK(ring_map_sized(plain, &slots, &body_size) != NULL);
+  CHECK(slots == 24 && body_size == 4096);
+  CHECK(close_mailbox(plain) == OK);
+  CHECK(send_message("wide", "w", blob) == OK);
+  for (i = 1; i < 20; i++) {
+    CHECK(send_message("wide", "w", wide) == OK);
+  }
+  sim_get_stats(&sent);
+  sim_attach(bob);
+  CHECK(receive_message_mapped(buf, sizeof(buf), &body, &leased[0]) == OK);
+  CHECK(strcmp(body, blob) == 0);
+  for (i = 1; i < 20; i++) {
+    CHECK(receive_message_mapped(buf, sizeof(buf), &body, &leased[i]) == OK);
+    CHECK(leased[i] != -1 && strcmp(body, wide) == 0);
+  }
+  sim_get_stats(&received);
+  CHECK(received.datacopies == sent.datacopies);
+  CHECK(received.remaps == sent.remaps + 1);
+  for (i = 0; i < 20; i++) {
+    CHECK(release_message(leased[i]) == OK);
+  }
+  sim_attach(alice);
+  memset(wide, 'w', 4096);
+  wide[4096] = '\0';
+  CHECK(send_message("wide", "w", wide) == ERROR);
+  CHECK(remove_mailbox("wide") == OK);
+
+  /* Bodies past a payload slot are chained in chunks; a probe tells the
+   * reader how large a buffer to bring, and a message that does not fit
+   * stays queued */
+  static char large[3000], got[3000], huge[MAX_LARGE_MESSAGE_LEN + 1];
+  for (i = 0; i < (int)sizeof(large) - 1; i++) {
+    large[i] = 'a' + i % 26;
+  }
+  large[sizeof(large) - 1] = '\0';
+  memset(huge, 'h', sizeof(huge) - 1);
+  huge[sizeof(huge) - 1] = '\0';
+  sim_attach(alice);
+  CHECK(send_message("inbox", "huge", huge) == ERROR);
+  CHECK(send_message("inbox", "large", large) == OK);
+  sim_attach(bob);
+  CHECK(probe_message() == (int)sizeof(large));
+  CHECK(receive_message(got, sizeof(large) - 1) == ERROR);
+  CHECK(probe_message() == (int)sizeof(large));
+  CHECK(receive_message(got, sizeof(large)) == OK);
+  CHECK(strcmp(got, large) == 0);
+  CHECK(probe_message() == ERROR);
+
+  sim_attach(alice);
+  CHECK(send_message("inbox", "short", "tiny") == OK);
+  sim_attach(bob);
+  CHECK(probe_message() == 5);
+  CHECK(receive_message(got, 5) == OK && strcmp(got, "tiny") == 0);
+
+  sim_attach(alice);
+  CHECK(add_mailbox(SECURE_MAILBOX | SHARED_MAILBOX, "slotted", "1000",
+                    "1001") == OK);
+  CHECK(send_message("slotted", "large", large) == ERROR);
+  CHECK(remove_mailbox("slotted") == OK);
+  CHECK(send_message("batch", "large", large) == OK);
+  sim_attach(carol);
+  CHECK(receive_messages(batch, sizeof(batch), 10) == 1);
+  CHECK(desc[0].length == (int)sizeof(large));
+  CHECK(strcmp(MAIL_FIELD(batch, desc[0].body), large) == 0);
+
+  /* Capacity is set per mailbox out of a global budget; a full mailbox
+   * fails sends, or holds send_message_wait() until a message goes */
+  struct sender first, second;
+  endpoint_t producer = sim_spawn(1000), producer2 = sim_spawn(1000);
+  sim_attach(alice);
+  CHECK(add_mailbox_capacity(SECURE_MAILBOX, "greedy", "1000", "1001",
+                             MAILBOX_SLOT_BUDGET) == ERROR);
+  CHECK(add_mailbox_capacity(SECURE_MAILBOX, "greedy", "1000", "1001",
+                             -1) == ERROR);
+  CHECK(add_mailbox_capacity(SECURE_MAILBOX, "tight", "1000", "1001", 2) ==
+        OK);
+  CHECK(send_message("tight", "one", "first") == OK);
+  CHECK(send_message_wait("tight", "two", "second") == OK);
+  CHECK(send_message("tight", "three", "third") == ERROR);
+  start_sender(&first, producer, "tight", "waited one");
+  start_sender(&second, producer2, "tight", "waited two");
+  sim_attach(bob);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "first") == 0);
+  pthread_join(first.thread, NULL);
+  CHECK(first.status == OK && second.status == 1);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "second") == 0);
+  pthread_join(second.thread, NULL);
+  CHECK(second.status == OK);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "waited one") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == OK &&
+        strcmp(buf, "waited two") == 0);
+
+  sim_attach(alice);
+  CHECK(send_message("tight", "one", "first") == OK);
+  CHECK(send_message("tight", "two", "second") == OK);
+  /* ...and fails it if the sender loses its access while waiting */
+  start_sender(&first, producer, "tight", "revoked");
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1000) == OK);
+  sim_attach(alice);
+  CHECK(remove_sender("tight", "alice") == OK);
+  pthread_join(first.thread, NULL);
+  CHECK(first.status == ERROR);
+  CHECK(add_sender("tight", "alice") == OK);
+  sim_attach(root);
+  CHECK(update_privileges("alice", 0b1011) == OK);
+  sim_attach(alice);
+  start_sender(&first, producer, "tight", "never");
+  CHECK(remove_mailbox("tight") == OK);
+  pthread_join(first.thread, NULL);
+  CHECK(first.status == ERROR);
+
+  CHECK(add_mailbox_capacity(SECURE_MAILBOX | SHARED_MAILBOX, "small",
+                             "1000", "1001", 4) == OK);
+  plain = open_mailbox("small", OPEN_SEND);
+  CHECK(ring_map(plain, &slots) != NULL && slots == 4);
+  sim_get_stats(&sent);
+  CHECK(close_mailbox(plain) == OK);
+  sim_get_stats(&received);
+  CHECK(received.unmaps == sent.unmaps + 1);
+  CHECK(remove_mailbox("small") == OK);
+
+  /* A subject that cannot be copied in fails the deposit, queueing
+   * nothing */
+  sim_attach(alice);
+  m.m1_p1 = large;
+  m.m1_p2 = NULL;
+  m.m1_p3 = "inbox";
+  m.m1_i1 = sizeof(large);
+  m.m1_i2 = 8;
+  m.m1_i3 = sizeof("inbox");
+  m.m1_ull1 = 1000;
+  CHECK(mailbox_syscall(MAILBOX_DEPOSIT, &m) == ERROR);
+  sim_attach(bob);
+  CHECK(probe_message() == ERROR);
+
+  /* A process that exits leaves nothing behind: the slot it claimed and
+   * the message lent to it go back, the calls it was blocked in are dropped
+   * without a reply, and a process that later gets its endpoint does not
+   * inherit its handles */
+  endpoint_t claimer = sim_spawn(1000), lender = sim_spawn(1001), reborn;
+  struct waiter doomed;
+  int claim;
+  sim_attach(alice);
+  CHECK(add_mailbox_capacity(SECURE_MAILBOX | SHARED_MAILBOX, "exits",
+                             "1000", "1001", 2) == OK);
+  sim_attach(claimer);
+  claim = open_mailbox("exits", OPEN_SEND);
+  CHECK(claim >= 0 && (slot = ring_claim(claim)) >= 0);
+  sim_attach(alice);
+  CHECK(send_message("exits", "lent", "lent out") == OK);
+  start_sender(&first, producer, "exits", "never");
+  sim_attach(lender);
+  CHECK(receive_message_mapped(buf, sizeof(buf), &body, &lease) == OK);
+  CHECK(lease != -1 && strcmp(body, "lent out") == 0);
+  start_waiter(&doomed, sim_spawn(1001), 10000);
+
+  sim_get_stats(&sent);
+  sim_exit(producer);
+  pthread_join(first.thread, NULL);
+  CHECK(first.status == ERROR);
+  sim_exit(doomed.ep);
+  pthread_join(doomed.thread, NULL);
+  CHECK(doomed.status == ERROR);
+  sim_exit(claimer);
+  sim_exit(lender);
+  sim_get_stats(&received);
+  CHECK(received.unmaps == sent.unmaps);
+  do {
+    reborn = sim_spawn(1000);
+  } while (reborn != claimer);
+  sim_attach(reborn);
+  CHECK(ring_post(claim, slot) == ERROR);
+  CHECK(close_mailbox(claim) == ERROR);
+
+  sim_attach(alice);
+  CHECK(send_message("exits", "one", "after") == OK);
+  CHECK(send_message("exits", "two", "after") == OK);
+  CHECK(send_message("exits", "three", "after") == ERROR);
+  sim_attach(bob);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "after") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == OK && strcmp(buf, "after") == 0);
+  CHECK(receive_message(buf, sizeof(buf)) == ERROR);
+  sim_attach(alice);
+  CHECK(remove_mailbox("exits") == OK);
+
+  /* Only the owner or the superuser removes a mailbox */
+  sim_attach(bob);
+  CHECK(remove_mailbox("news") == ERROR);
+  sim_attach(alice);
+  CHECK(remove_mailbox("news") == OK);
+  CHECK(remove_mailbox("news") == ERROR);
+
+  if (failures) {
+    fprintf(stderr, "test_secure: %d check(s) failed\n", failures);
+    return 1;
+  }
+  fprintf(stderr, "test_secure: all checks passed\n");
+  return 0;
+}